@@ -0,0 +1,690 @@
+#ifndef BINARYCLIENTHANDLER_H
+#define BINARYCLIENTHANDLER_H
+
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "BinaryProtocol.h"
+#include "ConnectionRegistry.h"
+#include "Game.h"
+#include "GameNotifier.h"
+#include "Reactor.h"
+#include "ServerConfig.h"
+#include "RateLimit.h"
+#include "Metrics.h"
+#include "CommandExecutor.h"
+#include "ResponseBuffer.h"
+
+// A connection on the bot port. Speaks the length-prefixed frames from
+// BinaryProtocol.h instead of telnet text, but plays in the same games and
+// logs in as the same users as the telnet clients. Every request gets one
+// reply frame; game events arrive as they happen.
+//
+// The reactor splits the frames; they run on a worker, in order, on the
+// bot's strand, which owns username and what the requests touch. A PING
+// with nothing ahead of it is answered on the spot.
+class BinaryClientHandler : public ConnectionHandler,
+                            public std::enable_shared_from_this<BinaryClientHandler> {
+private:
+    std::atomic<int> clientSocket;
+    std::atomic<bool> running;
+    Reactor* reactor;      // Reactor that owns this connection's socket
+    std::string username;  // Empty until LOGIN or REGISTER succeeds
+    std::atomic<bool> loggedIn;  // username is set, for the reactor's login timer
+    std::shared_ptr<CommandExecutor::Strand> strand;
+    std::atomic<int> framesInFlight;   // handed to the strand, not finished
+    std::atomic<bool> framesWaiting;   // the reactor wants to hear when one finishes
+    bool framesStalled;                // stopped at MAX_FRAMES_IN_FLIGHT, the rest left in pending
+    struct QueuedFrame {
+        uint8_t type;
+        std::string payload;
+    };
+    std::vector<QueuedFrame> queuedFrames;  // split from this read, not yet posted to the strand
+    std::string pending;   // Start of a frame not fully received yet
+    std::string resumedOutput; // From a hot restart: output the old process never wrote
+    int resumedObservedGame;   // From a hot restart: game being watched, or -1
+    SessionTimeouts timeouts;  // Login and idle limits, as for telnet clients
+    TimerWheel::TimerId loginTimer;
+    TimerWheel::TimerId idleTimer;
+    std::chrono::steady_clock::time_point lastInput;
+    // Every frame costs a token. Over the rate, frames wait in pending
+    // until one frees up.
+    TokenBucket frameBucket;
+    bool throttled;
+    TimerWheel::TimerId throttleTimer;
+    std::function<void(BinaryClientHandler*)> onDisconnected; // Lets the server drop its reference
+
+public:
+    BinaryClientHandler(int socket, Reactor* reactor)
+        : clientSocket(socket), running(true), reactor(reactor), loggedIn(false),
+          strand(CommandExecutor::getInstance().makeStrand()), framesInFlight(0), framesWaiting(false),
+          framesStalled(false),
+          resumedObservedGame(-1), throttled(false)
+    {
+    }
+
+    ~BinaryClientHandler()
+    {
+        running = false;
+    }
+
+    int getSocket() const override
+    {
+        return clientSocket;
+    }
+
+    WireProtocol getProtocol() const override
+    {
+        return WireProtocol::BINARY;
+    }
+
+    // Called once, on the reactor thread, when the connection goes away
+    void setDisconnectCallback(std::function<void(BinaryClientHandler*)> callback)
+    {
+        onDisconnected = std::move(callback);
+    }
+
+    // Set before the connection is handed to its reactor
+    void setTimeouts(const SessionTimeouts& limits)
+    {
+        timeouts = limits;
+    }
+
+    // Bots have no chat, so only the game rate applies
+    void setRateLimits(const RateLimits& limits)
+    {
+        frameBucket.configure(limits.gamePerSecond, limits.gameBurst);
+    }
+
+    // Reactor callbacks
+    void onOpen() override
+    {
+        startTimers();
+
+        // Only connections carried over by a hot restart have anything to pick up
+        if (!resumedOutput.empty()) {
+            reactor->send(getHandle(), resumedOutput);
+            resumedOutput.clear();
+        }
+        if (username.empty()) {
+            return;
+        }
+        UserManager::getInstance().resumeSession(username, getHandle());
+        auto user = UserManager::getInstance().getUserByUsername(username);
+        auto game = GameManager::getInstance().getGame(resumedObservedGame);
+        if (user && game) {
+            game->addObserver(getHandle());
+            user->setObserving(true);
+            user->setGameId(resumedObservedGame);
+        }
+        resumedObservedGame = -1;
+    }
+
+    // Hot restart: the session and any partial frame. Frames are sent
+    // unfiltered, so the old process's unsent output goes out as is.
+    void saveState(SnapshotWriter& out) const
+    {
+        out.putString(username);
+        out.putString(pending);
+        int observedGame = -1;
+        if (!username.empty()) {
+            auto user = UserManager::getInstance().getUserByUsername(username);
+            if (user && user->isUserObserving()) {
+                observedGame = user->getGameId();
+            }
+        }
+        out.putU32(static_cast<uint32_t>(observedGame));
+    }
+
+    // Called before the connection is added to its new reactor
+    void restoreState(SnapshotReader& in, const std::string& unsent)
+    {
+        username = in.getString();
+        loggedIn = !username.empty();
+        pending = in.getString();
+        resumedObservedGame = static_cast<int>(in.getU32());
+        resumedOutput = unsent;
+    }
+
+    void onData(const char* data, size_t len) override
+    {
+        lastInput = std::chrono::steady_clock::now();
+
+        if (throttled || framesStalled) {
+            pending.append(data, len);
+            if (pending.size() > FLOOD_BYTES) {
+                ServerMetrics::getInstance().recordFloodDisconnect();
+                replyEvent(BinaryProtocol::EV_FLOODING);
+                disconnect();
+            }
+            return;
+        }
+
+        // Work straight from the read buffer unless a frame is split
+        // across reads
+        if (!pending.empty()) {
+            pending.append(data, len);
+            size_t used = processFrames(pending.data(), pending.size());
+            pending.erase(0, used);
+        } else {
+            size_t used = processFrames(data, len);
+            if (used < len && running) {
+                pending.assign(data + used, len - used);
+            }
+        }
+    }
+
+    void onClose() override
+    {
+        disconnect();
+    }
+
+    void disconnect()
+    {
+        if (!running) {
+            return;
+        }
+        running = false;
+
+        // Log out on the strand, after the frames already handed to it
+        auto self = shared_from_this();
+        strand->post([self]() { self->leaveSession(); });
+
+        cancelTimers();
+
+        // Hand the socket back to the reactor to be closed
+        if (clientSocket >= 0) {
+            reactor->removeConnection(getHandle());
+            clientSocket = -1;
+        }
+
+        if (onDisconnected) {
+            onDisconnected(this);
+        }
+    }
+
+private:
+    // Frames held back by the rate limit before the client counts as flooding
+    static const size_t FLOOD_BYTES = 16 * BinaryProtocol::MAX_FRAME;
+    static const int MAX_FRAMES_IN_FLIGHT = 32;
+
+    // On the strand, once the connection has gone
+    void leaveSession()
+    {
+        if (username.empty()) {
+            return;
+        }
+        // Leaving mid-game forfeits, as for telnet players
+        auto user = UserManager::getInstance().getUserByUsername(username);
+        if (user && user->isInGame()) {
+            auto game = GameManager::getInstance().getGame(user->getGameId());
+            if (game && game->getStatus() == GameStatus::PLAYING) {
+                GameNotifier::playerDisconnected(game, user, opponentOf(game, user));
+                game->playerDisconnected(user);
+            }
+        }
+        UserManager::getInstance().logoutUser(getHandle());
+        username = "";
+        loggedIn = false;
+    }
+
+    // Same scheme as TelnetClientHandler: input only records the time, and
+    // a timer that fires early re-arms itself for the remainder
+    void startTimers()
+    {
+        lastInput = std::chrono::steady_clock::now();
+        if (timeouts.login > 0 && !loggedIn) {
+            loginTimer = reactor->runAfter(std::chrono::seconds(timeouts.login), [this]() {
+                loginTimer = TimerWheel::TimerId();
+                if (running && !loggedIn) {
+                    replyEvent(BinaryProtocol::EV_TIMED_OUT);
+                    disconnect();
+                }
+            });
+        }
+        if (timeouts.idle > 0) {
+            armIdleTimer(std::chrono::seconds(timeouts.idle));
+        }
+        // Frames carried over by a hot restart
+        if (!pending.empty()) {
+            throttled = true;
+            armThrottleTimer();
+        }
+    }
+
+    void armIdleTimer(std::chrono::steady_clock::duration delay)
+    {
+        idleTimer = reactor->runAfter(std::chrono::duration_cast<std::chrono::milliseconds>(delay), [this]() {
+            idleTimer = TimerWheel::TimerId();
+            if (!running) {
+                return;
+            }
+            auto limit = std::chrono::seconds(timeouts.idle);
+            auto idleFor = std::chrono::steady_clock::now() - lastInput;
+            if (idleFor < limit) {
+                armIdleTimer(limit - idleFor);
+                return;
+            }
+            replyEvent(BinaryProtocol::EV_TIMED_OUT);
+            disconnect();
+        });
+    }
+
+    void cancelTimers()
+    {
+        TimerWheel::TimerId timers[] = { loginTimer, idleTimer, throttleTimer };
+        loginTimer = idleTimer = throttleTimer = TimerWheel::TimerId();
+        if (reactor->isInLoopThread()) {
+            for (TimerWheel::TimerId timer : timers) {
+                reactor->cancelTimer(timer);
+            }
+            return;
+        }
+        // Disconnected from another thread (server shutdown)
+        Reactor* owner = reactor;
+        reactor->post([owner, timers]() {
+            for (TimerWheel::TimerId timer : timers) {
+                owner->cancelTimer(timer);
+            }
+        });
+    }
+
+    // Handle every complete frame in data and return the bytes consumed
+    size_t processFrames(const char* data, size_t len)
+    {
+        size_t pos = 0;
+        while (running && len - pos >= BinaryProtocol::HEADER_SIZE) {
+            size_t length = BinaryProtocol::getU16(data + pos);
+            if (length == 0 || length > BinaryProtocol::MAX_FRAME) {
+                // Can't find the next frame boundary; give up on the client
+                postFrames();
+                std::string out;
+                BinaryProtocol::appendEvent(out, BinaryProtocol::EV_BAD_FRAME);
+                reply(out);
+                disconnect();
+                return len;
+            }
+            if (len - pos < BinaryProtocol::HEADER_SIZE + length) {
+                break;
+            }
+            if (tooManyInFlight()) {
+                // Leave the rest until the strand catches up
+                framesStalled = true;
+                break;
+            }
+            if (!frameBucket.take(std::chrono::steady_clock::now())) {
+                // Leave this frame and the rest for the throttle timer
+                ServerMetrics::getInstance().recordCommandThrottled();
+                throttled = true;
+                armThrottleTimer();
+                break;
+            }
+            const char* frame = data + pos + BinaryProtocol::HEADER_SIZE;
+            dispatchFrame(static_cast<uint8_t>(frame[0]), frame + 1, length - 1);
+            pos += BinaryProtocol::HEADER_SIZE + length;
+        }
+        postFrames();
+        return pos;
+    }
+
+    // Queue a frame for the strand. A ping with nothing ahead of it is
+    // answered here; the replies before it have reached the reactor.
+    void dispatchFrame(uint8_t type, const char* payload, size_t len)
+    {
+        if (type == BinaryProtocol::PING && framesInFlight.load() == 0) {
+            handleFrame(type, payload, len);
+            return;
+        }
+        framesInFlight.fetch_add(1);
+        queuedFrames.push_back(QueuedFrame{type, std::string(payload, len)});
+    }
+
+    // Hand the frames split from one read to the strand as one job
+    void postFrames()
+    {
+        if (queuedFrames.empty()) {
+            return;
+        }
+        auto self = shared_from_this();
+        std::vector<QueuedFrame> frames(std::make_move_iterator(queuedFrames.begin()),
+                                        std::make_move_iterator(queuedFrames.end()));
+        queuedFrames.clear();
+        strand->post([self, frames = std::move(frames)]() {
+            self->runFrames(frames);
+        });
+    }
+
+    // The strand hands back once this is seen; check again in case the
+    // last frame finished just before
+    bool tooManyInFlight()
+    {
+        if (framesInFlight.load() < MAX_FRAMES_IN_FLIGHT) {
+            return false;
+        }
+        framesWaiting.store(true);
+        return framesInFlight.load() >= MAX_FRAMES_IN_FLIGHT;
+    }
+
+    // On the strand. The replies go to the reactor before the frames
+    // count as finished, so a ping answered there cannot overtake them.
+    void runFrames(const std::vector<QueuedFrame>& frames)
+    {
+        {
+            Reactor::BatchedSends batch;
+            for (const QueuedFrame& frame : frames) {
+                if (running) {
+                    handleFrame(frame.type, frame.payload.data(), frame.payload.size());
+                }
+            }
+        }
+        int remaining = framesInFlight.fetch_sub(static_cast<int>(frames.size())) - static_cast<int>(frames.size());
+        if (remaining <= MAX_FRAMES_IN_FLIGHT / 2 && framesWaiting.exchange(false)) {
+            auto self = shared_from_this();
+            auto finished = std::chrono::steady_clock::now();
+            reactor->post([self, finished]() {
+                ServerMetrics::getInstance().recordCommandHandback(finished);
+                self->framesDrained();
+            });
+        }
+    }
+
+    // Back on the reactor: carry on with the frames left in pending
+    void framesDrained()
+    {
+        if (!running || !framesStalled || throttled) {
+            return;
+        }
+        framesStalled = false;
+        size_t used = processFrames(pending.data(), pending.size());
+        pending.erase(0, used);
+    }
+
+    void armThrottleTimer()
+    {
+        throttleTimer = reactor->runAfter(frameBucket.timeUntilToken(std::chrono::steady_clock::now()), [this]() {
+            throttleTimer = TimerWheel::TimerId();
+            if (!running) {
+                return;
+            }
+            throttled = false;
+            framesStalled = false;
+            size_t used = processFrames(pending.data(), pending.size());
+            pending.erase(0, used);
+        });
+    }
+
+    void reply(std::string_view frames)
+    {
+        if (clientSocket >= 0) {
+            reactor->send(getHandle(), frames);
+        }
+    }
+
+    void replyEvent(uint8_t code, uint32_t gameId = 0)
+    {
+        std::string out;
+        BinaryProtocol::appendEvent(out, code, gameId);
+        reply(out);
+    }
+
+    // Read a u8-length-prefixed string; false if it runs past the payload
+    static bool readString(const char* payload, size_t len, size_t& pos, std::string& value)
+    {
+        if (pos >= len) {
+            return false;
+        }
+        size_t size = static_cast<unsigned char>(payload[pos++]);
+        if (len - pos < size) {
+            return false;
+        }
+        value.assign(payload + pos, size);
+        pos += size;
+        return true;
+    }
+
+    void handleFrame(uint8_t type, const char* payload, size_t len)
+    {
+        if (type != BinaryProtocol::LOGIN && type != BinaryProtocol::REGISTER &&
+            type != BinaryProtocol::PING && username.empty()) {
+            replyEvent(BinaryProtocol::EV_NOT_LOGGED_IN);
+            return;
+        }
+
+        switch (type) {
+        case BinaryProtocol::LOGIN:
+        case BinaryProtocol::REGISTER: {
+            size_t pos = 0;
+            std::string name, password;
+            if (!readString(payload, len, pos, name) || !readString(payload, len, pos, password) ||
+                name.empty() || name == "guest") {
+                replyEvent(BinaryProtocol::EV_BAD_FRAME);
+                return;
+            }
+            handleLogin(type == BinaryProtocol::REGISTER, name, password);
+            break;
+        }
+        case BinaryProtocol::MATCH: {
+            size_t pos = 3;
+            std::string opponentName;
+            if (len < pos || !readString(payload, len, pos, opponentName)) {
+                replyEvent(BinaryProtocol::EV_BAD_FRAME);
+                return;
+            }
+            int timeLimit = BinaryProtocol::getU16(payload + 1);
+            handleMatch(opponentName, payload[0] == 0, timeLimit > 0 ? timeLimit : 600);
+            break;
+        }
+        case BinaryProtocol::MOVE:
+            if (len != 2) {
+                replyEvent(BinaryProtocol::EV_BAD_FRAME);
+                return;
+            }
+            handleMove(static_cast<unsigned char>(payload[0]), static_cast<unsigned char>(payload[1]));
+            break;
+        case BinaryProtocol::RESIGN:
+            handleResign();
+            break;
+        case BinaryProtocol::OBSERVE:
+            if (len != 4) {
+                replyEvent(BinaryProtocol::EV_BAD_FRAME);
+                return;
+            }
+            handleObserve(static_cast<int>(BinaryProtocol::getU32(payload)));
+            break;
+        case BinaryProtocol::UNOBSERVE:
+            handleUnobserve();
+            break;
+        case BinaryProtocol::STATE_REQUEST:
+            handleStateRequest();
+            break;
+        case BinaryProtocol::PING: {
+            if (len != 4) {
+                replyEvent(BinaryProtocol::EV_BAD_FRAME);
+                return;
+            }
+            std::string out;
+            BinaryProtocol::appendPong(out, BinaryProtocol::getU32(payload));
+            reply(out);
+            break;
+        }
+        default:
+            replyEvent(BinaryProtocol::EV_BAD_FRAME);
+            break;
+        }
+    }
+
+    void handleLogin(bool create, const std::string& name, const std::string& password)
+    {
+        if (!username.empty()) {
+            UserManager::getInstance().logoutUser(getHandle());
+            username = "";
+            loggedIn = false;
+        }
+
+        bool ok = create ? UserManager::getInstance().registerUser(name, password, getHandle())
+                         : UserManager::getInstance().loginUser(name, password, getHandle());
+        if (!ok) {
+            replyEvent(create ? BinaryProtocol::EV_NAME_TAKEN : BinaryProtocol::EV_LOGIN_FAILED);
+            return;
+        }
+        username = name;
+        loggedIn = true;
+        replyEvent(BinaryProtocol::EV_OK);
+    }
+
+    void handleMatch(const std::string& opponentName, bool black, int timeLimit)
+    {
+        auto currentUser = UserManager::getInstance().getUserByUsername(username);
+        if (currentUser->isInGame()) {
+            replyEvent(BinaryProtocol::EV_USER_BUSY, currentUser->getGameId());
+            return;
+        }
+
+        auto opponent = UserManager::getInstance().getUserByUsername(opponentName);
+        if (!opponent) {
+            replyEvent(BinaryProtocol::EV_NO_SUCH_USER);
+            return;
+        }
+        if (opponentName == username || opponent->isInGame() || !opponent->getConnection().isValid()) {
+            replyEvent(BinaryProtocol::EV_USER_BUSY);
+            return;
+        }
+
+        std::shared_ptr<User> blackPlayer = black ? currentUser : opponent;
+        std::shared_ptr<User> whitePlayer = black ? opponent : currentUser;
+        int gameId = GameManager::getInstance().createGame(blackPlayer, whitePlayer, timeLimit);
+        auto game = GameManager::getInstance().getGame(gameId);
+
+        GameNotifier::gameStarted(game, opponent);
+
+        ResponseBuffer out;
+        BinaryProtocol::appendEvent(out.str(), BinaryProtocol::EV_GAME_STARTED, gameId, black ? 0 : 1);
+        GameNotifier::appendState(out.str(), game);
+        reply(out.view());
+    }
+
+    void handleMove(int row, int col)
+    {
+        std::shared_ptr<User> currentUser;
+        auto game = currentGame(currentUser);
+        if (!game || game->getStatus() != GameStatus::PLAYING) {
+            replyEvent(BinaryProtocol::EV_NOT_IN_GAME);
+            return;
+        }
+
+        bool isBlack = username == game->getBlackPlayer()->getUsername();
+        if (isBlack != (game->getCurrentTurn() == StoneColor::BLACK)) {
+            replyEvent(BinaryProtocol::EV_NOT_YOUR_TURN, game->getId());
+            return;
+        }
+        if (row >= 15 || col >= 15 || !game->isPositionEmpty(row, col) ||
+            !game->makeMove(currentUser, row, col)) {
+            replyEvent(BinaryProtocol::EV_ILLEGAL_MOVE, game->getId());
+            return;
+        }
+
+        GameNotifier::movePlayed(game, currentUser, opponentOf(game, currentUser), row, col);
+        ResponseBuffer out;
+        GameNotifier::appendMoveFrames(out.str(), game, currentUser, row, col);
+        reply(out.view());
+    }
+
+    void handleResign()
+    {
+        std::shared_ptr<User> currentUser;
+        auto game = currentGame(currentUser);
+        if (!game || game->getStatus() != GameStatus::PLAYING) {
+            replyEvent(BinaryProtocol::EV_NOT_IN_GAME);
+            return;
+        }
+
+        game->resign(currentUser);
+        auto opponent = opponentOf(game, currentUser);
+        GameNotifier::playerResigned(game, currentUser, opponent);
+        ResponseBuffer out;
+        GameNotifier::appendGameOver(out.str(), game, opponent, BinaryProtocol::END_RESIGN);
+        reply(out.view());
+    }
+
+    void handleObserve(int gameId)
+    {
+        auto currentUser = UserManager::getInstance().getUserByUsername(username);
+        if (currentUser->isInGame()) {
+            replyEvent(BinaryProtocol::EV_USER_BUSY, currentUser->getGameId());
+            return;
+        }
+        auto game = GameManager::getInstance().getGame(gameId);
+        if (!game) {
+            replyEvent(BinaryProtocol::EV_NO_SUCH_GAME, gameId);
+            return;
+        }
+
+        if (currentUser->isUserObserving()) {
+            auto oldGame = GameManager::getInstance().getGame(currentUser->getGameId());
+            if (oldGame) {
+                oldGame->removeObserver(getHandle());
+            }
+        }
+        game->addObserver(getHandle());
+        currentUser->setObserving(true);
+        currentUser->setGameId(gameId);
+
+        ResponseBuffer out;
+        BinaryProtocol::appendEvent(out.str(), BinaryProtocol::EV_OK, gameId);
+        GameNotifier::appendState(out.str(), game);
+        reply(out.view());
+    }
+
+    void handleUnobserve()
+    {
+        auto currentUser = UserManager::getInstance().getUserByUsername(username);
+        if (!currentUser->isUserObserving()) {
+            replyEvent(BinaryProtocol::EV_NOT_IN_GAME);
+            return;
+        }
+        auto game = GameManager::getInstance().getGame(currentUser->getGameId());
+        if (game) {
+            game->removeObserver(getHandle());
+        }
+        currentUser->setObserving(false);
+        currentUser->setGameId(-1);
+        replyEvent(BinaryProtocol::EV_OK);
+    }
+
+    void handleStateRequest()
+    {
+        auto currentUser = UserManager::getInstance().getUserByUsername(username);
+        auto game = GameManager::getInstance().getGame(currentUser->getGameId());
+        if (!game || (!currentUser->isInGame() && !currentUser->isUserObserving())) {
+            replyEvent(BinaryProtocol::EV_NOT_IN_GAME);
+            return;
+        }
+        ResponseBuffer out;
+        GameNotifier::appendState(out.str(), game);
+        reply(out.view());
+    }
+
+    // The game this user is playing, if any
+    std::shared_ptr<Game> currentGame(std::shared_ptr<User>& currentUser)
+    {
+        currentUser = UserManager::getInstance().getUserByUsername(username);
+        if (!currentUser->isInGame()) {
+            return nullptr;
+        }
+        return GameManager::getInstance().getGame(currentUser->getGameId());
+    }
+
+    static std::shared_ptr<User> opponentOf(const std::shared_ptr<Game>& game, const std::shared_ptr<User>& player)
+    {
+        if (player->getUsername() == game->getBlackPlayer()->getUsername()) {
+            return game->getWhitePlayer();
+        }
+        return game->getBlackPlayer();
+    }
+};
+
+#endif //BINARYCLIENTHANDLER_H
@@ -0,0 +1,155 @@
+#ifndef BINARYPROTOCOL_H
+#define BINARYPROTOCOL_H
+
+#include <cstdint>
+#include <string>
+
+// Wire format of the bot port. Every frame is
+//
+//     u16 length | u8 type | payload (length - 1 bytes)
+//
+// with all integers big-endian. Rows and columns are 0-based; colors are
+// 0 = black, 1 = white.
+namespace BinaryProtocol {
+    const size_t HEADER_SIZE = 2;
+    const size_t MAX_FRAME = 512;  // length field limit accepted from clients
+
+    // Client -> server
+    const uint8_t LOGIN = 0x01;          // u8 nameLen, name, u8 passLen, pass
+    const uint8_t REGISTER = 0x02;       // same as LOGIN
+    const uint8_t MATCH = 0x03;          // u8 color, u16 timeLimit, u8 nameLen, name
+    const uint8_t MOVE = 0x04;           // u8 row, u8 col
+    const uint8_t RESIGN = 0x05;         // (empty)
+    const uint8_t OBSERVE = 0x06;        // u32 gameId
+    const uint8_t UNOBSERVE = 0x07;      // (empty)
+    const uint8_t STATE_REQUEST = 0x08;  // (empty)
+    const uint8_t PING = 0x09;           // u32 cookie
+
+    // Server -> client
+    const uint8_t EVENT = 0x80;          // u8 code, u32 gameId, u8 arg0, u8 arg1
+    const uint8_t MOVE_PLAYED = 0x81;    // u32 gameId, u8 row, u8 col, u8 color
+    const uint8_t STATE = 0x82;          // u32 gameId, u8 status, u8 turn, u32 blackLeft, u32 whiteLeft, u8 cells[225]
+    const uint8_t CLOCK = 0x83;          // u32 gameId, u32 blackLeft, u32 whiteLeft (seconds)
+    const uint8_t PONG = 0x84;           // u32 cookie
+    const uint8_t TEXT = 0x85;           // chat and other human-readable text
+
+    // EVENT codes
+    const uint8_t EV_OK = 0;
+    const uint8_t EV_GAME_STARTED = 1;   // arg0 = your color
+    const uint8_t EV_GAME_OVER = 2;      // arg0 = winner color (NO_WINNER after a draw), arg1 = reason
+    const uint8_t EV_BAD_FRAME = 16;
+    const uint8_t EV_NOT_LOGGED_IN = 17;
+    const uint8_t EV_LOGIN_FAILED = 18;
+    const uint8_t EV_NAME_TAKEN = 19;
+    const uint8_t EV_NO_SUCH_USER = 20;
+    const uint8_t EV_USER_BUSY = 21;     // in a game, offline, or yourself
+    const uint8_t EV_NOT_IN_GAME = 22;
+    const uint8_t EV_NOT_YOUR_TURN = 23;
+    const uint8_t EV_ILLEGAL_MOVE = 24;
+    const uint8_t EV_NO_SUCH_GAME = 25;
+    const uint8_t EV_TIMED_OUT = 26;     // sent before closing a connection that logged in too late or went idle
+    const uint8_t EV_FLOODING = 27;      // sent before closing a connection that kept sending over its rate
+
+    // EV_GAME_OVER reasons
+    const uint8_t END_FIVE = 0;
+    const uint8_t END_RESIGN = 1;
+    const uint8_t END_DISCONNECT = 2;
+    const uint8_t END_TIMEOUT = 3;
+    const uint8_t END_DRAW = 4;          // the board filled up without five
+    const uint8_t NO_WINNER = 2;
+
+    // Board cells in STATE
+    const uint8_t CELL_EMPTY = 0;
+    const uint8_t CELL_BLACK = 1;
+    const uint8_t CELL_WHITE = 2;
+
+    inline void putU8(std::string& out, uint8_t value) {
+        out += static_cast<char>(value);
+    }
+
+    inline void putU16(std::string& out, uint16_t value) {
+        out += static_cast<char>(value >> 8);
+        out += static_cast<char>(value);
+    }
+
+    inline void putU32(std::string& out, uint32_t value) {
+        out += static_cast<char>(value >> 24);
+        out += static_cast<char>(value >> 16);
+        out += static_cast<char>(value >> 8);
+        out += static_cast<char>(value);
+    }
+
+    inline uint16_t getU16(const char* p) {
+        const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+        return static_cast<uint16_t>((u[0] << 8) | u[1]);
+    }
+
+    inline uint32_t getU32(const char* p) {
+        const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+        return (static_cast<uint32_t>(u[0]) << 24) | (static_cast<uint32_t>(u[1]) << 16) |
+               (static_cast<uint32_t>(u[2]) << 8) | u[3];
+    }
+
+    // Start a frame of the given type; finish it with endFrame()
+    inline size_t beginFrame(std::string& out, uint8_t type) {
+        size_t start = out.size();
+        putU16(out, 0);
+        putU8(out, type);
+        return start;
+    }
+
+    inline void endFrame(std::string& out, size_t start) {
+        size_t length = out.size() - start - HEADER_SIZE;
+        out[start] = static_cast<char>(length >> 8);
+        out[start + 1] = static_cast<char>(length);
+    }
+
+    inline void appendEvent(std::string& out, uint8_t code, uint32_t gameId = 0,
+                            uint8_t arg0 = 0, uint8_t arg1 = 0) {
+        size_t frame = beginFrame(out, EVENT);
+        putU8(out, code);
+        putU32(out, gameId);
+        putU8(out, arg0);
+        putU8(out, arg1);
+        endFrame(out, frame);
+    }
+
+    inline void appendMove(std::string& out, uint32_t gameId, int row, int col, uint8_t color) {
+        size_t frame = beginFrame(out, MOVE_PLAYED);
+        putU32(out, gameId);
+        putU8(out, static_cast<uint8_t>(row));
+        putU8(out, static_cast<uint8_t>(col));
+        putU8(out, color);
+        endFrame(out, frame);
+    }
+
+    inline void appendClock(std::string& out, uint32_t gameId, uint32_t blackLeft, uint32_t whiteLeft) {
+        size_t frame = beginFrame(out, CLOCK);
+        putU32(out, gameId);
+        putU32(out, blackLeft);
+        putU32(out, whiteLeft);
+        endFrame(out, frame);
+    }
+
+    inline void appendPong(std::string& out, uint32_t cookie) {
+        size_t frame = beginFrame(out, PONG);
+        putU32(out, cookie);
+        endFrame(out, frame);
+    }
+
+    // Wrap text meant for a human; a trailing CRLF is dropped
+    inline void appendText(std::string& out, const std::string& text) {
+        size_t length = text.size();
+        while (length > 0 && (text[length - 1] == '\n' || text[length - 1] == '\r')) {
+            length--;
+        }
+        if (length > 0xFFFF - 1) {
+            length = 0xFFFF - 1;
+        }
+        size_t frame = beginFrame(out, TEXT);
+        out.append(text, 0, length);
+        endFrame(out, frame);
+    }
+}
+
+#endif //BINARYPROTOCOL_H
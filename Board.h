@@ -0,0 +1,97 @@
+#ifndef BOARD_H
+#define BOARD_H
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include "Lines.h"
+
+enum class StoneColor { BLACK, WHITE };
+
+// The 15x15 board of a game, held in the Game itself. Each colour's
+// stones are Lines bitboards; their first four words are a 256-bit
+// row-major bitboard with one 16-bit lane per row (bit row * 16 + col; the
+// top bit of every lane stays clear), so whether a cell is free, whether
+// the board is full and how many stones are down are a few word
+// operations, and the rest lets a win be checked with Lines::makesFive.
+// The cells array mirrors the bitboards as the '.', 'X' and 'O'
+// characters that the boards and snapshots are written with.
+class Board {
+public:
+    static const int SIZE = Lines::SIZE;
+    using Bits = Lines::Bits;
+
+    Board() {
+        clear();
+    }
+
+    // Whether a move may go at (row, col): on the board and free
+    bool canPlace(int row, int col) const {
+        if (static_cast<unsigned>(row) >= SIZE || static_cast<unsigned>(col) >= SIZE) {
+            return false;
+        }
+        int bit = row * 16 + col;
+        return (((black[bit >> 6] | white[bit >> 6]) >> (bit & 63)) & 1) == 0;
+    }
+
+    // The caller checks canPlace() first
+    void place(int row, int col, StoneColor color) {
+        Lines::set(color == StoneColor::BLACK ? black : white, row, col);
+        cells[row * SIZE + col] = color == StoneColor::BLACK ? 'X' : 'O';
+    }
+
+    bool isFull() const {
+        for (int i = 0; i < 4; i++) {
+            if ((black[i] | white[i]) != FULL[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int stoneCount() const {
+        int count = 0;
+        for (int i = 0; i < 4; i++) {
+            count += std::popcount(black[i] | white[i]);
+        }
+        return count;
+    }
+
+    char at(int row, int col) const { return cells[row * SIZE + col]; }  // '.', 'X' or 'O'
+    const Bits& stones(StoneColor color) const { return color == StoneColor::BLACK ? black : white; }
+
+    // All SIZE * SIZE cells, row by row
+    const char* data() const { return cells; }
+
+    // Replace the board with cells as data() returns them; anything but
+    // 'X' or 'O' is empty
+    void assign(const char* saved) {
+        clear();
+        for (int row = 0; row < SIZE; row++) {
+            for (int col = 0; col < SIZE; col++) {
+                char cell = saved[row * SIZE + col];
+                if (cell == 'X' || cell == 'O') {
+                    place(row, col, cell == 'X' ? StoneColor::BLACK : StoneColor::WHITE);
+                }
+            }
+        }
+    }
+
+private:
+    void clear() {
+        std::memset(black, 0, sizeof(black));
+        std::memset(white, 0, sizeof(white));
+        std::memset(cells, '.', sizeof(cells));
+    }
+
+    // Every cell: four 15-bit rows per word, three in the last
+    static constexpr uint64_t FULL[4] = {0x7fff7fff7fff7fffULL, 0x7fff7fff7fff7fffULL,
+                                         0x7fff7fff7fff7fffULL, 0x00007fff7fff7fffULL};
+
+    // Bits is the array type the Lines functions take
+    Bits black;
+    Bits white;
+    char cells[SIZE * SIZE];
+};
+
+#endif // BOARD_H
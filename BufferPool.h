@@ -0,0 +1,295 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/uio.h>
+
+#include "Metrics.h"
+
+// Fixed-size piece of a connection's output, one page with its header
+struct IoChunk {
+    static const size_t CAPACITY = 4096 - 2 * sizeof(uint32_t) - sizeof(void*);
+
+    IoChunk* next;
+    uint32_t start;  // first byte not yet written to the socket
+    uint32_t end;    // end of the queued bytes
+    char data[CAPACITY];
+};
+
+// Hands out IoChunks carved from slabs of SLAB_CHUNKS and takes them back
+// on a free list. Slabs are never returned, so once the pool has grown to
+// the reactor's peak backlog, queueing output allocates nothing. One pool
+// per reactor, used only on its loop thread.
+class ChunkPool {
+public:
+    static const size_t SLAB_CHUNKS = 64;
+    static const int64_t SLAB_BYTES = SLAB_CHUNKS * sizeof(IoChunk);
+
+    ChunkPool() : freeList(nullptr), inUse(0) {}
+
+    ~ChunkPool() {
+        ServerMetrics::getInstance().recordChunkPoolBytes(-static_cast<int64_t>(slabs.size() * SLAB_BYTES));
+    }
+
+    ChunkPool(const ChunkPool&) = delete;
+    ChunkPool& operator=(const ChunkPool&) = delete;
+
+    IoChunk* acquire() {
+        if (!freeList) {
+            grow();
+        }
+        IoChunk* chunk = freeList;
+        freeList = chunk->next;
+        chunk->next = nullptr;
+        chunk->start = chunk->end = 0;
+        inUse++;
+        return chunk;
+    }
+
+    void release(IoChunk* chunk) {
+        chunk->next = freeList;
+        freeList = chunk;
+        inUse--;
+    }
+
+    size_t getSlabCount() const { return slabs.size(); }
+    size_t getChunksInUse() const { return inUse; }
+
+private:
+    void grow() {
+        slabs.emplace_back(new IoChunk[SLAB_CHUNKS]);
+        IoChunk* slab = slabs.back().get();
+        for (size_t i = 0; i < SLAB_CHUNKS; i++) {
+            slab[i].next = freeList;
+            freeList = &slab[i];
+        }
+        ServerMetrics::getInstance().recordChunkPoolBytes(SLAB_BYTES);
+    }
+
+    std::vector<std::unique_ptr<IoChunk[]>> slabs;
+    IoChunk* freeList;
+    size_t inUse;
+};
+
+// A connection's pending output as a list of pooled chunks. Appending
+// fills the tail chunk before taking another; bytes written to the socket
+// are consumed from the head, returning emptied chunks to the pool. The
+// chain does not own its pool, so every call that can take or return a
+// chunk is handed it.
+class ChunkChain {
+public:
+    ChunkChain() : head(nullptr), tail(nullptr), bytes(0) {}
+
+    // Must be cleared back into its pool before it goes away
+    ~ChunkChain() {}
+
+    ChunkChain(const ChunkChain&) = delete;
+    ChunkChain& operator=(const ChunkChain&) = delete;
+
+    ChunkChain(ChunkChain&& other) : head(other.head), tail(other.tail), bytes(other.bytes) {
+        other.head = other.tail = nullptr;
+        other.bytes = 0;
+    }
+
+    bool empty() const { return bytes == 0; }
+    size_t size() const { return bytes; }
+
+    void append(ChunkPool& pool, std::string_view data) {
+        while (!data.empty()) {
+            if (!tail || tail->end == IoChunk::CAPACITY) {
+                IoChunk* chunk = pool.acquire();
+                if (tail) {
+                    tail->next = chunk;
+                } else {
+                    head = chunk;
+                }
+                tail = chunk;
+            }
+            size_t room = IoChunk::CAPACITY - tail->end;
+            size_t count = data.size() < room ? data.size() : room;
+            memcpy(tail->data + tail->end, data.data(), count);
+            tail->end += static_cast<uint32_t>(count);
+            bytes += count;
+            data.remove_prefix(count);
+        }
+    }
+
+    // Point up to max iovecs at the unwritten bytes, oldest first, and
+    // return how many were filled. Appending afterwards leaves them valid.
+    int fillIovec(struct iovec* iov, int max) const {
+        int count = 0;
+        for (IoChunk* chunk = head; chunk && count < max; chunk = chunk->next) {
+            if (chunk->end == chunk->start) {
+                continue;
+            }
+            iov[count].iov_base = chunk->data + chunk->start;
+            iov[count].iov_len = chunk->end - chunk->start;
+            count++;
+        }
+        return count;
+    }
+
+    // Drop n bytes that reached the socket
+    void consume(ChunkPool& pool, size_t n) {
+        bytes -= n;
+        while (n > 0 && head) {
+            size_t left = head->end - head->start;
+            if (n < left) {
+                head->start += static_cast<uint32_t>(n);
+                return;
+            }
+            n -= left;
+            popHead(pool);
+        }
+        // Keep no empty chunk around once everything is written
+        if (bytes == 0) {
+            clear(pool);
+        }
+    }
+
+    void clear(ChunkPool& pool) {
+        while (head) {
+            popHead(pool);
+        }
+        bytes = 0;
+    }
+
+    // Unwritten bytes as one string, for handing a connection over
+    std::string toString() const {
+        std::string out;
+        out.reserve(bytes);
+        for (IoChunk* chunk = head; chunk; chunk = chunk->next) {
+            out.append(chunk->data + chunk->start, chunk->end - chunk->start);
+        }
+        return out;
+    }
+
+private:
+    void popHead(ChunkPool& pool) {
+        IoChunk* chunk = head;
+        head = chunk->next;
+        if (!head) {
+            tail = nullptr;
+        }
+        pool.release(chunk);
+    }
+
+    IoChunk* head;
+    IoChunk* tail;
+    size_t bytes;
+};
+
+// Fixed-size blocks for one kind of object, carved from slabs and
+// recycled through a free list. The block size is fixed by the first
+// allocation unless given up front. Not thread-safe.
+class SlabPool {
+public:
+    static const size_t SLAB_BLOCKS = 64;
+
+    explicit SlabPool(size_t blockSize = 0) : blockSize(0), freeList(nullptr) {
+        setBlockSize(blockSize);
+    }
+
+    // Only before the first allocation
+    void setBlockSize(size_t size) {
+        if (slabs.empty() && size > 0) {
+            size = size < sizeof(Block) ? sizeof(Block) : size;
+            blockSize = (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+        }
+    }
+
+    SlabPool(const SlabPool&) = delete;
+    SlabPool& operator=(const SlabPool&) = delete;
+
+    size_t getBlockSize() const { return blockSize; }
+
+    void* allocate() {
+        if (!freeList) {
+            grow();
+        }
+        Block* block = freeList;
+        freeList = block->next;
+        return block;
+    }
+
+    void deallocate(void* p) {
+        Block* block = static_cast<Block*>(p);
+        block->next = freeList;
+        freeList = block;
+    }
+
+private:
+    struct Block {
+        Block* next;
+    };
+
+    void grow() {
+        slabs.emplace_back(new std::max_align_t[blockSize * SLAB_BLOCKS / sizeof(std::max_align_t)]);
+        char* slab = reinterpret_cast<char*>(slabs.back().get());
+        for (size_t i = 0; i < SLAB_BLOCKS; i++) {
+            Block* block = reinterpret_cast<Block*>(slab + i * blockSize);
+            block->next = freeList;
+            freeList = block;
+        }
+    }
+
+    size_t blockSize;
+    Block* freeList;
+    std::vector<std::unique_ptr<std::max_align_t[]>> slabs;
+};
+
+// Standard allocator that serves single objects that fit in the pool's
+// blocks from a SlabPool, and anything else (hash table bucket arrays,
+// say) from the heap. Meant for node-based containers, whose nodes are
+// allocated one at a time; the first node sizes the pool.
+template <typename T>
+class SlabAllocator {
+public:
+    typedef T value_type;
+
+    explicit SlabAllocator(SlabPool* pool) : pool(pool) {}
+
+    template <typename U>
+    SlabAllocator(const SlabAllocator<U>& other) : pool(other.getPool()) {}
+
+    T* allocate(size_t n) {
+        if (n == 1 && pool->getBlockSize() == 0) {
+            pool->setBlockSize(sizeof(T));
+        }
+        if (fitsPool(n)) {
+            return static_cast<T*>(pool->allocate());
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n) {
+        if (fitsPool(n)) {
+            pool->deallocate(p);
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+    SlabPool* getPool() const { return pool; }
+
+    template <typename U>
+    bool operator==(const SlabAllocator<U>& other) const { return pool == other.getPool(); }
+    template <typename U>
+    bool operator!=(const SlabAllocator<U>& other) const { return pool != other.getPool(); }
+
+private:
+    bool fitsPool(size_t n) const {
+        return n == 1 && sizeof(T) <= pool->getBlockSize() && alignof(T) <= alignof(std::max_align_t);
+    }
+
+    SlabPool* pool;
+};
+
+#endif //BUFFERPOOL_H
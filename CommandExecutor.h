@@ -0,0 +1,315 @@
+#ifndef COMMANDEXECUTOR_H
+#define COMMANDEXECUTOR_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Metrics.h"
+
+// Worker threads that run client commands, so the reactors only read,
+// parse and write and never wait on game or user logic.
+//
+// Work is handed over on strands, one per session. A strand runs its
+// jobs one at a time in the order they were posted, so a user's
+// commands never overtake each other, while different users' strands
+// run side by side. A strand with work is queued on one worker; a worker
+// with nothing of its own steals ready strands from the others.
+class CommandExecutor {
+public:
+    class Strand;
+
+private:
+    // Jobs a worker runs from one strand before giving others a turn
+    static const int BATCH = 16;
+
+    struct Job {
+        std::function<void()> task;
+        std::chrono::steady_clock::time_point postedAt;
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<std::shared_ptr<Strand>> ready;  // own work from the front, thieves take the back
+        std::thread thread;
+    };
+
+public:
+    // A serial queue of jobs for one session. Post from any thread.
+    class Strand : public std::enable_shared_from_this<Strand> {
+    public:
+        explicit Strand(CommandExecutor& executor) : executor(executor), scheduled(false) {}
+
+        void post(std::function<void()> task) {
+            // Counted before running is read, so stop() waits for a post
+            // that saw it set to reach a worker before taking them away
+            executor.posters.fetch_add(1, std::memory_order_seq_cst);
+            if (!executor.isRunning()) {
+                executor.leavePost();
+                // No workers (or shut down): run it here, as before
+                task();
+                return;
+            }
+            ServerMetrics::getInstance().recordCommandQueued();
+            bool wake;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                jobs.push_back(Job{std::move(task), std::chrono::steady_clock::now()});
+                wake = !scheduled;
+                scheduled = true;
+            }
+            if (wake) {
+                executor.schedule(shared_from_this());
+            }
+            executor.leavePost();
+        }
+
+    private:
+        friend class CommandExecutor;
+
+        // Run up to BATCH jobs; true if more are waiting
+        bool run() {
+            for (int i = 0; i < BATCH; i++) {
+                Job job;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (jobs.empty()) {
+                        scheduled = false;
+                        return false;
+                    }
+                    job = std::move(jobs.front());
+                    jobs.pop_front();
+                }
+                auto startedAt = std::chrono::steady_clock::now();
+                ServerMetrics::getInstance().recordCommandStarted(startedAt - job.postedAt);
+                try {
+                    job.task();
+                } catch (const std::exception& e) {
+                    // Nobody to rethrow to; keep the worker going
+                    std::cerr << "Command failed: " << e.what() << std::endl;
+                }
+                job.task = nullptr;  // captures go now, not with the next job
+                ServerMetrics::getInstance().recordCommandFinished(std::chrono::steady_clock::now() - startedAt);
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            scheduled = !jobs.empty();
+            return scheduled;
+        }
+
+        CommandExecutor& executor;
+        std::mutex mutex;
+        std::deque<Job> jobs;
+        bool scheduled;  // queued on a worker or being run by one
+    };
+
+    static CommandExecutor& getInstance() {
+        static CommandExecutor instance;
+        return instance;
+    }
+
+    // Start the workers. With none, jobs run on the thread that posts them.
+    void start(int threads) {
+        if (threads <= 0 || !workers.empty()) {
+            return;
+        }
+        for (int i = 0; i < threads; i++) {
+            workers.push_back(std::unique_ptr<Worker>(new Worker()));
+        }
+        running = true;
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i]->thread = std::thread(&CommandExecutor::workerLoop, this, i);
+        }
+    }
+
+    // Run whatever is still queued, then join the workers. Jobs posted
+    // afterwards run on the posting thread. Call from one thread, as with
+    // start().
+    void stop() {
+        if (workers.empty()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        sleepCondition.notify_all();
+        for (auto& worker : workers) {
+            if (worker->thread.joinable()) {
+                worker->thread.join();
+            }
+        }
+        running = false;
+        stopping = false;
+
+        // Posts that saw running set may still be on their way to a
+        // worker's deque; new ones run on their own thread
+        int inFlight;
+        while ((inFlight = posters.load(std::memory_order_seq_cst)) > 0) {
+            posters.wait(inFlight);
+        }
+
+        // Anything posted as the last worker left
+        for (auto& worker : workers) {
+            while (std::shared_ptr<Strand> strand = takeOwn(*worker)) {
+                readyStrands.fetch_sub(1, std::memory_order_seq_cst);
+                while (strand->run()) {
+                }
+            }
+        }
+        workers.clear();
+    }
+
+    // Wait until every job posted so far has run, for a hot restart once
+    // the reactors that post them are paused
+    void drain() {
+        std::unique_lock<std::mutex> lock(drainMutex);
+        draining = true;
+        drainCondition.wait(lock, [this]() { return !running || isIdle(); });
+        draining = false;
+    }
+
+    bool isRunning() const { return running.load(std::memory_order_acquire); }
+    int getThreadCount() const { return static_cast<int>(workers.size()); }
+
+    std::shared_ptr<Strand> makeStrand() {
+        return std::make_shared<Strand>(*this);
+    }
+
+private:
+    CommandExecutor()
+        : running(false), stopping(false), readyStrands(0), activeWorkers(0), sleepers(0), nextWorker(0),
+          posters(0), draining(false) {}
+
+    ~CommandExecutor() {
+        stop();
+    }
+
+    bool isIdle() const {
+        return readyStrands.load(std::memory_order_seq_cst) == 0 && activeWorkers.load(std::memory_order_seq_cst) == 0;
+    }
+
+    // A worker has put a strand down or found none. Paired with drain():
+    // either it sees the counts at zero or we see it waiting.
+    void notifyIfIdle() {
+        if (draining.load(std::memory_order_seq_cst) && isIdle()) {
+            std::lock_guard<std::mutex> lock(drainMutex);
+            drainCondition.notify_all();
+        }
+    }
+
+    void leavePost() {
+        if (posters.fetch_sub(1, std::memory_order_seq_cst) == 1 && !isRunning()) {
+            posters.notify_all();  // stop() is waiting
+        }
+    }
+
+    // Queue a strand that has work. A worker requeues onto its own deque
+    // (the strand's data is warm there); anyone else spreads strands round
+    // robin. A sleeping worker is woken only if there is one.
+    void schedule(std::shared_ptr<Strand> strand) {
+        Worker* target = currentWorker;
+        if (!target || currentExecutor != this) {
+            target = workers[nextWorker.fetch_add(1, std::memory_order_relaxed) % workers.size()].get();
+        }
+        // Counted first, so drain() never misses it on its way in. Paired
+        // with the check in workerLoop(): either the sleeper sees the
+        // strand or we see the sleeper.
+        readyStrands.fetch_add(1, std::memory_order_seq_cst);
+        {
+            std::lock_guard<std::mutex> lock(target->mutex);
+            target->ready.push_back(std::move(strand));
+        }
+        if (sleepers.load(std::memory_order_seq_cst) > 0) {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            sleepCondition.notify_one();
+        }
+    }
+
+    std::shared_ptr<Strand> takeOwn(Worker& worker) {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.ready.empty()) {
+            return nullptr;
+        }
+        std::shared_ptr<Strand> strand = std::move(worker.ready.front());
+        worker.ready.pop_front();
+        return strand;
+    }
+
+    std::shared_ptr<Strand> steal(size_t self) {
+        for (size_t i = 1; i < workers.size(); i++) {
+            Worker& victim = *workers[(self + i) % workers.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.ready.empty()) {
+                std::shared_ptr<Strand> strand = std::move(victim.ready.back());
+                victim.ready.pop_back();
+                ServerMetrics::getInstance().recordCommandSteal();
+                return strand;
+            }
+        }
+        return nullptr;
+    }
+
+    void workerLoop(size_t index) {
+        Worker& self = *workers[index];
+        currentWorker = &self;
+        currentExecutor = this;
+        while (true) {
+            // Counted busy before taking work so drain() never sees a
+            // strand in neither place
+            activeWorkers.fetch_add(1, std::memory_order_seq_cst);
+            std::shared_ptr<Strand> strand = takeOwn(self);
+            if (!strand) {
+                strand = steal(index);
+            }
+            if (strand) {
+                readyStrands.fetch_sub(1, std::memory_order_seq_cst);
+                if (strand->run()) {
+                    schedule(std::move(strand));
+                }
+                activeWorkers.fetch_sub(1, std::memory_order_seq_cst);
+                notifyIfIdle();
+                continue;
+            }
+            activeWorkers.fetch_sub(1, std::memory_order_seq_cst);
+            notifyIfIdle();
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleepers.fetch_add(1, std::memory_order_seq_cst);
+            sleepCondition.wait(lock, [this]() {
+                return readyStrands.load(std::memory_order_seq_cst) > 0 || stopping;
+            });
+            sleepers.fetch_sub(1, std::memory_order_seq_cst);
+            if (stopping && readyStrands.load(std::memory_order_seq_cst) == 0) {
+                break;
+            }
+        }
+        currentWorker = nullptr;
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<bool> running;
+    bool stopping;                  // guarded by sleepMutex
+    std::atomic<int> readyStrands;  // queued on some worker, not yet taken
+    std::atomic<int> activeWorkers; // looking for or running a strand
+    std::atomic<int> sleepers;
+    std::atomic<size_t> nextWorker;
+    std::atomic<int> posters;       // in Strand::post(), past the running check
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+    std::atomic<bool> draining;     // set under drainMutex
+    std::mutex drainMutex;          // with drainCondition, wakes drain()
+    std::condition_variable drainCondition;
+
+    static inline thread_local Worker* currentWorker = nullptr;
+    static inline thread_local CommandExecutor* currentExecutor = nullptr;
+};
+
+#endif //COMMANDEXECUTOR_H
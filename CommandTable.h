@@ -0,0 +1,249 @@
+#ifndef COMMANDTABLE_H
+#define COMMANDTABLE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Verbs of the text command language
+enum class Command : uint8_t {
+    LOGIN, GUEST, REGISTER, EXIT, HELP, TESTSAVE,
+    WHO, STATS, INFO, PASSWD, QUIET, NONQUIET, BLOCK, UNBLOCK,
+    SHOUT, TELL, KIBITZ,
+    LISTMAIL, READMAIL, DELETEMAIL, MAIL,
+    GAME, MATCH, RESIGN, REFRESH, OBSERVE, UNOBSERVE
+};
+
+// How a move token such as "H8" parsed
+enum class MoveSyntax {
+    NOT_A_MOVE,     // not a letter followed by digits; try it as a verb
+    MALFORMED,      // row number too large to read
+    OUT_OF_BOUNDS,  // off the 15x15 board
+    VALID
+};
+
+// The one table of text commands, for every front end that speaks the
+// line protocol. Verbs are found with a perfect hash worked out by the
+// compiler, so a lookup is one hash of the verb (lowercased as it goes)
+// and one compare, with no allocation.
+class CommandTable {
+public:
+    // Flags on a command
+    static const uint8_t BEFORE_LOGIN = 1;  // allowed before login or guest
+    static const uint8_t CHAT = 2;          // charged to the chat rate limit
+    static const uint8_t SESSION = 4;       // decides how the next lines are read, so they wait for it
+
+    struct Spec {
+        std::string_view verb;  // lowercase
+        Command command;
+        uint8_t flags;
+    };
+
+    // A line as the reactor parsed it, ready to hand to a worker
+    struct Parsed {
+        std::string line;
+        const Spec* spec;  // the verb's command; null for a move or an unknown verb
+        MoveSyntax move;
+        int row, col;      // if move is VALID
+    };
+
+    static const int BOARD_SIZE = 15;
+
+    static Parsed parse(std::string line) {
+        Parsed parsed{std::move(line), nullptr, MoveSyntax::NOT_A_MOVE, 0, 0};
+        std::string_view verb = verbOf(parsed.line);
+        parsed.move = parseMove(verb, parsed.row, parsed.col);
+        if (parsed.move == MoveSyntax::NOT_A_MOVE) {
+            parsed.spec = find(verb);
+        }
+        return parsed;
+    }
+
+    // The first word of a line
+    static std::string_view verbOf(std::string_view line) {
+        size_t start = line.find_first_not_of(' ');
+        if (start == std::string_view::npos) {
+            return std::string_view();
+        }
+        return line.substr(start, line.find(' ', start) - start);
+    }
+
+    // The command a verb names, in any case, or null
+    static const Spec* find(std::string_view verb) {
+        if (verb.empty() || verb.size() > MAX_VERB) {
+            return nullptr;
+        }
+        uint8_t index = SLOTS[hashVerb(SEED, verb) & (TABLE_SIZE - 1)];
+        if (index == EMPTY) {
+            return nullptr;
+        }
+        const Spec& spec = SPECS[index];
+        if (spec.verb.size() != verb.size()) {
+            return nullptr;
+        }
+        for (size_t i = 0; i < verb.size(); i++) {
+            if (lower(verb[i]) != spec.verb[i]) {
+                return nullptr;
+            }
+        }
+        return &spec;
+    }
+
+    // A move is a column letter and a 1-based row; row and col come back
+    // 0-based
+    static MoveSyntax parseMove(std::string_view token, int& row, int& col) {
+        if (token.size() < 2 || !isLetter(token[0])) {
+            return MoveSyntax::NOT_A_MOVE;
+        }
+        int64_t number = 0;
+        bool overflow = false;
+        for (size_t i = 1; i < token.size(); i++) {
+            if (token[i] < '0' || token[i] > '9') {
+                return MoveSyntax::NOT_A_MOVE;
+            }
+            number = number * 10 + (token[i] - '0');
+            if (number > INT32_MAX) {
+                // Keep checking the rest is digits
+                overflow = true;
+                number = 0;
+            }
+        }
+        if (overflow) {
+            return MoveSyntax::MALFORMED;
+        }
+        col = (token[0] & ~0x20) - 'A';
+        if (col >= BOARD_SIZE || number < 1 || number > BOARD_SIZE) {
+            return MoveSyntax::OUT_OF_BOUNDS;
+        }
+        row = static_cast<int>(number) - 1;
+        return MoveSyntax::VALID;
+    }
+
+    // Split a line at spaces into views of it, reusing tokens' capacity
+    static void split(std::string_view line, std::vector<std::string_view>& tokens) {
+        tokens.clear();
+        size_t pos = 0;
+        while (pos < line.size()) {
+            size_t start = line.find_first_not_of(" \t", pos);
+            if (start == std::string_view::npos) {
+                break;
+            }
+            size_t end = line.find_first_of(" \t", start);
+            if (end == std::string_view::npos) {
+                end = line.size();
+            }
+            tokens.push_back(line.substr(start, end - start));
+            pos = end;
+        }
+    }
+
+    // What follows token (a view into line) and the space after it
+    static std::string restOfLine(std::string_view line, std::string_view token) {
+        size_t pos = static_cast<size_t>(token.data() - line.data()) + token.size() + 1;
+        if (pos >= line.size()) {
+            return "";
+        }
+        return std::string(line.substr(pos));
+    }
+
+private:
+    static constexpr Spec SPECS[] = {
+        { "login", Command::LOGIN, BEFORE_LOGIN | SESSION },
+        { "guest", Command::GUEST, BEFORE_LOGIN },
+        { "register", Command::REGISTER, BEFORE_LOGIN | SESSION },
+        { "exit", Command::EXIT, BEFORE_LOGIN | SESSION },
+        { "quit", Command::EXIT, BEFORE_LOGIN | SESSION },
+        { "help", Command::HELP, BEFORE_LOGIN },
+        { "?", Command::HELP, BEFORE_LOGIN },
+        { "testsave", Command::TESTSAVE, BEFORE_LOGIN },
+        { "who", Command::WHO, 0 },
+        { "stats", Command::STATS, 0 },
+        { "info", Command::INFO, 0 },
+        { "passwd", Command::PASSWD, 0 },
+        { "quiet", Command::QUIET, 0 },
+        { "nonquiet", Command::NONQUIET, 0 },
+        { "block", Command::BLOCK, 0 },
+        { "unblock", Command::UNBLOCK, 0 },
+        { "shout", Command::SHOUT, CHAT },
+        { "tell", Command::TELL, CHAT },
+        { "kibitz", Command::KIBITZ, CHAT },
+        { "'", Command::KIBITZ, CHAT },
+        { "listmail", Command::LISTMAIL, 0 },
+        { "readmail", Command::READMAIL, 0 },
+        { "deletemail", Command::DELETEMAIL, 0 },
+        { "mail", Command::MAIL, CHAT | SESSION },
+        { "game", Command::GAME, BEFORE_LOGIN },
+        { "match", Command::MATCH, 0 },
+        { "resign", Command::RESIGN, 0 },
+        { "refresh", Command::REFRESH, 0 },
+        { "observe", Command::OBSERVE, 0 },
+        { "unobserve", Command::UNOBSERVE, 0 },
+    };
+
+    static constexpr size_t COUNT = sizeof(SPECS) / sizeof(SPECS[0]);
+    static constexpr size_t TABLE_SIZE = 128;  // power of two, a few times COUNT
+    static constexpr uint8_t EMPTY = 0xff;
+    static constexpr size_t MAX_VERB = 16;
+
+    static constexpr char lower(char c) {
+        return (c >= 'A' && c <= 'Z') ? static_cast<char>(c | 0x20) : c;
+    }
+
+    static constexpr bool isLetter(char c) {
+        return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+    }
+
+    // FNV-1a over the lowercased verb, started from seed
+    static constexpr uint32_t hashVerb(uint32_t seed, std::string_view verb) {
+        uint32_t hash = 2166136261u ^ seed;
+        for (char c : verb) {
+            hash ^= static_cast<unsigned char>(lower(c));
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    // The first seed that sends every verb to its own slot
+    static constexpr uint32_t findSeed() {
+        for (uint32_t seed = 1; seed < 100000; seed++) {
+            bool used[TABLE_SIZE] = {};
+            bool clash = false;
+            for (size_t i = 0; i < COUNT && !clash; i++) {
+                uint32_t slot = hashVerb(seed, SPECS[i].verb) & (TABLE_SIZE - 1);
+                clash = used[slot];
+                used[slot] = true;
+            }
+            if (!clash) {
+                return seed;
+            }
+        }
+        return 0;
+    }
+
+    static constexpr std::array<uint8_t, TABLE_SIZE> buildSlots(uint32_t seed) {
+        std::array<uint8_t, TABLE_SIZE> slots = {};
+        for (size_t i = 0; i < TABLE_SIZE; i++) {
+            slots[i] = EMPTY;
+        }
+        for (size_t i = 0; i < COUNT; i++) {
+            slots[hashVerb(seed, SPECS[i].verb) & (TABLE_SIZE - 1)] = static_cast<uint8_t>(i);
+        }
+        return slots;
+    }
+
+public:
+    // The hash's seed and the slot of each verb, defined below once the
+    // functions that work them out are complete
+    static const uint32_t SEED;
+    static const std::array<uint8_t, TABLE_SIZE> SLOTS;
+};
+
+inline constexpr uint32_t CommandTable::SEED = CommandTable::findSeed();
+static_assert(CommandTable::SEED != 0, "no perfect hash seed for the command verbs");
+inline constexpr std::array<uint8_t, CommandTable::TABLE_SIZE> CommandTable::SLOTS =
+    CommandTable::buildSlots(CommandTable::SEED);
+
+#endif //COMMANDTABLE_H
@@ -0,0 +1,121 @@
+#ifndef CONNECTIONREGISTRY_H
+#define CONNECTIONREGISTRY_H
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/resource.h>
+
+#include "BinaryProtocol.h"
+#include "Reactor.h"
+
+// Maps each open connection to the reactor that owns it, so any thread can
+// queue output for a connection without writing to the socket itself.
+// Slots are indexed by fd and looked up with plain atomic loads, so fanning
+// a message out to many connections never takes a lock. A handle whose
+// connection has closed fails the generation check and is ignored.
+class ConnectionRegistry {
+private:
+    struct Slot {
+        std::atomic<uint32_t> generation;  // of the current or last connection
+        std::atomic<Reactor*> owner;       // null while the slot is free
+        std::atomic<WireProtocol> protocol;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    int size;
+
+    ConnectionRegistry() {
+        struct rlimit limit;
+        size = 65536;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+            size = static_cast<int>(std::min<rlim_t>(limit.rlim_cur, 1 << 20));
+        }
+        slots.reset(new Slot[size]);
+        for (int i = 0; i < size; i++) {
+            slots[i].generation = 0;
+            slots[i].owner = nullptr;
+            slots[i].protocol = WireProtocol::TELNET;
+        }
+    }
+
+    // Owning reactor of a live handle, or null if it has closed
+    Reactor* lookup(ConnectionHandle conn) const {
+        if (!conn.isValid() || conn.slot >= static_cast<uint32_t>(size)) {
+            return nullptr;
+        }
+        const Slot& slot = slots[conn.slot];
+        if (slot.generation.load(std::memory_order_acquire) != conn.generation) {
+            return nullptr;
+        }
+        return slot.owner.load(std::memory_order_acquire);
+    }
+
+public:
+    static ConnectionRegistry& getInstance() {
+        static ConnectionRegistry instance;
+        return instance;
+    }
+
+    // Called by the owning reactor when it registers a socket. Returns the
+    // new connection's handle, or an invalid handle if fd is out of range.
+    ConnectionHandle add(int fd, Reactor* reactor, WireProtocol protocol) {
+        if (fd < 0 || fd >= size) {
+            return ConnectionHandle();
+        }
+        Slot& slot = slots[fd];
+        uint32_t generation = slot.generation.load(std::memory_order_relaxed) + 1;
+        if (generation == 0) {
+            generation = 1;
+        }
+        slot.owner.store(reactor, std::memory_order_release);
+        slot.protocol.store(protocol, std::memory_order_release);
+        slot.generation.store(generation, std::memory_order_release);
+        return ConnectionHandle(static_cast<uint32_t>(fd), generation);
+    }
+
+    // Called by the owning reactor before it closes the socket
+    void remove(ConnectionHandle conn) {
+        if (lookup(conn)) {
+            slots[conn.slot].owner.store(nullptr, std::memory_order_release);
+        }
+    }
+
+    bool isOpen(ConnectionHandle conn) const {
+        return lookup(conn) != nullptr;
+    }
+
+    WireProtocol getProtocol(ConnectionHandle conn) const {
+        if (conn.slot >= static_cast<uint32_t>(size)) {
+            return WireProtocol::TELNET;
+        }
+        return slots[conn.slot].protocol.load(std::memory_order_acquire);
+    }
+
+    // Queue data on a connection from any thread; false if it has closed.
+    // The slot can be reused between the lookup and the send, so the
+    // reactor checks the generation again on its own thread.
+    bool send(ConnectionHandle conn, std::string_view data) {
+        Reactor* reactor = lookup(conn);
+        return reactor && reactor->send(conn, data);
+    }
+
+    // Send a line meant for a person. Bot connections get it wrapped in a
+    // TEXT frame so it cannot break their framing.
+    bool sendText(ConnectionHandle conn, const std::string& text) {
+        Reactor* reactor = lookup(conn);
+        if (!reactor) {
+            return false;
+        }
+        if (getProtocol(conn) == WireProtocol::BINARY) {
+            std::string frame;
+            BinaryProtocol::appendText(frame, text);
+            return reactor->send(conn, frame);
+        }
+        return reactor->send(conn, text);
+    }
+};
+
+#endif //CONNECTIONREGISTRY_H
@@ -0,0 +1,86 @@
+#ifndef DEFLATEFILTER_H
+#define DEFLATEFILTER_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <zlib.h>
+
+#include "Metrics.h"
+#include "Reactor.h"
+
+// zlib output stream for MCCP2. One deflate stream lives as long as the
+// connection compresses, so later batches reuse the dictionary built from
+// earlier ones (boards and game lists repeat a lot). Each batch ends with
+// Z_SYNC_FLUSH so the client can decode it without waiting for more. The
+// byte counts are shared with the metrics report, which reads them while
+// the connection is open.
+class DeflateFilter : public OutputFilter {
+private:
+    z_stream stream;
+    bool ready;
+    std::shared_ptr<CompressionCounters> counters;
+
+    void run(const char* data, size_t len, int flush, std::string& out) {
+        char chunk[4096];
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        stream.avail_in = static_cast<uInt>(len);
+        do {
+            stream.next_out = reinterpret_cast<Bytef*>(chunk);
+            stream.avail_out = sizeof(chunk);
+            int result = deflate(&stream, flush);
+            if (result == Z_STREAM_ERROR) {
+                return;
+            }
+            size_t produced = sizeof(chunk) - stream.avail_out;
+            out.append(chunk, produced);
+            counters->bytesOut.fetch_add(produced, std::memory_order_relaxed);
+        } while (stream.avail_out == 0);
+    }
+
+public:
+    explicit DeflateFilter(int level = Z_DEFAULT_COMPRESSION) : ready(false), counters(std::make_shared<CompressionCounters>()) {
+        memset(&stream, 0, sizeof(stream));
+        ready = deflateInit(&stream, level) == Z_OK;
+    }
+
+    ~DeflateFilter() {
+        if (ready) {
+            deflateEnd(&stream);
+        }
+    }
+
+    DeflateFilter(const DeflateFilter&) = delete;
+    DeflateFilter& operator=(const DeflateFilter&) = delete;
+
+    bool isReady() const { return ready; }
+
+    void write(std::string_view data, std::string& out) override {
+        if (ready && !data.empty()) {
+            counters->bytesIn.fetch_add(data.size(), std::memory_order_relaxed);
+            run(data.data(), data.size(), Z_NO_FLUSH, out);
+        }
+    }
+
+    void flush(std::string& out) override {
+        if (ready) {
+            run(nullptr, 0, Z_SYNC_FLUSH, out);
+        }
+    }
+
+    void finish(std::string& out) override {
+        if (ready) {
+            run(nullptr, 0, Z_FINISH, out);
+        }
+    }
+
+    uint64_t getBytesIn() const { return counters->bytesIn; }
+    uint64_t getBytesOut() const { return counters->bytesOut; }
+    const std::shared_ptr<CompressionCounters>& getCounters() const { return counters; }
+
+    // Uncompressed bytes per byte sent
+    double getRatio() const { return counters->getRatio(); }
+};
+
+#endif //DEFLATEFILTER_H
@@ -0,0 +1,614 @@
+#ifndef EPOLLREACTOR_H
+#define EPOLLREACTOR_H
+
+#include <climits>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+
+#include "BufferPool.h"
+#include "ConnectionRegistry.h"
+#include "Metrics.h"
+#include "Reactor.h"
+#include "SocketUtils.h"
+
+// Readiness-based reactor built on level-triggered epoll
+class EpollReactor : public Reactor {
+public:
+    explicit EpollReactor(int id)
+        : Reactor(id), epollFd(-1), wakeFd(-1),
+          connections(0, std::hash<int>(), std::equal_to<int>(), ConnectionAllocator(&connectionSlab)) {}
+
+    ~EpollReactor() {
+        stop();
+    }
+
+    const char* getBackendName() const override { return "epoll"; }
+
+    bool start() override {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd < 0) {
+            perror("epoll_create1");
+            return false;
+        }
+
+        // eventfd used to wake the loop when work is posted from another thread
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wakeFd < 0) {
+            perror("eventfd");
+            close(epollFd);
+            epollFd = -1;
+            return false;
+        }
+
+        // timerfd that drives the timer wheel
+        timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timerFd < 0) {
+            perror("timerfd_create");
+            close(wakeFd);
+            close(epollFd);
+            wakeFd = epollFd = -1;
+            return false;
+        }
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = wakeFd;
+        struct epoll_event timerEv;
+        timerEv.events = EPOLLIN;
+        timerEv.data.fd = timerFd;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev) < 0 ||
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &timerEv) < 0) {
+            perror("epoll_ctl wakeFd");
+            close(timerFd);
+            close(wakeFd);
+            close(epollFd);
+            timerFd = wakeFd = epollFd = -1;
+            return false;
+        }
+
+        running = true;
+        loopThread = std::thread(&EpollReactor::run, this);
+        return true;
+    }
+
+    void stop() override {
+        if (!running.exchange(false)) {
+            return;
+        }
+        wakeup();
+        if (loopThread.joinable()) {
+            loopThread.join();
+        }
+
+        // Close whatever is still registered
+        for (auto& pair : connections) {
+            ConnectionRegistry::getInstance().remove(pair.second.handle);
+            dropOutput(pair.second);
+            close(pair.first);
+        }
+        connections.clear();
+        listeners.clear();
+        connectionCount = 0;
+
+        close(timerFd);
+        close(wakeFd);
+        close(epollFd);
+        timerFd = wakeFd = epollFd = -1;
+    }
+
+    void pause() override {
+        if (!running.exchange(false)) {
+            return;
+        }
+        wakeup();
+        if (loopThread.joinable()) {
+            loopThread.join();
+        }
+    }
+
+    std::vector<ReleasedConnection> release() override {
+        // Output sent from other reactors after our loop stopped
+        drainOutbox([this](ConnectionHandle handle, std::string_view data) {
+            auto it = findConnection(handle);
+            if (it != connections.end()) {
+                appendOutput(it->second, data);
+            }
+        });
+
+        std::vector<ReleasedConnection> released;
+        for (auto& pair : connections) {
+            int fd = pair.first;
+            Connection& conn = pair.second;
+            ConnectionRegistry::getInstance().remove(conn.handle);
+            if (conn.closing || conn.peerClosed) {
+                // Already on its way out
+                dropOutput(conn);
+                close(fd);
+                continue;
+            }
+
+            if (conn.filter) {
+                std::string tail;
+                conn.filter->finish(tail);
+                conn.filter.reset();
+                appendOutput(conn, tail);
+            }
+
+            // Write what the socket takes now; the rest goes to the next process
+            flush(fd);
+            ReleasedConnection out;
+            out.handler = conn.handler;
+            out.fd = fd;
+            out.unsent = conn.output.toString();
+            dropOutput(conn);
+            released.push_back(std::move(out));
+        }
+        connections.clear();
+        listeners.clear();
+        dirtyFds.clear();
+        connectionCount = 0;
+
+        close(timerFd);
+        close(wakeFd);
+        close(epollFd);
+        timerFd = wakeFd = epollFd = -1;
+        return released;
+    }
+
+    void addListener(int fd, AcceptCallback onAccept) override {
+        post([this, fd, onAccept]() {
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.fd = fd;
+            if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+                perror("epoll_ctl add listener");
+                return;
+            }
+            listeners[fd] = onAccept;
+        });
+    }
+
+    void addConnection(std::shared_ptr<ConnectionHandler> handler) override {
+        connectionCount++;
+        post([this, handler]() {
+            int fd = handler->getSocket();
+            struct epoll_event ev;
+            ev.events = EPOLLIN | EPOLLRDHUP;
+            ev.data.fd = fd;
+            if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+                perror("epoll_ctl add");
+                close(fd);
+                connectionCount--;
+                return;
+            }
+            ConnectionHandle handle = ConnectionRegistry::getInstance().add(fd, this, handler->getProtocol());
+            if (!handle.isValid()) {
+                std::cerr << "No connection slot for socket " << fd << std::endl;
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+                close(fd);
+                connectionCount--;
+                return;
+            }
+            Connection& conn = connections[fd];
+            conn.handler = handler;
+            conn.handle = handle;
+            handler->setHandle(handle);
+            handler->onOpen();
+        });
+    }
+
+    void removeConnection(ConnectionHandle handle) override {
+        post([this, handle]() {
+            auto it = findConnection(handle);
+            if (it == connections.end()) {
+                return;
+            }
+            finishFilterBatch(it->first, it->second);
+            it->second.closing = true;
+
+            // Let queued output reach the socket before closing it
+            if (it->second.output.empty()) {
+                closeConnection(it);
+            }
+        });
+    }
+
+    bool send(ConnectionHandle handle, std::string_view data) override {
+        if (!isInLoopThread()) {
+            enqueueOutbound(handle, data);
+            return true;
+        }
+        catchUpOutbox();
+
+        auto it = findConnection(handle);
+        if (it == connections.end() || it->second.closing || it->second.peerClosed) {
+            return false;
+        }
+        int fd = it->first;
+        Connection& conn = it->second;
+        if (conn.lastOutputTick != loopTick) {
+            conn.lastOutputTick = loopTick;
+            conn.responses++;
+        }
+
+        if (!conn.filter) {
+            return queueOutput(fd, conn, data);
+        }
+
+        // The filter's output is completed by finishFilterBatch() at the
+        // end of this loop iteration
+        if (!conn.filterPending) {
+            conn.filterPending = true;
+            dirtyFds.push_back(fd);
+        }
+        filterScratch.clear();
+        conn.filter->write(data, filterScratch);
+        return queueOutput(fd, conn, filterScratch);
+    }
+
+    void setOutputFilter(ConnectionHandle handle, std::shared_ptr<OutputFilter> filter) override {
+        if (!isInLoopThread()) {
+            post([this, handle, filter]() { setOutputFilter(handle, filter); });
+            return;
+        }
+
+        auto it = findConnection(handle);
+        if (it == connections.end()) {
+            return;
+        }
+        Connection& conn = it->second;
+        if (conn.filter) {
+            std::string tail;
+            conn.filter->finish(tail);
+            conn.filterPending = false;
+            queueOutput(it->first, conn, tail);
+        }
+        conn.filter = filter;
+    }
+
+    bool whenFlushed(ConnectionHandle handle, std::function<void()> callback) override {
+        auto it = findConnection(handle);
+        if (it == connections.end() || it->second.closing || it->second.peerClosed) {
+            return false;
+        }
+        Connection& conn = it->second;
+        if (conn.output.empty() && !conn.filterPending) {
+            return false;
+        }
+        conn.onFlushed = std::move(callback);
+        return true;
+    }
+
+protected:
+    void wakeup() override {
+        uint64_t one = 1;
+        ssize_t n = write(wakeFd, &one, sizeof(one));
+        (void)n;
+    }
+
+private:
+    void run() {
+        const int MAX_EVENTS = 64;
+        struct epoll_event events[MAX_EVENTS];
+
+        while (running) {
+            int n = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("epoll_wait");
+                break;
+            }
+            auto readyTime = std::chrono::steady_clock::now();
+
+            for (int i = 0; i < n; i++) {
+                int fd = events[i].data.fd;
+                if (fd == wakeFd) {
+                    uint64_t count;
+                    ssize_t r = read(wakeFd, &count, sizeof(count));
+                    (void)r;
+                    continue;
+                }
+                if (fd == timerFd) {
+                    uint64_t expirations;
+                    ssize_t r = read(timerFd, &expirations, sizeof(expirations));
+                    (void)r;
+                    expireTimers();
+                    continue;
+                }
+
+                auto listener = listeners.find(fd);
+                if (listener != listeners.end()) {
+                    handleAccept(fd, listener->second, readyTime);
+                    continue;
+                }
+                if (events[i].events & EPOLLOUT) {
+                    flush(fd);
+                }
+                if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                    // Reset or failed socket; nothing more will be read from it
+                    handleHangup(fd);
+                } else if (events[i].events & (EPOLLIN | EPOLLRDHUP)) {
+                    // On EPOLLRDHUP recv() drains what is left, then returns 0
+                    handleRead(fd);
+                }
+            }
+
+            runTasks();
+            flushDirty();
+        }
+
+        // Drain anything posted during shutdown
+        runTasks();
+    }
+
+    // Accept every pending connection on a ready listener
+    void handleAccept(int listenFd, const AcceptCallback& onAccept,
+                      std::chrono::steady_clock::time_point readyTime) {
+        while (true) {
+            int clientSocket = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (clientSocket < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    perror("accept4");
+                }
+                return;
+            }
+            ServerMetrics::getInstance().recordAccept(readyTime);
+            onAccept(clientSocket);
+        }
+    }
+
+    void handleRead(int fd) {
+        auto it = connections.find(fd);
+        if (it == connections.end() || it->second.peerClosed) {
+            return;
+        }
+        // Keep the handler alive while its callbacks run
+        std::shared_ptr<ConnectionHandler> handler = it->second.handler;
+
+        ssize_t nbytes = recv(fd, readBuffer, sizeof(readBuffer), 0);
+        if (nbytes > 0) {
+            handler->onData(readBuffer, static_cast<size_t>(nbytes));
+        }
+        else if (nbytes == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            // Peer closed the connection or the socket failed
+            handleHangup(fd);
+        }
+    }
+
+    // Tell the handler its peer is gone. The handler's disconnect path
+    // calls removeConnection(), so the socket is closed and the handler
+    // released before this loop iteration ends.
+    void handleHangup(int fd) {
+        auto it = connections.find(fd);
+        if (it == connections.end() || it->second.peerClosed) {
+            return;
+        }
+        std::shared_ptr<ConnectionHandler> handler = it->second.handler;
+        it->second.peerClosed = true;
+        dropOutput(it->second);
+        handler->onClose();
+    }
+
+    // Per-socket state kept by the loop thread
+    struct Connection {
+        std::shared_ptr<ConnectionHandler> handler;
+        ConnectionHandle handle;
+        ChunkChain output;                 // not yet written, in the reactor's chunks
+        uint64_t lastOutputTick;           // loop tick of the latest send()
+        uint64_t responses;                // ticks that produced output
+        std::shared_ptr<OutputFilter> filter;
+        bool filterPending;                // filter has output to flush this iteration
+        bool writeArmed;                   // waiting for EPOLLOUT
+        bool closing;                      // removeConnection() was called
+        bool peerClosed;                   // onClose() already delivered
+        std::function<void()> onFlushed;   // whenFlushed() callback
+
+        Connection() : lastOutputTick(UINT64_MAX), responses(0),
+                       filterPending(false), writeArmed(false), closing(false), peerClosed(false) {}
+    };
+
+    typedef SlabAllocator<std::pair<const int, Connection>> ConnectionAllocator;
+    typedef std::unordered_map<int, Connection, std::hash<int>, std::equal_to<int>, ConnectionAllocator>
+        ConnectionMap;
+
+    // Queue bytes that are ready for the socket; they are written out at
+    // the end of this loop iteration, or on EPOLLOUT if the socket is full
+    bool queueOutput(int fd, Connection& conn, std::string_view data) {
+        if (data.empty()) {
+            return true;
+        }
+        if (conn.output.empty() && !conn.writeArmed) {
+            dirtyFds.push_back(fd);
+        }
+        conn.output.append(chunks, data);
+        ServerMetrics::getInstance().recordOutboundQueued(static_cast<int64_t>(data.size()), conn.output.size());
+
+        if (conn.output.size() > outboundHighWaterMark) {
+            // The client is not reading; drop it rather than buffer forever
+            std::cout << "Connection " << fd << " exceeded outbound high-water mark ("
+                      << conn.output.size() << " bytes), disconnecting" << std::endl;
+            ServerMetrics::getInstance().recordOutboundOverflow();
+            dropOutput(conn);
+            conn.peerClosed = true;
+
+            // Deliver the close from the loop rather than from inside
+            // whatever handler is sending to this connection
+            std::shared_ptr<ConnectionHandler> handler = conn.handler;
+            post([handler]() { handler->onClose(); });
+            return false;
+        }
+        return true;
+    }
+
+    // Queue output without writing it, for release()
+    void appendOutput(Connection& conn, std::string_view data) {
+        if (conn.filter) {
+            filterScratch.clear();
+            conn.filter->write(data, filterScratch);
+            data = filterScratch;
+        }
+        conn.output.append(chunks, data);
+        ServerMetrics::getInstance().recordOutboundQueued(static_cast<int64_t>(data.size()), conn.output.size());
+    }
+
+    // Complete the filter's output for this iteration's batch
+    void finishFilterBatch(int fd, Connection& conn) {
+        if (!conn.filterPending) {
+            return;
+        }
+        conn.filterPending = false;
+        filterScratch.clear();
+        conn.filter->flush(filterScratch);
+        queueOutput(fd, conn, filterScratch);
+    }
+
+    // Write everything queued during this iteration
+    void flushDirty() {
+        // Completing a filter batch can queue more dirty fds; take the
+        // list first. Both vectors keep their capacity from one iteration
+        // to the next.
+        flushing.swap(dirtyFds);
+        for (int fd : flushing) {
+            auto it = connections.find(fd);
+            if (it != connections.end()) {
+                finishFilterBatch(fd, it->second);
+            }
+            flush(fd);
+        }
+        flushing.clear();
+    }
+
+    // Write as much queued output as the socket takes, in one sendmsg per
+    // batch of buffers, and wait for EPOLLOUT if it fills up. MSG_MORE on
+    // all but the last batch keeps TCP from sending a short segment at
+    // each batch boundary.
+    void flush(int fd) {
+        auto it = connections.find(fd);
+        if (it == connections.end()) {
+            return;
+        }
+        Connection& conn = it->second;
+
+        while (!conn.output.empty()) {
+            struct iovec iov[64];
+            int count = conn.output.fillIovec(iov, 64);
+            size_t batch = 0;
+            for (int i = 0; i < count; i++) {
+                batch += iov[i].iov_len;
+            }
+
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = count;
+            int flags = MSG_NOSIGNAL;
+            if (batch < conn.output.size()) {
+                flags |= MSG_MORE;
+            }
+
+            ssize_t written = sendmsg(fd, &msg, flags);
+            ServerMetrics::getInstance().recordWriteCall();
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    ServerMetrics::getInstance().recordWriteBlocked();
+                    setWriteArmed(fd, conn, true);
+                    return;
+                }
+                // Socket failed; the read side will report the close
+                dropOutput(conn);
+                break;
+            }
+            consumeOutput(conn, static_cast<size_t>(written));
+        }
+
+        setWriteArmed(fd, conn, false);
+        if (conn.closing) {
+            closeConnection(it);
+        } else if (conn.onFlushed && conn.output.empty()) {
+            notifyFlushed(conn);
+        }
+    }
+
+    // Run the whenFlushed() callback as a task, so it never runs inside a
+    // flush; it is dropped if the connection is gone by then
+    void notifyFlushed(Connection& conn) {
+        std::function<void()> callback = std::move(conn.onFlushed);
+        conn.onFlushed = nullptr;
+        ConnectionHandle handle = conn.handle;
+        post([this, handle, callback]() {
+            if (findConnection(handle) != connections.end()) {
+                callback();
+            }
+        });
+    }
+
+    // Remove bytes that reached the socket from the front of the queue
+    void consumeOutput(Connection& conn, size_t bytes) {
+        ServerMetrics::getInstance().recordOutboundQueued(-static_cast<int64_t>(bytes), 0);
+        conn.output.consume(chunks, bytes);
+    }
+
+    void dropOutput(Connection& conn) {
+        ServerMetrics::getInstance().recordOutboundQueued(-static_cast<int64_t>(conn.output.size()), 0);
+        conn.output.clear(chunks);
+    }
+
+    void setWriteArmed(int fd, Connection& conn, bool armed) {
+        if (conn.writeArmed == armed) {
+            return;
+        }
+        struct epoll_event ev;
+        ev.events = armed ? (EPOLLIN | EPOLLRDHUP | EPOLLOUT) : (EPOLLIN | EPOLLRDHUP);
+        ev.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev);
+        conn.writeArmed = armed;
+    }
+
+    // The connection a handle refers to, unless it has since closed
+    ConnectionMap::iterator findConnection(ConnectionHandle handle) {
+        auto it = connections.find(static_cast<int>(handle.slot));
+        if (it != connections.end() && it->second.handle != handle) {
+            return connections.end();
+        }
+        return it;
+    }
+
+    void closeConnection(ConnectionMap::iterator it) {
+        int fd = it->first;
+        ConnectionRegistry::getInstance().remove(it->second.handle);
+        ServerMetrics::getInstance().recordConnectionOutput(it->second.responses,
+                                                            SocketUtils::getDataSegmentsOut(fd));
+        dropOutput(it->second);
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        connections.erase(it);
+        connectionCount--;
+    }
+
+private:
+    int epollFd;
+    int wakeFd;
+
+    // Owned by the loop thread. The pools come first so they outlive
+    // everything that holds their memory.
+    ChunkPool chunks;         // output queues
+    SlabPool connectionSlab;  // nodes of connections
+    ConnectionMap connections;
+    std::vector<int> dirtyFds;
+    std::vector<int> flushing;  // dirtyFds being flushed
+    std::string filterScratch;  // output filter result, reused
+    std::unordered_map<int, AcceptCallback> listeners;
+    char readBuffer[4096];
+};
+
+#endif //EPOLLREACTOR_H
@@ -1,12 +1,16 @@
 #ifndef GAME_H
 #define GAME_H
 
+#include <algorithm>
 #include <vector>
 #include <string>
 #include <memory>
+#include <mutex>
+#include "Board.h"
+#include "ResponseBuffer.h"
+#include "Snapshot.h"
 #include "User.h"
 
-enum class StoneColor { BLACK, WHITE };
 enum class GameStatus { WAITING, PLAYING, FINISHED };
 
 class Game {
@@ -14,13 +18,18 @@ private:
     int gameId;
     std::shared_ptr<User> blackPlayer;
     std::shared_ptr<User> whitePlayer;
-    std::vector<std::vector<char>> board; // 15x15 board
+    Board board;
     StoneColor currentTurn;
     GameStatus status;
     std::string winner;
 
+    // Guards the board, turn, status, winner, clocks and observers: the
+    // players' strands, observers' strands and the timeout thread all
+    // reach the same game. The players and limits never change.
+    mutable std::mutex gameMutex;
+
     // For observer functionality
-    std::vector<int> observers; // Socket IDs of observers
+    std::vector<ConnectionHandle> observers; // Connections watching the game
 
     // Time tracking
     time_t gameStartTime;
@@ -29,15 +38,16 @@ private:
     int whiteTimeUsed; // in seconds
     int timeLimit; // in seconds
 
+    // The unlocked halves of checkWin() and endGame()
+    bool makesFive(int row, int col) const;
+    void finish(const std::string& winnerName);
+
 public:
     Game(int id, std::shared_ptr<User> black, std::shared_ptr<User> white, int timeLimit = 600)
         : gameId(id), blackPlayer(black), whitePlayer(white),
           currentTurn(StoneColor::BLACK), status(GameStatus::PLAYING),
           timeLimit(timeLimit), blackTimeUsed(0), whiteTimeUsed(0)
     {
-        // Initialize empty board (15x15)
-        board.resize(15, std::vector<char>(15, '.'));
-
         // Set players' game status
         blackPlayer->setPlaying(true);
         blackPlayer->setGameId(gameId);
@@ -60,20 +70,45 @@ public:
     void endGame(const std::string& winnerName);
 
     // Observer methods
-    void addObserver(int socket);
-    void removeObserver(int socket);
-    bool isObserving(int socket) const;
-    std::vector<int> getObservers() const;
+    void addObserver(ConnectionHandle conn);
+    void removeObserver(ConnectionHandle conn);
+    bool isObserving(ConnectionHandle conn) const;
+    std::vector<ConnectionHandle> getObservers() const;
     // Add to your Game.h in the public section:
     bool isPositionEmpty(int row, int col) const;
     // Getters
     int getId() const { return gameId; }
-    std::string getBoardString() const;
-    GameStatus getStatus() const { return status; }
-    StoneColor getCurrentTurn() const { return currentTurn; }
-    std::string getWinner() const { return winner; }
+    void appendBoard(std::string& out) const;  // the board and clocks as text
+    GameStatus getStatus() const {
+        std::lock_guard<std::mutex> lock(gameMutex);
+        return status;
+    }
+    StoneColor getCurrentTurn() const {
+        std::lock_guard<std::mutex> lock(gameMutex);
+        return currentTurn;
+    }
+    std::string getWinner() const {  // empty after a draw
+        std::lock_guard<std::mutex> lock(gameMutex);
+        return winner;
+    }
+    bool isDraw() const {
+        std::lock_guard<std::mutex> lock(gameMutex);
+        return status == GameStatus::FINISHED && winner.empty();
+    }
     std::shared_ptr<User> getBlackPlayer() const { return blackPlayer; }
     std::shared_ptr<User> getWhitePlayer() const { return whitePlayer; }
+    char getCell(int row, int col) const {  // '.', 'X' (black) or 'O' (white)
+        std::lock_guard<std::mutex> lock(gameMutex);
+        return board.at(row, col);
+    }
+    int getTimeLimit() const { return timeLimit; }
+    // Seconds left on a player's clock, counting the turn in progress
+    int getTimeRemaining(StoneColor color) const;
+
+    // Hot restart. Observers are not saved; they come back with their
+    // connections.
+    void saveState(SnapshotWriter& out) const;
+    static std::shared_ptr<Game> restoreState(SnapshotReader& in);
 };
 
 // GameManager singleton to manage all games
@@ -101,26 +136,33 @@ public:
 
     // Get all games
     std::vector<std::shared_ptr<Game>> getAllGames();
+    void getAllGames(std::vector<std::shared_ptr<Game>>& result);  // into a vector the caller reuses
 
     // Remove finished games
     void cleanupGames();
+
+    // Every game and the next game id, for a hot restart
+    void saveState(SnapshotWriter& out);
+    void restoreState(SnapshotReader& in);
 };
 
 void Game::playerDisconnected(std::shared_ptr<User> player) {
+    std::lock_guard<std::mutex> lock(gameMutex);
     if (status != GameStatus::PLAYING) {
         return;
     }
 
     // If the black player disconnected, white wins and vice versa
     if (player->getUsername() == blackPlayer->getUsername()) {
-        endGame(whitePlayer->getUsername());
+        finish(whitePlayer->getUsername());
     } else if (player->getUsername() == whitePlayer->getUsername()) {
-        endGame(blackPlayer->getUsername());
+        finish(blackPlayer->getUsername());
     }
 }
 
 // Call this periodically to check if time has expired
 bool Game::checkTimeExpired() {
+    std::lock_guard<std::mutex> lock(gameMutex);
     if (status != GameStatus::PLAYING) {
         return false;
     }
@@ -134,14 +176,14 @@ bool Game::checkTimeExpired() {
         int updatedBlackTime = blackTimeUsed + elapsed;
         if (updatedBlackTime > timeLimit) {
             std::cout << "Black player time expired: " << updatedBlackTime << " seconds" << std::endl;
-            endGame(whitePlayer->getUsername());
+            finish(whitePlayer->getUsername());
             return true;
         }
     } else {
         int updatedWhiteTime = whiteTimeUsed + elapsed;
         if (updatedWhiteTime > timeLimit) {
             std::cout << "White player time expired: " << updatedWhiteTime << " seconds" << std::endl;
-            endGame(blackPlayer->getUsername());
+            finish(blackPlayer->getUsername());
             return true;
         }
     }
@@ -150,6 +192,8 @@ bool Game::checkTimeExpired() {
 }
 
 bool Game::makeMove(std::shared_ptr<User> player, int row, int col) {
+    std::lock_guard<std::mutex> lock(gameMutex);
+
     // Check if game is already over
     if (status != GameStatus::PLAYING) {
         return false;
@@ -171,7 +215,7 @@ bool Game::makeMove(std::shared_ptr<User> player, int row, int col) {
     }
 
     // Check if position is valid and empty
-    if (row < 0 || row >= 15 || col < 0 || col >= 15 || board[row][col] != '.') {
+    if (!board.canPlace(row, col)) {
         return false;
     }
 
@@ -183,31 +227,37 @@ bool Game::makeMove(std::shared_ptr<User> player, int row, int col) {
         blackTimeUsed += elapsed;
         // Check for time limit
         if (blackTimeUsed > timeLimit) {
-            endGame(whitePlayer->getUsername());
+            finish(whitePlayer->getUsername());
             return false;
         }
     } else {
         whiteTimeUsed += elapsed;
         // Check for time limit
         if (whiteTimeUsed > timeLimit) {
-            endGame(blackPlayer->getUsername());
+            finish(blackPlayer->getUsername());
             return false;
         }
     }
 
     // Place the stone on the board
-    board[row][col] = (currentTurn == StoneColor::BLACK) ? 'X' : 'O';
+    board.place(row, col, currentTurn);
 
     // Check for win condition
-    if (checkWin(row, col)) {
+    if (makesFive(row, col)) {
         if (currentTurn == StoneColor::BLACK) {
-            endGame(blackPlayer->getUsername());
+            finish(blackPlayer->getUsername());
         } else {
-            endGame(whitePlayer->getUsername());
+            finish(whitePlayer->getUsername());
         }
         return true; // Move was successful, even though it ended the game
     }
 
+    // A full board without five is a draw
+    if (board.isFull()) {
+        finish("");
+        return true;
+    }
+
     // Only update turn if game isn't over
     if (status == GameStatus::PLAYING) {
         currentTurn = (currentTurn == StoneColor::BLACK) ? StoneColor::WHITE : StoneColor::BLACK;
@@ -216,63 +266,50 @@ bool Game::makeMove(std::shared_ptr<User> player, int row, int col) {
 
     return true;
 }
+int Game::getTimeRemaining(StoneColor color) const {
+    std::lock_guard<std::mutex> lock(gameMutex);
+    int used = (color == StoneColor::BLACK) ? blackTimeUsed : whiteTimeUsed;
+    if (status == GameStatus::PLAYING && color == currentTurn) {
+        used += static_cast<int>(time(nullptr) - lastMoveTime);
+    }
+    return std::max(0, timeLimit - used);
+}
+
 // Helper method to check if a position is empty
 bool Game::isPositionEmpty(int row, int col) const {
-    if (row < 0 || row >= 15 || col < 0 || col >= 15) {
-        return false;
-    }
-    return board[row][col] == '.';
+    std::lock_guard<std::mutex> lock(gameMutex);
+    return board.canPlace(row, col);
 }
 bool Game::checkWin(int row, int col) {
-    char stone = board[row][col];
-    const int directions[4][2] = {{0, 1}, {1, 0}, {1, 1}, {1, -1}}; // horizontal, vertical, diagonal \, diagonal /
-
-    for (int d = 0; d < 4; d++) {
-        int count = 1; // Start with the stone just placed
-
-        // Check in positive direction
-        for (int i = 1; i < 5; i++) {
-            int newRow = row + i * directions[d][0];
-            int newCol = col + i * directions[d][1];
-
-            if (newRow < 0 || newRow >= 15 || newCol < 0 || newCol >= 15 || board[newRow][newCol] != stone) {
-                break;
-            }
-            count++;
-        }
-
-        // Check in negative direction
-        for (int i = 1; i < 5; i++) {
-            int newRow = row - i * directions[d][0];
-            int newCol = col - i * directions[d][1];
-
-            if (newRow < 0 || newRow >= 15 || newCol < 0 || newCol >= 15 || board[newRow][newCol] != stone) {
-                break;
-            }
-            count++;
-        }
-
-        if (count >= 5) {
-            return true;
-        }
-    }
+    std::lock_guard<std::mutex> lock(gameMutex);
+    return makesFive(row, col);
+}
 
-    return false;
+bool Game::makesFive(int row, int col) const {
+    StoneColor color = board.at(row, col) == 'X' ? StoneColor::BLACK : StoneColor::WHITE;
+    return Lines::makesFive(board.stones(color), row, col);
 }
 
 void Game::resign(std::shared_ptr<User> player) {
+    std::lock_guard<std::mutex> lock(gameMutex);
     if (status != GameStatus::PLAYING) {
         return;
     }
 
     if (player->getUsername() == blackPlayer->getUsername()) {
-        endGame(whitePlayer->getUsername());
+        finish(whitePlayer->getUsername());
     } else if (player->getUsername() == whitePlayer->getUsername()) {
-        endGame(blackPlayer->getUsername());
+        finish(blackPlayer->getUsername());
     }
 }
 
 void Game::endGame(const std::string& winnerName) {
+    std::lock_guard<std::mutex> lock(gameMutex);
+    finish(winnerName);
+}
+
+// An empty winnerName is a draw, which counts for neither player
+void Game::finish(const std::string& winnerName) {
     status = GameStatus::FINISHED;
     winner = winnerName;
 
@@ -280,7 +317,7 @@ void Game::endGame(const std::string& winnerName) {
     if (winner == blackPlayer->getUsername()) {
         blackPlayer->addWin();
         whitePlayer->addLoss();
-    } else {
+    } else if (winner == whitePlayer->getUsername()) {
         whitePlayer->addWin();
         blackPlayer->addLoss();
     }
@@ -293,50 +330,114 @@ void Game::endGame(const std::string& winnerName) {
 }
 
 // Observer methods
-void Game::addObserver(int socket) {
+void Game::addObserver(ConnectionHandle conn) {
+    std::lock_guard<std::mutex> lock(gameMutex);
     // Check if already observing
-    for (int observer : observers) {
-        if (observer == socket) {
+    for (ConnectionHandle observer : observers) {
+        if (observer == conn) {
             return;
         }
     }
-    observers.push_back(socket);
+    observers.push_back(conn);
 }
 
-void Game::removeObserver(int socket) {
-    auto it = std::find(observers.begin(), observers.end(), socket);
+void Game::removeObserver(ConnectionHandle conn) {
+    std::lock_guard<std::mutex> lock(gameMutex);
+    auto it = std::find(observers.begin(), observers.end(), conn);
     if (it != observers.end()) {
         observers.erase(it);
     }
 }
 
-bool Game::isObserving(int socket) const {
-    return std::find(observers.begin(), observers.end(), socket) != observers.end();
+bool Game::isObserving(ConnectionHandle conn) const {
+    std::lock_guard<std::mutex> lock(gameMutex);
+    return std::find(observers.begin(), observers.end(), conn) != observers.end();
 }
 
-std::vector<int> Game::getObservers() const {
+// A copy, so callers can send to them without holding the game
+std::vector<ConnectionHandle> Game::getObservers() const {
+    std::lock_guard<std::mutex> lock(gameMutex);
     return observers;
 }
 
-std::string Game::getBoardString() const {
-    std::string result = "   A B C D E F G H I J K L M N O\n";
+void Game::appendBoard(std::string& out) const {
+    std::lock_guard<std::mutex> lock(gameMutex);
+    out += "   A B C D E F G H I J K L M N O\n";
     for (int i = 0; i < 15; i++) {
-        result += (i < 9 ? " " : "") + std::to_string(i + 1) + " ";
+        ResponseBuffer::appendInt(out, i + 1, 2);
+        out += ' ';
         for (int j = 0; j < 15; j++) {
-            result += board[i][j];
-            result += " ";
+            out += board.at(i, j);
+            out += ' ';
         }
-        result += "\n";
+        out += '\n';
     }
 
     // Add turn information
-    result += "\nCurrent turn: " + std::string(currentTurn == StoneColor::BLACK ? "Black" : "White");
+    out += "\nCurrent turn: ";
+    out += currentTurn == StoneColor::BLACK ? "Black" : "White";
 
     // Add time information
-    result += "\nBlack time used: " + std::to_string(blackTimeUsed) + " seconds";
-    result += "\nWhite time used: " + std::to_string(whiteTimeUsed) + " seconds";
+    out += "\nBlack time used: ";
+    ResponseBuffer::appendInt(out, blackTimeUsed);
+    out += " seconds\nWhite time used: ";
+    ResponseBuffer::appendInt(out, whiteTimeUsed);
+    out += " seconds";
+}
 
-    return result;
+void Game::saveState(SnapshotWriter& out) const {
+    std::lock_guard<std::mutex> lock(gameMutex);
+    out.putU32(static_cast<uint32_t>(gameId));
+    out.putString(blackPlayer->getUsername());
+    out.putString(whitePlayer->getUsername());
+    out.putBytes(board.data(), Board::SIZE * Board::SIZE);
+    out.putU8(static_cast<uint8_t>(currentTurn));
+    out.putU8(static_cast<uint8_t>(status));
+    out.putString(winner);
+    out.putI64(gameStartTime);
+    out.putI64(lastMoveTime);
+    out.putU32(static_cast<uint32_t>(blackTimeUsed));
+    out.putU32(static_cast<uint32_t>(whiteTimeUsed));
+    out.putU32(static_cast<uint32_t>(timeLimit));
+}
+
+// Games must be restored in id order, so a player's latest game decides
+// whether they are playing
+std::shared_ptr<Game> Game::restoreState(SnapshotReader& in) {
+    int id = static_cast<int>(in.getU32());
+    auto black = UserManager::getInstance().getUserByUsername(in.getString());
+    auto white = UserManager::getInstance().getUserByUsername(in.getString());
+    char cells[Board::SIZE * Board::SIZE];
+    in.getBytes(cells, sizeof(cells));
+    StoneColor turn = static_cast<StoneColor>(in.getU8());
+    GameStatus gameStatus = static_cast<GameStatus>(in.getU8());
+    std::string gameWinner = in.getString();
+    time_t startTime = static_cast<time_t>(in.getI64());
+    time_t moveTime = static_cast<time_t>(in.getI64());
+    int blackUsed = static_cast<int>(in.getU32());
+    int whiteUsed = static_cast<int>(in.getU32());
+    int limit = static_cast<int>(in.getU32());
+    if (!black || !white || !in.isOk()) {
+        return nullptr;
+    }
+
+    // The constructor marks both players as in this game
+    auto game = std::make_shared<Game>(id, black, white, limit);
+    game->board.assign(cells);
+    game->currentTurn = turn;
+    game->status = gameStatus;
+    game->winner = gameWinner;
+    game->gameStartTime = startTime;
+    game->lastMoveTime = moveTime;
+    game->blackTimeUsed = blackUsed;
+    game->whiteTimeUsed = whiteUsed;
+    if (gameStatus == GameStatus::FINISHED) {
+        black->setPlaying(false);
+        black->setGameId(-1);
+        white->setPlaying(false);
+        white->setGameId(-1);
+    }
+    return game;
 }
 
 // GameManager methods implementation
@@ -360,13 +461,18 @@ std::shared_ptr<Game> GameManager::getGame(int gameId) {
 }
 
 std::vector<std::shared_ptr<Game>> GameManager::getAllGames() {
+    std::vector<std::shared_ptr<Game>> result;
+    getAllGames(result);
+    return result;
+}
+
+void GameManager::getAllGames(std::vector<std::shared_ptr<Game>>& result) {
     std::lock_guard<std::mutex> lock(gamesMutex);
 
-    std::vector<std::shared_ptr<Game>> result;
+    result.clear();
     for (const auto& pair : games) {
         result.push_back(pair.second);
     }
-    return result;
 }
 
 void GameManager::cleanupGames() {
@@ -383,4 +489,32 @@ void GameManager::cleanupGames() {
         }
     }
 }
-#endif // GAME_H
\ No newline at end of file
+void GameManager::saveState(SnapshotWriter& out) {
+    std::lock_guard<std::mutex> lock(gamesMutex);
+
+    std::vector<int> ids;
+    for (const auto& pair : games) {
+        ids.push_back(pair.first);
+    }
+    std::sort(ids.begin(), ids.end());
+
+    out.putU32(static_cast<uint32_t>(nextGameId));
+    out.putU32(static_cast<uint32_t>(ids.size()));
+    for (int id : ids) {
+        games[id]->saveState(out);
+    }
+}
+
+void GameManager::restoreState(SnapshotReader& in) {
+    std::lock_guard<std::mutex> lock(gamesMutex);
+
+    nextGameId = static_cast<int>(in.getU32());
+    uint32_t count = in.getU32();
+    for (uint32_t i = 0; i < count && in.isOk(); i++) {
+        auto game = Game::restoreState(in);
+        if (game) {
+            games[game->getId()] = game;
+        }
+    }
+}
+#endif // GAME_H
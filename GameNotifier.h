@@ -0,0 +1,203 @@
+#ifndef GAMENOTIFIER_H
+#define GAMENOTIFIER_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "BinaryProtocol.h"
+#include "ConnectionRegistry.h"
+#include "Game.h"
+#include "ResponseBuffer.h"
+
+// Tells the players and observers of a game what happened, in whatever
+// protocol each of them speaks. The text and the binary frames are only
+// built if someone needs them, so a game between two bots never formats
+// a board, and they are built in ResponseBuffers, so neither allocates.
+class GameNotifier {
+public:
+    // A new game was created; tell the player who did not ask for it
+    static void gameStarted(const std::shared_ptr<Game>& game, const std::shared_ptr<User>& opponent) {
+        notify({opponent->getConnection()},
+            [&](std::string& out) {
+                appendStartMessage(out, game);
+                out += "\r\n\n";
+                game->appendBoard(out);
+                out += "\r\n";
+            },
+            [&](std::string& out) {
+                BinaryProtocol::appendEvent(out, BinaryProtocol::EV_GAME_STARTED, game->getId(),
+                                            colorOf(game, opponent));
+                appendState(out, game);
+            });
+    }
+
+    // A move was made; tell the opponent and the observers, with the
+    // result if it won or filled the board
+    static void movePlayed(const std::shared_ptr<Game>& game, const std::shared_ptr<User>& mover,
+                           const std::shared_ptr<User>& opponent, int row, int col) {
+        notify(recipients(game, opponent),
+            [&](std::string& out) {
+                out += mover->getUsername();
+                out += " played at ";
+                out += static_cast<char>('A' + col);
+                ResponseBuffer::appendInt(out, row + 1);
+                appendResult(out, game);
+                out += "\r\n\n";
+                game->appendBoard(out);
+                out += "\r\n";
+            },
+            [&](std::string& out) {
+                appendMoveFrames(out, game, mover, row, col);
+            });
+    }
+
+    static void playerResigned(const std::shared_ptr<Game>& game, const std::shared_ptr<User>& player,
+                               const std::shared_ptr<User>& opponent) {
+        notify(recipients(game, opponent),
+            [&](std::string& out) {
+                out += player->getUsername();
+                out += " has resigned the game.\r\n";
+            },
+            [&](std::string& out) {
+                appendGameOver(out, game, opponent, BinaryProtocol::END_RESIGN);
+            });
+    }
+
+    // Sent before the game is ended in the opponent's favour
+    static void playerDisconnected(const std::shared_ptr<Game>& game, const std::shared_ptr<User>& player,
+                                   const std::shared_ptr<User>& opponent) {
+        notify(recipients(game, opponent),
+            [&](std::string& out) {
+                out += player->getUsername();
+                out += " has disconnected. ";
+                out += opponent->getUsername();
+                out += " wins by default.\r\n";
+            },
+            [&](std::string& out) {
+                appendGameOver(out, game, opponent, BinaryProtocol::END_DISCONNECT);
+            });
+    }
+
+    // The game has already been ended on time
+    static void gameTimedOut(const std::shared_ptr<Game>& game) {
+        std::vector<ConnectionHandle> to = recipients(game, game->getBlackPlayer());
+        to.insert(to.begin() + 1, game->getWhitePlayer()->getConnection());
+        notify(to,
+            [&](std::string& out) {
+                out += "Game ended: ";
+                out += game->getWinner();
+                out += " wins due to timeout.\r\n";
+            },
+            [&](std::string& out) {
+                auto winner = game->getWinner() == game->getBlackPlayer()->getUsername()
+                              ? game->getBlackPlayer() : game->getWhitePlayer();
+                appendGameOver(out, game, winner, BinaryProtocol::END_TIMEOUT);
+            });
+    }
+
+    // Frames for the player who made a move: the move itself, both clocks,
+    // and the result if the game is over
+    static void appendMoveFrames(std::string& out, const std::shared_ptr<Game>& game,
+                                 const std::shared_ptr<User>& mover, int row, int col) {
+        BinaryProtocol::appendMove(out, game->getId(), row, col, colorOf(game, mover));
+        BinaryProtocol::appendClock(out, game->getId(),
+                                    game->getTimeRemaining(StoneColor::BLACK),
+                                    game->getTimeRemaining(StoneColor::WHITE));
+        if (game->isDraw()) {
+            BinaryProtocol::appendEvent(out, BinaryProtocol::EV_GAME_OVER, game->getId(),
+                                        BinaryProtocol::NO_WINNER, BinaryProtocol::END_DRAW);
+        } else if (game->getStatus() == GameStatus::FINISHED) {
+            appendGameOver(out, game, mover, BinaryProtocol::END_FIVE);
+        }
+    }
+
+    // The line after a move that ended the game, for the text protocols
+    static void appendResult(std::string& out, const std::shared_ptr<Game>& game) {
+        if (game->isDraw()) {
+            out += "\nThe board is full. The game is a draw.";
+        } else if (game->getStatus() == GameStatus::FINISHED) {
+            out += '\n';
+            out += game->getWinner();
+            out += " has won the game!";
+        }
+    }
+
+    static void appendGameOver(std::string& out, const std::shared_ptr<Game>& game,
+                               const std::shared_ptr<User>& winner, uint8_t reason) {
+        BinaryProtocol::appendEvent(out, BinaryProtocol::EV_GAME_OVER, game->getId(),
+                                    colorOf(game, winner), reason);
+    }
+
+    // Full snapshot of a game: status, turn, clocks and every cell
+    static void appendState(std::string& out, const std::shared_ptr<Game>& game) {
+        size_t frame = BinaryProtocol::beginFrame(out, BinaryProtocol::STATE);
+        BinaryProtocol::putU32(out, game->getId());
+        BinaryProtocol::putU8(out, static_cast<uint8_t>(game->getStatus()));
+        BinaryProtocol::putU8(out, game->getCurrentTurn() == StoneColor::BLACK ? 0 : 1);
+        BinaryProtocol::putU32(out, game->getTimeRemaining(StoneColor::BLACK));
+        BinaryProtocol::putU32(out, game->getTimeRemaining(StoneColor::WHITE));
+        for (int row = 0; row < 15; row++) {
+            for (int col = 0; col < 15; col++) {
+                char cell = game->getCell(row, col);
+                BinaryProtocol::putU8(out, cell == 'X' ? BinaryProtocol::CELL_BLACK
+                                         : cell == 'O' ? BinaryProtocol::CELL_WHITE
+                                         : BinaryProtocol::CELL_EMPTY);
+            }
+        }
+        BinaryProtocol::endFrame(out, frame);
+    }
+
+    static void appendStartMessage(std::string& out, const std::shared_ptr<Game>& game) {
+        out += "Game ";
+        ResponseBuffer::appendInt(out, game->getId());
+        out += " started: ";
+        out += game->getBlackPlayer()->getUsername();
+        out += " (Black) vs ";
+        out += game->getWhitePlayer()->getUsername();
+        out += " (White)";
+    }
+
+    static uint8_t colorOf(const std::shared_ptr<Game>& game, const std::shared_ptr<User>& player) {
+        return player->getUsername() == game->getBlackPlayer()->getUsername() ? 0 : 1;
+    }
+
+private:
+    // One player plus everyone watching
+    static std::vector<ConnectionHandle> recipients(const std::shared_ptr<Game>& game,
+                                                    const std::shared_ptr<User>& player) {
+        std::vector<ConnectionHandle> to{player->getConnection()};
+        for (ConnectionHandle observer : game->getObservers()) {
+            to.push_back(observer);
+        }
+        return to;
+    }
+
+    template <typename MakeText, typename MakeFrames>
+    static void notify(const std::vector<ConnectionHandle>& to, MakeText makeText, MakeFrames makeFrames) {
+        ConnectionRegistry& registry = ConnectionRegistry::getInstance();
+        ResponseBuffer text, frames;
+        bool haveText = false, haveFrames = false;
+
+        for (ConnectionHandle conn : to) {
+            if (!registry.isOpen(conn)) {
+                continue;
+            }
+            if (registry.getProtocol(conn) == WireProtocol::BINARY) {
+                if (!haveFrames) {
+                    makeFrames(frames.str());
+                    haveFrames = true;
+                }
+                registry.send(conn, frames.view());
+            } else {
+                if (!haveText) {
+                    makeText(text.str());
+                    haveText = true;
+                }
+                registry.send(conn, text.view());
+            }
+        }
+    }
+};
+
+#endif //GAMENOTIFIER_H
@@ -0,0 +1,221 @@
+#ifndef HOTRESTART_H
+#define HOTRESTART_H
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Process side of a hot restart. The running server starts the new binary
+// with one end of a Unix socket pair ("--resume-fd N"), then sends it every
+// listening and client socket with SCM_RIGHTS followed by a state
+// snapshot. The new process takes over without the sockets ever closing.
+//
+// On the channel: the child writes READY once it is running, the parent
+// sends a header (fd count, snapshot size), the fds in batches of one
+// byte each, and the snapshot; the child writes DONE once it has resumed.
+class HotRestart {
+public:
+    static const char READY = 'R';
+    static const char DONE = 'D';
+
+    // Start argv[0] again with the same options plus --resume-fd. Returns
+    // the channel to it, or -1 if it could not be started or did not
+    // report in within timeoutMs.
+    static int spawn(char* argv[], int timeoutMs, pid_t& child) {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0) {
+            perror("socketpair");
+            return -1;
+        }
+
+        child = fork();
+        if (child < 0) {
+            perror("fork");
+            close(pair[0]);
+            close(pair[1]);
+            return -1;
+        }
+
+        if (child == 0) {
+            // Only the child's end survives exec
+            close(pair[0]);
+            fcntl(pair[1], F_SETFD, 0);
+            std::string fdArg = std::to_string(pair[1]);
+            std::vector<char*> args;
+            for (int i = 0; argv[i]; i++) {
+                if (strcmp(argv[i], "--resume-fd") == 0 && argv[i + 1]) {
+                    i++;  // from our own hot restart
+                    continue;
+                }
+                args.push_back(argv[i]);
+            }
+            args.push_back(const_cast<char*>("--resume-fd"));
+            args.push_back(const_cast<char*>(fdArg.c_str()));
+            args.push_back(nullptr);
+            execvp(args[0], args.data());
+            perror("execvp");
+            _exit(127);
+        }
+
+        close(pair[1]);
+        char reply = 0;
+        if (!readByte(pair[0], reply, timeoutMs) || reply != READY) {
+            std::cerr << "Hot restart: new process did not start" << std::endl;
+            close(pair[0]);
+            kill(child, SIGKILL);
+            waitpid(child, nullptr, 0);
+            return -1;
+        }
+        return pair[0];
+    }
+
+    // Parent: hand over the sockets and the snapshot
+    static bool send(int channel, const std::vector<int>& fds, const std::string& snapshot) {
+        char header[12];
+        putU32(header, static_cast<uint32_t>(fds.size()));
+        putU32(header + 4, static_cast<uint32_t>(static_cast<uint64_t>(snapshot.size()) >> 32));
+        putU32(header + 8, static_cast<uint32_t>(snapshot.size()));
+        if (!writeAll(channel, header, sizeof(header))) {
+            return false;
+        }
+
+        for (size_t start = 0; start < fds.size(); start += FDS_PER_MESSAGE) {
+            size_t count = std::min(FDS_PER_MESSAGE, fds.size() - start);
+            char byte = 0;
+            struct iovec iov = { &byte, 1 };
+            std::vector<char> control(CMSG_SPACE(count * sizeof(int)));
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control.data();
+            msg.msg_controllen = control.size();
+            struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+            memcpy(CMSG_DATA(cmsg), fds.data() + start, count * sizeof(int));
+            if (sendmsg(channel, &msg, MSG_NOSIGNAL) != 1) {
+                perror("sendmsg SCM_RIGHTS");
+                return false;
+            }
+        }
+
+        return writeAll(channel, snapshot.data(), snapshot.size());
+    }
+
+    // Child: receive what send() sent
+    static bool receive(int channel, std::vector<int>& fds, std::string& snapshot) {
+        char header[12];
+        if (!readAll(channel, header, sizeof(header))) {
+            return false;
+        }
+        uint32_t fdCount = getU32(header);
+        uint64_t size = (static_cast<uint64_t>(getU32(header + 4)) << 32) | getU32(header + 8);
+
+        while (fds.size() < fdCount) {
+            size_t count = std::min(FDS_PER_MESSAGE, static_cast<size_t>(fdCount) - fds.size());
+            char byte;
+            struct iovec iov = { &byte, 1 };
+            std::vector<char> control(CMSG_SPACE(count * sizeof(int)));
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control.data();
+            msg.msg_controllen = control.size();
+            if (recvmsg(channel, &msg, MSG_CMSG_CLOEXEC) != 1 || (msg.msg_flags & MSG_CTRUNC)) {
+                perror("recvmsg SCM_RIGHTS");
+                return false;
+            }
+            struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS) {
+                return false;
+            }
+            size_t received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const int* data = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+            fds.insert(fds.end(), data, data + received);
+        }
+
+        snapshot.resize(size);
+        return readAll(channel, &snapshot[0], size);
+    }
+
+    static bool notify(int channel, char byte) {
+        return writeAll(channel, &byte, 1);
+    }
+
+    // Wait up to timeoutMs for one byte from the other side
+    static bool readByte(int channel, char& byte, int timeoutMs) {
+        struct pollfd pfd = { channel, POLLIN, 0 };
+        int ready;
+        do {
+            ready = poll(&pfd, 1, timeoutMs);
+        } while (ready < 0 && errno == EINTR);
+        return ready == 1 && read(channel, &byte, 1) == 1;
+    }
+
+private:
+    // Well under the kernel's SCM_MAX_FD (253)
+    static constexpr size_t FDS_PER_MESSAGE = 200;
+
+    static void putU32(char* p, uint32_t value) {
+        p[0] = static_cast<char>(value >> 24);
+        p[1] = static_cast<char>(value >> 16);
+        p[2] = static_cast<char>(value >> 8);
+        p[3] = static_cast<char>(value);
+    }
+
+    static uint32_t getU32(const char* p) {
+        const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+        return (static_cast<uint32_t>(u[0]) << 24) | (static_cast<uint32_t>(u[1]) << 16) |
+               (static_cast<uint32_t>(u[2]) << 8) | u[3];
+    }
+
+    // The other process may be gone; that is an error, not a SIGPIPE
+    static bool writeAll(int fd, const char* data, size_t len) {
+        while (len > 0) {
+            ssize_t n = ::send(fd, data, len, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("hot restart write");
+                return false;
+            }
+            data += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    static bool readAll(int fd, char* data, size_t len) {
+        while (len > 0) {
+            ssize_t n = read(fd, data, len);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            data += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+};
+
+#endif //HOTRESTART_H
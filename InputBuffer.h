@@ -0,0 +1,126 @@
+#ifndef INPUTBUFFER_H
+#define INPUTBUFFER_H
+
+#include <cstring>
+#include <memory>
+#include <string_view>
+
+#include "Snapshot.h"
+
+// Per-connection receive buffer. Bytes are appended as they arrive and
+// complete lines are handed out as views into the buffer, so nothing is
+// copied between the socket read and the command parser. A partial line
+// stays buffered until the rest of it arrives.
+class InputBuffer {
+private:
+    std::unique_ptr<char[]> buffer;
+    size_t capacity;
+    size_t readPos;    // start of the first unconsumed byte
+    size_t scanPos;    // bytes before this have been searched for '\n'
+    size_t writePos;   // end of the received data
+    bool discarding;   // dropping the rest of an over-long line
+
+public:
+    explicit InputBuffer(size_t capacity = 4096)
+        : buffer(new char[capacity]), capacity(capacity),
+          readPos(0), scanPos(0), writePos(0), discarding(false) {}
+
+    // Copy in as much of data as fits and return the number of bytes taken.
+    // If mask is given (a WebSocket masking key), byte i is unmasked with
+    // mask[(phase + i) % 4] on the way in. Views returned by nextLine() are
+    // invalidated.
+    size_t append(const char* data, size_t len, const unsigned char* mask = nullptr, size_t phase = 0) {
+        if (readPos == writePos) {
+            // Everything consumed; start over at the front
+            readPos = scanPos = writePos = 0;
+        } else if (writePos == capacity && readPos > 0) {
+            compact();
+        }
+        size_t chunk = capacity - writePos;
+        if (chunk > len) {
+            chunk = len;
+        }
+        if (mask) {
+            char* dest = buffer.get() + writePos;
+            for (size_t i = 0; i < chunk; i++) {
+                dest[i] = static_cast<char>(data[i] ^ mask[(phase + i) & 3]);
+            }
+        } else {
+            memcpy(buffer.get() + writePos, data, chunk);
+        }
+        writePos += chunk;
+        return chunk;
+    }
+
+    // Get the next complete line, without its "\n" or "\r\n". The view
+    // stays valid until the next append().
+    bool nextLine(std::string_view& line) {
+        while (scanPos < writePos) {
+            const char* start = buffer.get() + scanPos;
+            const char* newline = static_cast<const char*>(memchr(start, '\n', writePos - scanPos));
+            if (!newline) {
+                if (discarding) {
+                    // Still inside an over-long line; nothing worth keeping
+                    readPos = scanPos = writePos = 0;
+                } else {
+                    scanPos = writePos;
+                }
+                return false;
+            }
+
+            size_t end = static_cast<size_t>(newline - buffer.get());
+            size_t lineStart = readPos;
+            readPos = scanPos = end + 1;
+
+            if (discarding) {
+                // Tail of a line that was too long; drop it
+                discarding = false;
+                continue;
+            }
+
+            if (end > lineStart && buffer[end - 1] == '\r') {
+                end--;
+            }
+            line = std::string_view(buffer.get() + lineStart, end - lineStart);
+            return true;
+        }
+        return false;
+    }
+
+    // The buffer is full and holds no complete line
+    bool isFull() const {
+        return readPos == 0 && writePos == capacity;
+    }
+
+    // Bytes received but not yet handed out as lines, for a hot restart
+    void saveState(SnapshotWriter& out) const {
+        out.putString(std::string(buffer.get() + readPos, writePos - readPos));
+        out.putBool(discarding);
+    }
+
+    void restoreState(SnapshotReader& in) {
+        std::string pending = in.getString();
+        readPos = scanPos = writePos = 0;
+        append(pending.data(), pending.size());
+        discarding = in.getBool();
+    }
+
+    // Throw away a partial line that does not fit, along with the rest of
+    // it when it arrives
+    void discardPartialLine() {
+        readPos = scanPos = writePos = 0;
+        discarding = true;
+    }
+
+private:
+    // Move unconsumed bytes to the front of the buffer
+    void compact() {
+        size_t remaining = writePos - readPos;
+        memmove(buffer.get(), buffer.get() + readPos, remaining);
+        scanPos -= readPos;
+        writePos = remaining;
+        readPos = 0;
+    }
+};
+
+#endif //INPUTBUFFER_H
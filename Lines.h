@@ -0,0 +1,123 @@
+#ifndef LINES_H
+#define LINES_H
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Five-in-a-row detection over a 15x15 board. One colour's stones are
+// kept four times over, once along each direction, so that every line
+// through a cell is a contiguous 16-bit lane:
+//
+//     lanes  0-14   rows              bit = col
+//     lanes 16-30   columns           bit = row
+//     lanes 32-60   diagonals \       lane 32 + row - col + 14, bit = col
+//     lanes 64-92   anti-diagonals /  lane 64 + row + col, bit = col
+//
+// 96 lanes, 24 words. Lanes 0-15 are the plain row-major bitboard (bit
+// row * 16 + col), and bit 15 of every lane is never set, so shifting a
+// whole word cannot carry a run from one lane into the next.
+namespace Lines {
+    const int SIZE = 15;
+    const int WORDS = 24;
+    using Bits = uint64_t[WORDS];
+
+    inline uint64_t lane(const Bits& stones, int n) {
+        return (stones[n >> 2] >> ((n & 3) * 16)) & 0xffff;
+    }
+
+    inline void setBit(Bits& stones, int n, int bit) {
+        stones[n >> 2] |= uint64_t(1) << ((n & 3) * 16 + bit);
+    }
+
+    inline void set(Bits& stones, int row, int col) {
+        setBit(stones, row, col);
+        setBit(stones, 16 + col, row);
+        setBit(stones, 32 + row - col + SIZE - 1, col);
+        setBit(stones, 64 + row + col, col);
+    }
+
+    // The row, column, diagonal and anti-diagonal through a cell, packed
+    // into the four 16-bit lanes of one word
+    inline uint64_t linesThrough(const Bits& stones, int row, int col) {
+        return lane(stones, row) | (lane(stones, 16 + col) << 16) |
+               (lane(stones, 32 + row - col + SIZE - 1) << 32) | (lane(stones, 64 + row + col) << 48);
+    }
+
+    // The cell's own bit in each lane of linesThrough()
+    inline uint64_t cellIn(int row, int col) {
+        return (0x0001000100000001ULL << col) | (uint64_t(1) << (16 + row));
+    }
+
+    // Whether a stone at (row, col) is part of five or more in a row,
+    // counting the cell as a stone whether or not it is one yet. All four
+    // lines are tested at once.
+    inline bool makesFive(const Bits& stones, int row, int col) {
+        uint64_t cell = cellIn(row, col);
+        uint64_t line = linesThrough(stones, row, col) | cell;
+        uint64_t starts = line & (line >> 1) & (line >> 2) & (line >> 3) & (line >> 4);
+        uint64_t fives = starts | (starts << 1) | (starts << 2) | (starts << 3) | (starts << 4);
+        return (fives & cell) != 0;
+    }
+
+    // The longest line a stone at (row, col) is part of, again counting
+    // the cell as a stone
+    inline int longestRun(const Bits& stones, int row, int col) {
+        uint64_t line = linesThrough(stones, row, col) | cellIn(row, col);
+        int longest = 0;
+        for (int d = 0; d < 4; d++) {
+            int bit = d == 1 ? row : col;
+            uint32_t bits = static_cast<uint32_t>(line >> (d * 16)) & 0xffff;
+            int up = std::countr_one(bits >> bit);
+            int down = std::countl_one(static_cast<uint16_t>(bits << (16 - bit)));
+            longest = std::max(longest, up + down);
+        }
+        return longest;
+    }
+
+    // Whether there are five in a row anywhere, for scanning whole
+    // positions rather than checking one move
+    inline bool hasFivePortable(const Bits& stones) {
+        uint64_t any = 0;
+        for (int i = 0; i < WORDS; i++) {
+            uint64_t w = stones[i];
+            any |= w & (w >> 1) & (w >> 2) & (w >> 3) & (w >> 4);
+        }
+        return any != 0;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    // Sixteen lanes per register, shifted within each lane
+    __attribute__((target("avx2")))
+    inline bool hasFiveAvx2(const Bits& stones) {
+        __m256i any = _mm256_setzero_si256();
+        for (int i = 0; i < WORDS; i += 4) {
+            __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(stones + i));
+            __m256i run = _mm256_and_si256(w, _mm256_srli_epi16(w, 1));
+            run = _mm256_and_si256(run, _mm256_srli_epi16(w, 2));
+            run = _mm256_and_si256(run, _mm256_srli_epi16(w, 3));
+            run = _mm256_and_si256(run, _mm256_srli_epi16(w, 4));
+            any = _mm256_or_si256(any, run);
+        }
+        return !_mm256_testz_si256(any, any);
+    }
+
+    inline const bool HAVE_AVX2 = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+    }();
+
+    inline bool hasFive(const Bits& stones) {
+        return HAVE_AVX2 ? hasFiveAvx2(stones) : hasFivePortable(stones);
+    }
+#else
+    inline bool hasFive(const Bits& stones) {
+        return hasFivePortable(stones);
+    }
+#endif
+}
+
+#endif // LINES_H
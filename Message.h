@@ -8,6 +8,9 @@
 #include <ctime>
 #include <unordered_map>
 
+#include "ResponseBuffer.h"
+#include "Snapshot.h"
+
 class Message {
 private:
     int id;
@@ -26,6 +29,13 @@ public:
         timestamp = std::time(nullptr);
     }
 
+    // A message saved by an earlier process
+    Message(int id, const std::string& sender, const std::string& recipient,
+            const std::string& title, const std::string& content, time_t timestamp, bool read)
+        : id(id), sender(sender), recipient(recipient),
+          title(title), content(content), timestamp(timestamp), read(read) {
+    }
+
     int getId() const { return id; }
     std::string getSender() const { return sender; }
     std::string getRecipient() const { return recipient; }
@@ -36,15 +46,24 @@ public:
 
     void markAsRead() { read = true; }
 
-    std::string getFormattedHeader() const {
+    // One line of listmail; localtime_r, as commands run on several threads
+    void appendFormattedHeader(std::string& out) const {
+        struct tm local;
+        localtime_r(&timestamp, &local);
         char timeStr[100];
-        std::strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M", std::localtime(&timestamp));
+        size_t timeLen = std::strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M", &local);
 
-        return std::to_string(id) + ". " +
-               (read ? "" : "[NEW] ") +
-               "From: " + sender +
-               ", Title: " + title +
-               ", Date: " + timeStr;
+        ResponseBuffer::appendInt(out, id);
+        out += ". ";
+        if (!read) {
+            out += "[NEW] ";
+        }
+        out += "From: ";
+        out += sender;
+        out += ", Title: ";
+        out += title;
+        out += ", Date: ";
+        out.append(timeStr, timeLen);
     }
 };
 
@@ -78,6 +97,21 @@ public:
         return userMessages[username];
     }
 
+    // A header line for each of the user's messages; returns how many
+    size_t appendHeaders(const std::string& username, std::string& out) {
+        std::lock_guard<std::mutex> lock(messagesMutex);
+
+        auto it = userMessages.find(username);
+        if (it == userMessages.end()) {
+            return 0;
+        }
+        for (const auto& message : it->second) {
+            message->appendFormattedHeader(out);
+            out += '\n';
+        }
+        return it->second.size();
+    }
+
     std::shared_ptr<Message> getMessage(const std::string& username, int messageId) {
         std::lock_guard<std::mutex> lock(messagesMutex);
 
@@ -116,5 +150,46 @@ public:
 
         return count;
     }
+
+    // All mail, for a hot restart
+    void saveState(SnapshotWriter& out) {
+        std::lock_guard<std::mutex> lock(messagesMutex);
+
+        uint32_t count = 0;
+        for (const auto& pair : userMessages) {
+            count += static_cast<uint32_t>(pair.second.size());
+        }
+        out.putU32(static_cast<uint32_t>(nextMessageId));
+        out.putU32(count);
+        for (const auto& pair : userMessages) {
+            for (const auto& message : pair.second) {
+                out.putU32(static_cast<uint32_t>(message->getId()));
+                out.putString(message->getSender());
+                out.putString(message->getRecipient());
+                out.putString(message->getTitle());
+                out.putString(message->getContent());
+                out.putI64(message->getTimestamp());
+                out.putBool(message->isRead());
+            }
+        }
+    }
+
+    void restoreState(SnapshotReader& in) {
+        std::lock_guard<std::mutex> lock(messagesMutex);
+
+        nextMessageId = static_cast<int>(in.getU32());
+        uint32_t count = in.getU32();
+        for (uint32_t i = 0; i < count && in.isOk(); i++) {
+            int id = static_cast<int>(in.getU32());
+            std::string sender = in.getString();
+            std::string recipient = in.getString();
+            std::string title = in.getString();
+            std::string content = in.getString();
+            time_t timestamp = static_cast<time_t>(in.getI64());
+            bool read = in.getBool();
+            userMessages[recipient].push_back(
+                std::make_shared<Message>(id, sender, recipient, title, content, timestamp, read));
+        }
+    }
 };
 #endif // MESSAGE_H
\ No newline at end of file
@@ -0,0 +1,293 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Latency histogram with power-of-two microsecond buckets. Lock-free so
+// reactor threads can record into it on every event.
+class LatencyHistogram {
+private:
+    static const int BUCKETS = 32;
+    std::atomic<uint64_t> buckets[BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> totalMicros;
+    std::atomic<uint64_t> maxMicros;
+
+public:
+    LatencyHistogram() : count(0), totalMicros(0), maxMicros(0) {
+        for (int i = 0; i < BUCKETS; i++) {
+            buckets[i] = 0;
+        }
+    }
+
+    void record(uint64_t micros) {
+        int bucket = 0;
+        while (bucket < BUCKETS - 1 && (1ull << bucket) <= micros) {
+            bucket++;
+        }
+        buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        totalMicros.fetch_add(micros, std::memory_order_relaxed);
+
+        uint64_t currentMax = maxMicros.load(std::memory_order_relaxed);
+        while (micros > currentMax &&
+               !maxMicros.compare_exchange_weak(currentMax, micros, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t getCount() const { return count; }
+
+    // Upper bound of the bucket holding the given percentile
+    uint64_t getPercentile(double percentile) const {
+        uint64_t total = count;
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t target = static_cast<uint64_t>(total * percentile / 100.0);
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            seen += buckets[i];
+            if (seen > target) {
+                return 1ull << i;
+            }
+        }
+        return maxMicros;
+    }
+
+    // e.g. "n=42 avg=12us p50<=16us p99<=128us max=97us"
+    std::string summary() const {
+        uint64_t n = count;
+        uint64_t avg = n ? totalMicros / n : 0;
+        return "n=" + std::to_string(n) +
+               " avg=" + std::to_string(avg) + "us" +
+               " p50<=" + std::to_string(getPercentile(50)) + "us" +
+               " p99<=" + std::to_string(getPercentile(99)) + "us" +
+               " max=" + std::to_string(maxMicros.load()) + "us";
+    }
+};
+
+// Bytes into and out of one MCCP2 stream. The connection's reactor counts
+// while the report reads.
+struct CompressionCounters {
+    std::atomic<uint64_t> bytesIn{0};
+    std::atomic<uint64_t> bytesOut{0};
+
+    // Uncompressed bytes per byte sent
+    double getRatio() const {
+        uint64_t out = bytesOut;
+        return out ? static_cast<double>(bytesIn.load()) / out : 0.0;
+    }
+};
+
+// Server-wide counters, reported periodically by TelnetServer
+class ServerMetrics {
+private:
+    // Time from a listener becoming ready to the connection being accepted
+    LatencyHistogram acceptLatency;
+    std::atomic<uint64_t> connectionsAccepted;
+
+    // Outbound queues
+    std::atomic<int64_t> outboundQueuedBytes;  // currently waiting, all connections
+    std::atomic<uint64_t> outboundPeakBytes;   // largest single queue seen
+    std::atomic<uint64_t> outboundOverflows;   // connections dropped at the high-water mark
+    std::atomic<uint64_t> writeCalls;          // writev/send submissions
+    std::atomic<uint64_t> writeBlocked;        // times a socket filled and waited for EPOLLOUT
+
+    // Output coalescing, totalled over closed connections
+    std::atomic<uint64_t> responses;           // loop ticks that produced output
+    std::atomic<uint64_t> dataSegments;        // TCP segments that carried it
+
+    // MCCP2: totals over finished streams, and the streams still open (by
+    // socket), which the report adds in
+    mutable std::mutex compressionMutex;
+    uint64_t compressedConnections;
+    uint64_t compressionBytesIn;
+    uint64_t compressionBytesOut;
+    std::vector<std::pair<int, std::shared_ptr<CompressionCounters>>> openCompressions;
+
+    // Admission control and rate limiting
+    std::atomic<uint64_t> connectionsRefused;  // over the per-address cap
+    std::atomic<uint64_t> commandsThrottled;   // held back until a token was free
+    std::atomic<uint64_t> floodDisconnects;
+
+    // Output buffer memory held by the reactors' chunk pools
+    std::atomic<int64_t> chunkPoolBytes;
+
+    // Command executor: jobs waiting for a worker, and the time a job (the
+    // commands or frames parsed from one read) spends in each stage
+    std::atomic<int64_t> commandsWaiting;
+    std::atomic<int64_t> commandsWaitingPeak;
+    std::atomic<uint64_t> commandSteals;       // strands a worker took from another
+    LatencyHistogram commandWait;              // posted -> picked up by a worker
+    LatencyHistogram commandRun;               // running on the worker
+    LatencyHistogram commandHandback;          // done -> its session's reactor carries on
+
+    ServerMetrics()
+        : connectionsAccepted(0), outboundQueuedBytes(0), outboundPeakBytes(0),
+          outboundOverflows(0), writeCalls(0), writeBlocked(0),
+          responses(0), dataSegments(0),
+          compressedConnections(0), compressionBytesIn(0), compressionBytesOut(0),
+          connectionsRefused(0), commandsThrottled(0), floodDisconnects(0), chunkPoolBytes(0),
+          commandsWaiting(0), commandsWaitingPeak(0), commandSteals(0) {}
+
+public:
+    static ServerMetrics& getInstance() {
+        static ServerMetrics instance;
+        return instance;
+    }
+
+    static uint64_t microsSince(std::chrono::steady_clock::time_point start) {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+
+    void recordAccept(std::chrono::steady_clock::time_point readyTime) {
+        connectionsAccepted.fetch_add(1, std::memory_order_relaxed);
+        acceptLatency.record(microsSince(readyTime));
+    }
+
+    // Track a connection's queue growing or shrinking by delta bytes
+    void recordOutboundQueued(int64_t delta, size_t connectionQueuedBytes) {
+        outboundQueuedBytes.fetch_add(delta, std::memory_order_relaxed);
+        uint64_t peak = outboundPeakBytes.load(std::memory_order_relaxed);
+        while (connectionQueuedBytes > peak &&
+               !outboundPeakBytes.compare_exchange_weak(peak, connectionQueuedBytes, std::memory_order_relaxed)) {
+        }
+    }
+
+    void recordOutboundOverflow() { outboundOverflows.fetch_add(1, std::memory_order_relaxed); }
+    void recordWriteCall() { writeCalls.fetch_add(1, std::memory_order_relaxed); }
+    void recordWriteBlocked() { writeBlocked.fetch_add(1, std::memory_order_relaxed); }
+
+    // Called as a connection closes
+    void recordConnectionOutput(uint64_t connResponses, uint64_t connSegments) {
+        responses.fetch_add(connResponses, std::memory_order_relaxed);
+        dataSegments.fetch_add(connSegments, std::memory_order_relaxed);
+    }
+
+    void recordCompressionStarted(int socket, std::shared_ptr<CompressionCounters> counters) {
+        std::lock_guard<std::mutex> lock(compressionMutex);
+        // Streams whose connection went without recordCompression() (a
+        // hot restart taken back) are held only here; count them as done
+        for (size_t i = 0; i < openCompressions.size();) {
+            if (openCompressions[i].second.use_count() == 1) {
+                addCompressionTotals(*openCompressions[i].second);
+                openCompressions.erase(openCompressions.begin() + i);
+            } else {
+                i++;
+            }
+        }
+        openCompressions.emplace_back(socket, std::move(counters));
+    }
+
+    // Called as a stream ends
+    void recordCompression(const std::shared_ptr<CompressionCounters>& counters) {
+        std::lock_guard<std::mutex> lock(compressionMutex);
+        for (auto it = openCompressions.begin(); it != openCompressions.end(); ++it) {
+            if (it->second == counters) {
+                openCompressions.erase(it);
+                break;
+            }
+        }
+        addCompressionTotals(*counters);
+    }
+
+    void addCompressionTotals(const CompressionCounters& counters) {
+        compressedConnections++;
+        compressionBytesIn += counters.bytesIn;
+        compressionBytesOut += counters.bytesOut;
+    }
+
+    void recordConnectionRefused() { connectionsRefused.fetch_add(1, std::memory_order_relaxed); }
+    void recordCommandThrottled() { commandsThrottled.fetch_add(1, std::memory_order_relaxed); }
+    void recordFloodDisconnect() { floodDisconnects.fetch_add(1, std::memory_order_relaxed); }
+    void recordChunkPoolBytes(int64_t delta) { chunkPoolBytes.fetch_add(delta, std::memory_order_relaxed); }
+
+    void recordCommandQueued() {
+        int64_t waiting = commandsWaiting.fetch_add(1, std::memory_order_relaxed) + 1;
+        int64_t peak = commandsWaitingPeak.load(std::memory_order_relaxed);
+        while (waiting > peak &&
+               !commandsWaitingPeak.compare_exchange_weak(peak, waiting, std::memory_order_relaxed)) {
+        }
+    }
+
+    void recordCommandStarted(std::chrono::steady_clock::duration waited) {
+        commandsWaiting.fetch_sub(1, std::memory_order_relaxed);
+        commandWait.record(toMicros(waited));
+    }
+
+    void recordCommandFinished(std::chrono::steady_clock::duration ran) { commandRun.record(toMicros(ran)); }
+    void recordCommandHandback(std::chrono::steady_clock::time_point finished) { commandHandback.record(microsSince(finished)); }
+    void recordCommandSteal() { commandSteals.fetch_add(1, std::memory_order_relaxed); }
+
+    static uint64_t toMicros(std::chrono::steady_clock::duration duration) {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+    }
+
+    double getSegmentsPerResponse() const {
+        uint64_t n = responses;
+        return n ? static_cast<double>(dataSegments.load()) / n : 0.0;
+    }
+
+    std::string getReport() const {
+        std::string report = "Metrics:\n";
+        report += "  connections accepted: " + std::to_string(connectionsAccepted.load()) + "\n";
+        report += "  accept latency: " + acceptLatency.summary() + "\n";
+        report += "  outbound queued: " + std::to_string(outboundQueuedBytes.load()) + " bytes" +
+                  " (peak per connection " + std::to_string(outboundPeakBytes.load()) + " bytes)\n";
+        report += "  outbound overflows: " + std::to_string(outboundOverflows.load()) + "\n";
+        report += "  write calls: " + std::to_string(writeCalls.load()) +
+                  ", blocked on EPOLLOUT: " + std::to_string(writeBlocked.load()) + "\n";
+        report += "  segments per response: " + std::to_string(getSegmentsPerResponse()) +
+                  " (" + std::to_string(dataSegments.load()) + " segments / " +
+                  std::to_string(responses.load()) + " responses)\n";
+        appendCompression(report);
+        report += "  refused connections: " + std::to_string(connectionsRefused.load()) +
+                  ", throttled commands: " + std::to_string(commandsThrottled.load()) +
+                  ", flood disconnects: " + std::to_string(floodDisconnects.load()) + "\n";
+        report += "  output buffer pools: " + std::to_string(chunkPoolBytes.load() / 1024) + " KB\n";
+        report += "  command queue: " + std::to_string(commandsWaiting.load()) + " waiting (peak " +
+                  std::to_string(commandsWaitingPeak.load()) + "), " +
+                  std::to_string(commandSteals.load()) + " steals\n";
+        report += "  command wait: " + commandWait.summary() + "\n";
+        report += "  command run: " + commandRun.summary() + "\n";
+        report += "  command handback: " + commandHandback.summary() + "\n";
+        return report;
+    }
+
+    // Totals over every stream, open ones included, then a line for each
+    // open one
+    void appendCompression(std::string& report) const {
+        std::lock_guard<std::mutex> lock(compressionMutex);
+        uint64_t connections = compressedConnections, in = compressionBytesIn, out = compressionBytesOut;
+        std::string open;
+        size_t openCount = 0;
+        for (const auto& pair : openCompressions) {
+            const CompressionCounters& counters = *pair.second;
+            connections++;
+            in += counters.bytesIn;
+            out += counters.bytesOut;
+            if (pair.second.use_count() == 1) {
+                continue;  // its connection is gone
+            }
+            openCount++;
+            open += "    connection " + std::to_string(pair.first) + ": " + std::to_string(counters.bytesIn.load()) +
+                    " -> " + std::to_string(counters.bytesOut.load()) + " bytes (ratio " +
+                    std::to_string(counters.getRatio()) + ")\n";
+        }
+        report += "  compression: " + std::to_string(connections) + " connections (" +
+                  std::to_string(openCount) + " open), " +
+                  std::to_string(in) + " -> " + std::to_string(out) + " bytes (ratio " +
+                  std::to_string(out ? static_cast<double>(in) / out : 0.0) + ")\n";
+        report += open;
+    }
+};
+
+#endif //METRICS_H
@@ -0,0 +1,72 @@
+#ifndef MPSCQUEUE_H
+#define MPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Lock-free multi-producer / single-consumer queue. Producers push with a
+// single compare-and-swap; the consumer takes everything pushed so far
+// with one exchange and walks it oldest first. Because the consumer only
+// ever takes the whole list, there is no ABA problem to guard against.
+template <typename T>
+class MpscQueue {
+private:
+    struct Node {
+        T value;
+        Node* next;
+    };
+
+    std::atomic<Node*> head;  // newest first
+
+public:
+    MpscQueue() : head(nullptr) {}
+
+    ~MpscQueue() {
+        drain([](T&) {});
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    // Safe to call from any thread
+    void push(T value) {
+        Node* node = new Node{std::move(value), head.load(std::memory_order_relaxed)};
+        while (!head.compare_exchange_weak(node->next, node,
+                                           std::memory_order_acq_rel,
+                                           std::memory_order_relaxed)) {
+        }
+    }
+
+    // Consumer thread only. Calls consume(T&) for each queued item in the
+    // order it was pushed and returns how many there were.
+    template <typename Consume>
+    size_t drain(Consume consume) {
+        Node* list = head.exchange(nullptr, std::memory_order_acq_rel);
+
+        // Reverse into push order
+        Node* ordered = nullptr;
+        while (list) {
+            Node* next = list->next;
+            list->next = ordered;
+            ordered = list;
+            list = next;
+        }
+
+        size_t count = 0;
+        while (ordered) {
+            Node* next = ordered->next;
+            consume(ordered->value);
+            delete ordered;
+            ordered = next;
+            count++;
+        }
+        return count;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == nullptr;
+    }
+};
+
+#endif //MPSCQUEUE_H
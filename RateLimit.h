@@ -0,0 +1,107 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+// Classic token bucket: holds up to burst tokens and refills at rate per
+// second. Owned by one connection and only touched on its reactor thread.
+class TokenBucket {
+public:
+    TokenBucket() : rate(0), burst(0), tokens(0) {}
+
+    // A rate of 0 means unlimited
+    void configure(double perSecond, double burstSize) {
+        rate = perSecond;
+        burst = burstSize < 1 ? 1 : burstSize;
+        tokens = burst;
+        updated = std::chrono::steady_clock::now();
+    }
+
+    bool isLimited() const { return rate > 0; }
+
+    // Spend a token if one is available
+    bool take(std::chrono::steady_clock::time_point now) {
+        if (!isLimited()) {
+            return true;
+        }
+        refill(now);
+        if (tokens < 1) {
+            return false;
+        }
+        tokens -= 1;
+        return true;
+    }
+
+    // How long until take() can succeed
+    std::chrono::milliseconds timeUntilToken(std::chrono::steady_clock::time_point now) {
+        refill(now);
+        if (!isLimited() || tokens >= 1) {
+            return std::chrono::milliseconds(0);
+        }
+        return std::chrono::milliseconds(static_cast<int64_t>((1 - tokens) * 1000 / rate) + 1);
+    }
+
+private:
+    void refill(std::chrono::steady_clock::time_point now) {
+        double elapsed = std::chrono::duration<double>(now - updated).count();
+        updated = now;
+        tokens += elapsed * rate;
+        if (tokens > burst) {
+            tokens = burst;
+        }
+    }
+
+    double rate;
+    double burst;
+    double tokens;
+    std::chrono::steady_clock::time_point updated;
+};
+
+// Open connections per source IPv4 address, shared by every reactor's
+// accept path
+class ConnectionLimiter {
+public:
+    ConnectionLimiter() : maxPerAddress(0) {}
+
+    // 0 means unlimited
+    void setMaxPerAddress(int limit) { maxPerAddress = limit; }
+
+    // Count a new connection from address, unless that would go over the
+    // limit. force counts it regardless (connections kept over a hot restart).
+    bool admit(uint32_t address, bool force = false) {
+        std::lock_guard<std::mutex> lock(mutex);
+        int& open = counts[address];
+        if (!force && maxPerAddress > 0 && open >= maxPerAddress) {
+            if (open == 0) {
+                counts.erase(address);
+            }
+            return false;
+        }
+        open++;
+        return true;
+    }
+
+    void release(uint32_t address) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = counts.find(address);
+        if (it != counts.end() && --it->second <= 0) {
+            counts.erase(it);
+        }
+    }
+
+    // Forget every connection, for counting them all again
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        counts.clear();
+    }
+
+private:
+    int maxPerAddress;
+    std::mutex mutex;
+    std::unordered_map<uint32_t, int> counts;
+};
+
+#endif //RATELIMIT_H
@@ -0,0 +1,392 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "MpscQueue.h"
+#include "TimerWheel.h"
+
+// I/O backends a reactor can be built on
+enum class IoBackend { EPOLL, IO_URING };
+
+// Names one connection for as long as it lives. The slot is the socket's
+// entry in the ConnectionRegistry; its generation changes each time the
+// slot is reused, so a handle kept past a disconnect can never reach the
+// next client that gets the same fd.
+struct ConnectionHandle {
+    uint32_t slot;
+    uint32_t generation;  // 0 means no connection
+
+    ConnectionHandle() : slot(0), generation(0) {}
+    ConnectionHandle(uint32_t slot, uint32_t generation) : slot(slot), generation(generation) {}
+
+    bool isValid() const { return generation != 0; }
+
+    // Both halves in one word, for storing in an atomic
+    uint64_t pack() const { return (static_cast<uint64_t>(generation) << 32) | slot; }
+    static ConnectionHandle unpack(uint64_t value) {
+        return ConnectionHandle(static_cast<uint32_t>(value), static_cast<uint32_t>(value >> 32));
+    }
+
+    bool operator==(const ConnectionHandle& other) const {
+        return slot == other.slot && generation == other.generation;
+    }
+    bool operator!=(const ConnectionHandle& other) const { return !(*this == other); }
+};
+
+namespace std {
+    template <> struct hash<ConnectionHandle> {
+        size_t operator()(const ConnectionHandle& handle) const {
+            return std::hash<uint64_t>()(handle.pack());
+        }
+    };
+}
+
+// What a connection speaks, so code that notifies other connections can
+// encode for each of them
+enum class WireProtocol : uint8_t { TELNET, BINARY };
+
+// Per-connection state driven by a Reactor. All callbacks run on the
+// reactor thread that owns the socket.
+class ConnectionHandler {
+public:
+    virtual ~ConnectionHandler() {}
+
+    // Set by the reactor when the socket is registered, before onOpen()
+    void setHandle(ConnectionHandle newHandle) { handle = newHandle; }
+    ConnectionHandle getHandle() const { return handle; }
+
+    // Called once after the socket has been registered with the reactor
+    virtual void onOpen() {}
+
+    // Called with the bytes read from the socket
+    virtual void onData(const char* data, size_t len) = 0;
+
+    // Called once when the peer has gone away
+    virtual void onClose() = 0;
+
+    virtual int getSocket() const = 0;
+
+    virtual WireProtocol getProtocol() const { return WireProtocol::TELNET; }
+
+private:
+    ConnectionHandle handle;
+};
+
+// Rewrites a connection's output stream on its way to the socket, e.g. to
+// compress it. Only called on the reactor thread that owns the connection.
+class OutputFilter {
+public:
+    virtual ~OutputFilter() {}
+
+    // Feed data through the filter, appending whatever output is ready
+    virtual void write(std::string_view data, std::string& out) = 0;
+
+    // End of an output batch: append what the peer needs to decode
+    // everything written so far
+    virtual void flush(std::string& out) = 0;
+
+    // The filter is being removed: append the end of its stream
+    virtual void finish(std::string& out) = 0;
+};
+
+// A connection taken out of a reactor by Reactor::release(), still open
+struct ReleasedConnection {
+    std::shared_ptr<ConnectionHandler> handler;
+    int fd;
+    std::string unsent;  // output, already filtered, that never reached the socket
+};
+
+// Event loop owning a set of sockets. Each reactor runs on its own thread,
+// so an idle connection costs a map entry and its handler rather than a
+// thread. Subclasses supply the I/O backend (epoll or io_uring).
+class Reactor {
+public:
+    // Called on the reactor thread for every socket accepted on a listener
+    typedef std::function<void(int clientSocket)> AcceptCallback;
+
+    explicit Reactor(int id)
+        : id(id), running(false), connectionCount(0), outboundHighWaterMark(1 << 20),
+          loopTick(0), timerFd(-1), wakePending(false), deliveringOutbox(false), ticking(false),
+          timerEpoch(std::chrono::steady_clock::now()) {}
+
+    virtual ~Reactor() {}
+
+    virtual const char* getBackendName() const = 0;
+
+    virtual bool start() = 0;
+    virtual void stop() = 0;
+
+    // Hot restart, in two steps so no reactor is still running handlers
+    // while another is being emptied. pause() stops the loop and leaves
+    // every socket in place; release() (after all reactors are paused)
+    // hands back the connections, with output filters finished, and
+    // frees the reactor without closing any client or listening socket.
+    virtual void pause() = 0;
+    virtual std::vector<ReleasedConnection> release() = 0;
+
+    // Take over a non-blocking listening socket and accept from it
+    virtual void addListener(int fd, AcceptCallback onAccept) = 0;
+
+    // Hand a connected, non-blocking socket over to this reactor.
+    // Safe to call from any thread.
+    virtual void addConnection(std::shared_ptr<ConnectionHandler> handler) = 0;
+
+    // Unregister and close a connection once its pending output is written.
+    // Safe to call from any thread; the close happens on the reactor thread
+    // so the fd cannot be reused while it is still registered.
+    virtual void removeConnection(ConnectionHandle conn) = 0;
+
+    // Queue data on a connection owned by this reactor. Returns at once;
+    // the reactor writes it out when the socket is writable. Data for a
+    // handle whose connection has already closed is dropped. On the loop
+    // thread the bytes are copied straight into the connection's queue,
+    // behind any cross-thread output that was handed over before them.
+    virtual bool send(ConnectionHandle conn, std::string_view data) = 0;
+
+    // Pass all output queued on the connection from now on through filter,
+    // which is flushed once per loop iteration. A null filter removes the
+    // current one after letting it finish its stream.
+    virtual void setOutputFilter(ConnectionHandle conn, std::shared_ptr<OutputFilter> filter) = 0;
+
+    // Loop thread only. Run callback, as a posted task, once everything
+    // queued on the connection so far has been handed to the socket.
+    // Returns false, and never runs it, if there is nothing to wait for:
+    // no output is pending or the connection is closing. One callback per
+    // connection at a time; it is dropped if the connection goes away.
+    virtual bool whenFlushed(ConnectionHandle conn, std::function<void()> callback) = 0;
+
+    // A connection whose unsent output grows past this many bytes is too
+    // slow to keep up and gets disconnected
+    void setOutboundHighWaterMark(size_t bytes) { outboundHighWaterMark = bytes; }
+
+    // Run a task on the reactor thread
+    void post(std::function<void()> task) {
+        // Output batched on this thread goes first, as it was sent first
+        flushBatchedSends();
+        {
+            std::lock_guard<std::mutex> lock(tasksMutex);
+            tasks.push_back(std::move(task));
+        }
+        signal();
+    }
+
+    // Run callback on the loop thread once delay has passed, give or take
+    // a tick. Call from the loop thread only; a timer is cheap enough to
+    // keep one per connection.
+    TimerWheel::TimerId runAfter(std::chrono::milliseconds delay, TimerWheel::Callback callback) {
+        uint64_t now = currentTick();
+        if (timers.empty()) {
+            timers.advance(now);
+            setTicking(true);
+        }
+        // The wheel lags the clock by up to a tick between timerfd reads
+        uint64_t ticks = (static_cast<uint64_t>(delay.count()) + TICK_MS - 1) / TICK_MS;
+        return timers.schedule(now - timers.getTick() + ticks, std::move(callback));
+    }
+
+    // Loop thread only. Cancelling a timer that already ran does nothing.
+    void cancelTimer(TimerWheel::TimerId timer) {
+        timers.cancel(timer);
+    }
+
+    // While one is alive, output this thread hands to reactors is held
+    // back and merged, one message per run of sends to a connection, and
+    // handed over when the last one goes or before a post(). For a worker
+    // running a batch of commands, whose replies would otherwise each cost
+    // a push and a drain.
+    class BatchedSends {
+    public:
+        BatchedSends() { batchDepth++; }
+        ~BatchedSends() {
+            if (--batchDepth == 0) {
+                flushBatchedSends();
+            }
+        }
+        BatchedSends(const BatchedSends&) = delete;
+        BatchedSends& operator=(const BatchedSends&) = delete;
+    };
+
+    bool isInLoopThread() const {
+        return std::this_thread::get_id() == loopThread.get_id();
+    }
+
+    int getId() const { return id; }
+    int getConnectionCount() const { return connectionCount; }
+
+protected:
+    // Interrupt the loop so it picks up posted tasks
+    virtual void wakeup() = 0;
+
+    // Hand output from another thread to the loop. A single lock-free
+    // push; the loop moves it onto the connection's queue when it drains
+    // the outbox, so only the reactor thread ever writes to the socket.
+    void enqueueOutbound(ConnectionHandle conn, std::string_view data) {
+        if (batchDepth > 0) {
+            if (batched.reactor == this && batched.conn == conn) {
+                batched.data.append(data);
+                return;
+            }
+            flushBatchedSends();
+            batched.reactor = this;
+            batched.conn = conn;
+            batched.data.assign(data);
+            return;
+        }
+        outbox.push(OutboundMessage{conn, std::string(data)});
+        signal();
+    }
+
+    // Cross-thread output that never reached the loop, for release()
+    template <typename Consume>
+    void drainOutbox(Consume consume) {
+        outbox.drain([&consume](OutboundMessage& message) {
+            consume(message.conn, message.data);
+        });
+    }
+
+    // Wheel resolution. The timerfd only ticks while timers are pending,
+    // so an idle reactor is never woken for them.
+    static const int TICK_MS = 100;
+
+    // Called by the backend each time timerFd fires
+    void expireTimers() {
+        timers.advance(currentTick());
+        if (timers.empty()) {
+            setTicking(false);
+        }
+    }
+
+    // Loop thread, before queueing output of its own: deliver the
+    // cross-thread output already handed over, so a reply a command
+    // worker sent first is not overtaken by one sent from here after it
+    void catchUpOutbox() {
+        if (!deliveringOutbox && !outbox.empty()) {
+            deliverOutbox();
+        }
+    }
+
+    // Run on the loop thread once per iteration: cross-thread output
+    // first, so a send followed by a posted close keeps its order
+    void runTasks() {
+        wakePending.store(false, std::memory_order_seq_cst);
+
+        deliverOutbox();
+
+        std::vector<std::function<void()>> pending;
+        {
+            std::lock_guard<std::mutex> lock(tasksMutex);
+            pending.swap(tasks);
+        }
+        for (auto& task : pending) {
+            task();
+        }
+
+        // Output queued from here on goes out in the next iteration's flush
+        loopTick++;
+    }
+
+protected:
+    int id;
+    std::atomic<bool> running;
+    std::atomic<int> connectionCount;
+    std::thread loopThread;
+    size_t outboundHighWaterMark;
+    uint64_t loopTick;  // loop iterations; output queued in one tick is one response
+    int timerFd;        // periodic timerfd driving the wheel, opened by the backend
+
+private:
+    uint64_t currentTick() const {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - timerEpoch).count()) / TICK_MS;
+    }
+
+    void deliverOutbox() {
+        deliveringOutbox = true;
+        outbox.drain([this](OutboundMessage& message) {
+            send(message.conn, message.data);
+        });
+        deliveringOutbox = false;
+    }
+
+    // Hand over what this thread's BatchedSends is holding
+    static void flushBatchedSends() {
+        Reactor* target = batched.reactor;
+        if (!target) {
+            return;
+        }
+        batched.reactor = nullptr;
+        // Copied out at its final size; the staging string keeps its capacity
+        target->outbox.push(OutboundMessage{batched.conn, std::string(batched.data)});
+        batched.data.clear();
+        target->signal();
+    }
+
+    void setTicking(bool on) {
+        if (on == ticking || timerFd < 0) {
+            return;
+        }
+        struct itimerspec spec;
+        memset(&spec, 0, sizeof(spec));
+        if (on) {
+            spec.it_interval.tv_nsec = TICK_MS * 1000000L;
+            spec.it_value = spec.it_interval;
+        }
+        if (timerfd_settime(timerFd, 0, &spec, nullptr) < 0) {
+            perror("timerfd_settime");
+            return;
+        }
+        ticking = on;
+    }
+
+    // Wake the loop unless a wakeup is already on its way. Producers that
+    // find one pending make no syscall at all.
+    void signal() {
+        if (!wakePending.exchange(true, std::memory_order_seq_cst)) {
+            wakeup();
+        }
+    }
+
+    struct OutboundMessage {
+        ConnectionHandle conn;
+        std::string data;
+    };
+
+    // Output held by this thread's BatchedSends, for one connection
+    struct BatchedOutput {
+        Reactor* reactor;  // null when nothing is held
+        ConnectionHandle conn;
+        std::string data;
+    };
+
+    std::mutex tasksMutex;
+    std::vector<std::function<void()>> tasks;
+    MpscQueue<OutboundMessage> outbox;  // drained only by the loop thread
+    std::atomic<bool> wakePending;      // a wakeup has been sent and not yet consumed
+    bool deliveringOutbox;              // inside deliverOutbox(); loop thread only
+    TimerWheel timers;                  // loop thread only
+    bool ticking;                       // timerFd is armed
+    std::chrono::steady_clock::time_point timerEpoch;  // tick 0
+
+    static inline thread_local int batchDepth = 0;
+    static inline thread_local BatchedOutput batched = BatchedOutput{nullptr, ConnectionHandle(), std::string()};
+};
+
+#endif //REACTOR_H
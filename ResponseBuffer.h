@@ -0,0 +1,62 @@
+#ifndef RESPONSEBUFFER_H
+#define RESPONSEBUFFER_H
+
+#include <charconv>
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <string_view>
+
+// A text response under construction. Each thread keeps a small stack of
+// strings that are emptied but never freed, so once they have grown to
+// the largest response (a board, the who list) building one allocates
+// nothing. Renderers append to a std::string&, like the BinaryProtocol
+// writers, and the finished text is handed to Reactor::send(), which
+// copies it into the connection's outbound chunks.
+//
+// Leases nest: a response can be built while another one, further out on
+// the same thread, is still open.
+class ResponseBuffer {
+public:
+    ResponseBuffer() : text(lease()) {
+        text.clear();
+    }
+
+    ~ResponseBuffer() {
+        depth--;
+    }
+
+    ResponseBuffer(const ResponseBuffer&) = delete;
+    ResponseBuffer& operator=(const ResponseBuffer&) = delete;
+
+    std::string& str() { return text; }
+    std::string_view view() const { return text; }
+    bool empty() const { return text.empty(); }
+
+    // Decimal value, right-aligned in width characters
+    static void appendInt(std::string& out, long long value, int width = 0) {
+        char digits[24];
+        auto result = std::to_chars(digits, digits + sizeof(digits), value);
+        size_t len = static_cast<size_t>(result.ptr - digits);
+        if (width > 0 && len < static_cast<size_t>(width)) {
+            out.append(static_cast<size_t>(width) - len, ' ');
+        }
+        out.append(digits, len);
+    }
+
+private:
+    static std::string& lease() {
+        // A deque, so strings further down stay put as the stack grows
+        if (depth == stack.size()) {
+            stack.emplace_back();
+        }
+        return stack[depth++];
+    }
+
+    std::string& text;
+
+    static inline thread_local std::deque<std::string> stack;
+    static inline thread_local size_t depth = 0;
+};
+
+#endif //RESPONSEBUFFER_H
@@ -0,0 +1,58 @@
+#ifndef SERVERCONFIG_H
+#define SERVERCONFIG_H
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+#include "Reactor.h"
+
+// How long a client may stay in each state before it is dropped, in
+// seconds; 0 turns a limit off. Enforced with the reactors' timer wheels.
+struct SessionTimeouts {
+    int login;  // connected without logging in (or finishing a WebSocket upgrade)
+    int idle;   // nothing received
+    int mail;   // no line typed while composing a mail
+    int mailDeadline;  // composing one mail, from start to "."
+
+    SessionTimeouts() : login(60), idle(3600), mail(60), mailDeadline(600) {}
+};
+
+// Admission control and per-connection command rates; 0 turns a limit
+// off. A client over its rate is slowed down, and one that keeps sending
+// until its input buffer fills is disconnected for flooding.
+struct RateLimits {
+    int connectionsPerAddress;  // open connections from one IP address
+    double chatPerSecond;       // shout, tell, kibitz and mail
+    double chatBurst;
+    double gamePerSecond;       // moves and every other command
+    double gameBurst;
+
+    RateLimits() : connectionsPerAddress(32), chatPerSecond(1), chatBurst(5),
+                   gamePerSecond(10), gameBurst(20) {}
+};
+
+// Startup options for TelnetServer, filled in from the command line
+struct ServerConfig {
+    int port;
+    int binaryPort;       // bot protocol port, 0 = disabled
+    int webSocketPort;    // browser port, 0 = disabled
+    std::string unixSocketPath;       // telnet on a Unix domain socket, empty = disabled
+    std::string binaryUnixSocketPath; // bot protocol on a Unix domain socket, likewise
+    std::vector<uid_t> trustedUids;   // local peers running as these skip rate limits
+    int reactorThreads;   // 0 = one per hardware thread
+    int commandThreads;   // workers running commands, 0 = one per hardware thread, -1 = none (the reactors run them)
+    IoBackend ioBackend;  // falls back to epoll if io_uring is unavailable
+    int listenBacklog;    // pending-connection queue length per listener
+    size_t outboundHighWaterMark; // unsent bytes before a client counts as stuck
+    size_t maxMailBody;   // bytes of body one mail may have, 0 = no limit
+    int resumeFd;         // hot restart channel from the old process, -1 = fresh start
+    SessionTimeouts timeouts;
+    RateLimits limits;
+
+    ServerConfig() : port(8023), binaryPort(8024), webSocketPort(8025), reactorThreads(0), commandThreads(0), ioBackend(IoBackend::EPOLL),
+                     listenBacklog(SOMAXCONN), outboundHighWaterMark(1 << 20), maxMailBody(16 * 1024),
+                     resumeFd(-1) {}
+};
+
+#endif //SERVERCONFIG_H
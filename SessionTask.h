@@ -0,0 +1,77 @@
+#ifndef SESSIONTASK_H
+#define SESSIONTASK_H
+
+#include <coroutine>
+#include <exception>
+#include <iostream>
+#include <utility>
+
+// Return type of a coroutine that runs one interactive flow of a client
+// session, such as composing a mail or a login prompt. The flow starts
+// right away and runs until its first co_await; from then on whatever it
+// waits for resumes it on the connection's reactor thread. A suspended
+// flow costs its frame and nothing else, so thousands of them need no
+// thread of their own.
+//
+// The task owns the frame: it stays suspended at the end so the owner
+// can see it finished, and is destroyed with the task. Dropping the task
+// while the flow is suspended (the client went away) just unwinds it.
+class SessionTask {
+public:
+    struct promise_type {
+        SessionTask get_return_object() {
+            return SessionTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+
+        // Nobody to rethrow to; end the flow and keep the server up
+        void unhandled_exception() {
+            try {
+                throw;
+            } catch (const std::exception& e) {
+                std::cerr << "Session flow failed: " << e.what() << std::endl;
+            } catch (...) {
+                std::cerr << "Session flow failed" << std::endl;
+            }
+        }
+    };
+
+    SessionTask() : handle(nullptr) {}
+
+    SessionTask(SessionTask&& other) : handle(std::exchange(other.handle, nullptr)) {}
+
+    SessionTask& operator=(SessionTask&& other) {
+        if (this != &other) {
+            reset();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+
+    SessionTask(const SessionTask&) = delete;
+    SessionTask& operator=(const SessionTask&) = delete;
+
+    ~SessionTask() { reset(); }
+
+    // A flow is running or suspended, not finished
+    bool isActive() const { return handle && !handle.done(); }
+    bool isDone() const { return handle && handle.done(); }
+
+    // Free the frame. Never from inside the flow itself.
+    void reset() {
+        if (handle) {
+            handle.destroy();
+            handle = nullptr;
+        }
+    }
+
+private:
+    explicit SessionTask(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+#endif //SESSIONTASK_H
@@ -0,0 +1,124 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Flat binary encoding of server state handed from one process to the
+// next on a hot restart. Both sides are the same build, so the format
+// only needs to be unambiguous, not stable.
+class SnapshotWriter {
+private:
+    std::string data;
+
+public:
+    void putU8(uint8_t value) {
+        data += static_cast<char>(value);
+    }
+
+    void putU32(uint32_t value) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            data += static_cast<char>(value >> shift);
+        }
+    }
+
+    void putI64(int64_t value) {
+        uint64_t bits = static_cast<uint64_t>(value);
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            data += static_cast<char>(bits >> shift);
+        }
+    }
+
+    void putBool(bool value) {
+        putU8(value ? 1 : 0);
+    }
+
+    void putString(const std::string& value) {
+        putU32(static_cast<uint32_t>(value.size()));
+        data += value;
+    }
+
+    void putBytes(const void* bytes, size_t len) {
+        data.append(static_cast<const char*>(bytes), len);
+    }
+
+    const std::string& getData() const { return data; }
+};
+
+// Reads what SnapshotWriter wrote. Running past the end yields zeros and
+// marks the reader bad instead of throwing, so a truncated snapshot is
+// caught by one isOk() check at the end.
+class SnapshotReader {
+private:
+    const std::string& data;
+    size_t pos;
+    bool ok;
+
+    bool need(size_t len) {
+        if (!ok || data.size() - pos < len) {
+            ok = false;
+            return false;
+        }
+        return true;
+    }
+
+public:
+    explicit SnapshotReader(const std::string& data) : data(data), pos(0), ok(true) {}
+
+    uint8_t getU8() {
+        if (!need(1)) {
+            return 0;
+        }
+        return static_cast<uint8_t>(data[pos++]);
+    }
+
+    uint32_t getU32() {
+        if (!need(4)) {
+            return 0;
+        }
+        uint32_t value = 0;
+        for (int i = 0; i < 4; i++) {
+            value = (value << 8) | static_cast<uint8_t>(data[pos++]);
+        }
+        return value;
+    }
+
+    int64_t getI64() {
+        if (!need(8)) {
+            return 0;
+        }
+        uint64_t value = 0;
+        for (int i = 0; i < 8; i++) {
+            value = (value << 8) | static_cast<uint8_t>(data[pos++]);
+        }
+        return static_cast<int64_t>(value);
+    }
+
+    bool getBool() {
+        return getU8() != 0;
+    }
+
+    std::string getString() {
+        uint32_t len = getU32();
+        if (!need(len)) {
+            return std::string();
+        }
+        std::string value = data.substr(pos, len);
+        pos += len;
+        return value;
+    }
+
+    void getBytes(void* bytes, size_t len) {
+        if (!need(len)) {
+            memset(bytes, 0, len);
+            return;
+        }
+        memcpy(bytes, data.data() + pos, len);
+        pos += len;
+    }
+
+    bool isOk() const { return ok; }
+};
+
+#endif //SNAPSHOT_H
@@ -5,8 +5,20 @@
 #ifndef SOCKETUTILS_H
 #define SOCKETUTILS_H
 
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
 #include <sys/fcntl.h>
-#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <linux/tcp.h>
+#include <unistd.h>
 
 class SocketUtils
 {
@@ -30,71 +42,156 @@ public:
         return true;
     }
 
-    // Send data to socket with error handling
-    static bool sendData(int sock, const std::string& data)
+    // Send small writes at once instead of waiting on Nagle's algorithm;
+    // the reactors batch output per loop iteration themselves
+    static bool setNoDelay(int sock)
     {
-        // Check for valid socket
-        if (sock < 0) {
+        int opt = 1;
+        if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)) < 0)
+        {
+            perror("setsockopt TCP_NODELAY");
             return false;
         }
+        return true;
+    }
 
-        ssize_t total = 0;
-        ssize_t bytesleft = data.length();
-        ssize_t n;
+    // Number of TCP segments carrying data sent on the socket so far
+    static uint64_t getDataSegmentsOut(int sock)
+    {
+        struct tcp_info info;
+        socklen_t len = sizeof(info);
+        memset(&info, 0, sizeof(info));
+        if (getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &len) < 0)
+        {
+            return 0;
+        }
+        return info.tcpi_data_segs_out;
+    }
 
-        while (total < static_cast<ssize_t>(data.length()))
+    // Create a non-blocking TCP socket listening on all interfaces. With
+    // reusePort several sockets can bind the same port and the kernel
+    // spreads incoming connections across them. Returns -1 on failure.
+    static int createListenSocket(int port, int backlog, bool reusePort)
+    {
+        int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (sock < 0)
         {
-            n = send(sock, data.c_str() + total, bytesleft, 0);
-            if (n == -1) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK)
-                {
-                    // Would block, try again later
-                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                    continue;
-                }
-                else
-                {
-                    // Log the error but don't use perror here
-                    return false;
-                }
-            }
-            total += n;
-            bytesleft -= n;
+            perror("socket");
+            return -1;
         }
-        return true;
+
+        int opt = 1;
+        if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+        {
+            perror("setsockopt SO_REUSEADDR");
+            close(sock);
+            return -1;
+        }
+        if (reusePort && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+        {
+            perror("setsockopt SO_REUSEPORT");
+            close(sock);
+            return -1;
+        }
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = INADDR_ANY;
+        addr.sin_port = htons(port);
+
+        if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+        {
+            perror("bind");
+            close(sock);
+            return -1;
+        }
+
+        if (listen(sock, backlog) < 0)
+        {
+            perror("listen");
+            close(sock);
+            return -1;
+        }
+        return sock;
     }
 
-    // Receive data from socket with timeout
-    static std::string receiveData(int sock, int timeout_ms = 1000)
+    // Create a non-blocking Unix domain stream socket listening at path.
+    // A socket file left behind by a server that is gone is replaced; one
+    // that still accepts connections is not. Returns -1 on failure.
+    static int createUnixListenSocket(const std::string& path, int backlog)
     {
-        char buffer[4096];
-        std::string received;
-        struct pollfd pfd;
-        pfd.fd = sock;
-        pfd.events = POLLIN;
-
-        int ret = poll(&pfd, 1, timeout_ms);
-        if (ret > 0)
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(addr.sun_path))
+        {
+            fprintf(stderr, "Unix socket path too long: %s\n", path.c_str());
+            return -1;
+        }
+        memcpy(addr.sun_path, path.c_str(), path.size());
+
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
         {
-            if (pfd.revents & POLLIN)
+            int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            bool live = probe >= 0 && connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+            if (probe >= 0)
+            {
+                close(probe);
+            }
+            if (live)
             {
-                memset(buffer, 0, sizeof(buffer));
-                ssize_t nbytes = recv(sock, buffer, sizeof(buffer) - 1, 0);
-                if (nbytes > 0)
-                {
-                    received = std::string(buffer, nbytes);
-                }
+                fprintf(stderr, "Unix socket %s is in use by another server\n", path.c_str());
+                return -1;
             }
+            unlink(path.c_str());
         }
-        else if (ret == 0)
+
+        int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (sock < 0)
         {
-            // Timeout
+            perror("socket AF_UNIX");
+            return -1;
         }
-        else
+
+        if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+        {
+            perror("bind AF_UNIX");
+            close(sock);
+            return -1;
+        }
+
+        if (listen(sock, backlog) < 0)
         {
-            perror("poll");
+            perror("listen");
+            close(sock);
+            unlink(path.c_str());
+            return -1;
         }
-        return received;
+        return sock;
+    }
+
+    // Process, user and group of the peer of a connected Unix socket, as
+    // the kernel recorded them at connect time
+    static bool getPeerCredentials(int sock, struct ucred& peer)
+    {
+        socklen_t len = sizeof(peer);
+        memset(&peer, 0, sizeof(peer));
+        if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &peer, &len) < 0)
+        {
+            perror("getsockopt SO_PEERCRED");
+            return false;
+        }
+        return true;
+    }
+
+    static bool isUnixSocket(int sock)
+    {
+        struct sockaddr_storage addr;
+        socklen_t len = sizeof(addr);
+        memset(&addr, 0, sizeof(addr));
+        return getsockname(sock, (struct sockaddr*)&addr, &len) == 0 && addr.ss_family == AF_UNIX;
     }
 };
 
@@ -1,30 +1,125 @@
 #ifndef TELNETCLIENTHANDLER_H
 #define TELNETCLIENTHANDLER_H
+#include <functional>
+#include <optional>
 #include <thread>
 #include <string>
-#include <sstream>
 #include <vector>
+#include <iterator>
 #include <algorithm>
 //#include "UserManager.h"
 #include "Game.h"
 #include "Message.h"
-#include <regex>
+#include "Reactor.h"
+#include "ServerConfig.h"
+#include "RateLimit.h"
+#include "ConnectionRegistry.h"
+#include "GameNotifier.h"
+#include "InputBuffer.h"
+#include "TelnetProtocol.h"
+#include "WebSocketProtocol.h"
+#include "DeflateFilter.h"
+#include "Metrics.h"
+#include "SessionTask.h"
+#include "CommandTable.h"
+#include "CommandExecutor.h"
+#include "ResponseBuffer.h"
 #include <iostream>
 #include <fstream>  // Add this line to include ofstream
 
 
-class TelnetClientHandler {
+class TelnetClientHandler : public ConnectionHandler,
+                            public std::enable_shared_from_this<TelnetClientHandler>,
+                            private TelnetParser::Listener, private WebSocketParser::Listener {
 private:
-    int clientSocket;
+    std::atomic<int> clientSocket;
     std::atomic<bool> running;
-    std::thread handlerThread;
-    std::string username; // To track logged-in user
+    Reactor* reactor; // Reactor that owns this connection's socket
+    std::string username; // To track logged-in user; belongs to the strand
+    InputBuffer input;    // Received bytes not yet processed as lines
+    TelnetParser telnet;  // Strips IAC sequences and tracks negotiated options
+    bool webSocket;       // Connected through the WebSocket port instead of telnet
+    WebSocketParser ws;   // Handshake and frame parser for WebSocket clients
+    std::shared_ptr<WebSocketFilter> wsFilter; // Frames our output once the handshake is done
+    bool wsCloseSent;
+    char wsLastByte;      // Last byte of WebSocket message data, to end lines at message ends
+    std::shared_ptr<DeflateFilter> compressor; // Set while MCCP2 is on
+    std::function<void(TelnetClientHandler*)> onDisconnected; // Lets the server drop its reference
+
+    // Commands run on a worker, in order, on this session's strand; the
+    // reactor only parses them. username and whatever the commands touch
+    // belong to the strand. A command that decides how the lines after
+    // it are read (CommandTable::SESSION) holds the input until the
+    // reactor has picked up its outcome; others are handed over as they
+    // come, up to MAX_COMMANDS_IN_FLIGHT.
+    static const int MAX_COMMANDS_IN_FLIGHT = 32;
+    static const size_t MAX_HELD_INPUT = 64 * 1024;  // beyond this the client is flooding
+    std::shared_ptr<CommandExecutor::Strand> strand;
+    std::atomic<int> commandsInFlight;
+    std::atomic<bool> commandsStalled;  // input held until a command finishes
+    bool awaitingCommand;               // a SESSION command is running
+    std::atomic<bool> loggedIn;         // username is set, for the reactor's login timer
+    enum class Outcome : uint8_t { NONE, EXIT, COMPOSE_MAIL, LOGIN_PROMPT, REGISTER_PROMPT };
+    Outcome outcome;                    // what a SESSION command left the reactor to do
+    std::string heldInput;              // read while held lines filled the input buffer
+
+    // Interactive flow in progress (composing mail, a login prompt): a
+    // coroutine on the reactor thread. While it waits in readLine(), input
+    // lines go to it instead of to the command interpreter.
+    SessionTask flow;
+    std::coroutine_handle<> flowWaiter;   // the flow, while suspended
+    bool flowWantsLine;                   // suspended in readLine() rather than flush() or onStrand()
+    std::optional<std::string> flowLine;  // what readLine() resumes with
+
+    // What the flows have collected, kept here rather than in their
+    // frames so a hot restart can carry it over and start them again
+    bool composingMail;
+    std::string mailRecipient;
+    std::string mailTitle;
+    std::string mailBody;
+    std::chrono::steady_clock::time_point mailStarted;  // for its deadline
+    bool mailTooLong;        // went over maxMailBody; lines are dropped until "."
+    size_t maxMailBody;      // 0 = no limit
+    enum class Prompt : uint8_t { NONE, LOGIN, REGISTER };
+    Prompt prompt;           // login or register prompt in progress
+    std::string promptUser;  // name given to it so far
+    bool hidingInput;        // asked the client to stop echoing
+
+    // Limits on logging in, idling and composing mail, each checked by one
+    // reactor timer. Input only records the time; a timer that fires early
+    // re-arms itself for the remainder.
+    SessionTimeouts timeouts;
+    TimerWheel::TimerId loginTimer;
+    TimerWheel::TimerId idleTimer;
+    TimerWheel::TimerId mailTimer;
+    std::chrono::steady_clock::time_point lastInput;
+    std::chrono::steady_clock::time_point lastMailInput;
+
+    // Command rate limits. A line over its bucket's limit waits in
+    // throttledLine, with everything after it left in the input buffer,
+    // until a token frees up.
+    TokenBucket chatBucket;
+    TokenBucket gameBucket;
+    bool throttled;
+    std::string throttledLine;
+    TimerWheel::TimerId throttleTimer;
+    std::string lineScratch;  // processLine()'s printable copy of a line
+    std::vector<std::string_view> tokenScratch;  // processCommand()'s words of it
+    std::vector<CommandTable::Parsed> pendingCommands;  // parsed, not yet posted to the strand
+
+    // Set for a connection carried over by a hot restart; onOpen() picks
+    // the session up again instead of greeting a new client
+    bool resumed;
+    std::string resumedOutput;  // output the old process never got to write
+    bool resumedCompression;
+    bool resumedWebSocketOpen;
+    int resumedObservedGame;
 
 public:
     // Add to TelnetClientHandler.h in the public section
     bool isLoggedIn() const
     {
-        return !username.empty();
+        return loggedIn;
     }
 
     // Add this getter for the username
@@ -37,12 +132,30 @@ public:
     {
         return running && clientSocket >= 0;
     }
-    TelnetClientHandler(int socket)
-        : clientSocket(socket), running(true), username("")
+    int getSocket() const override
+    {
+        return clientSocket;
+    }
+
+    bool isWebSocket() const
+    {
+        return webSocket;
+    }
+
+    // Options negotiated with the client's telnet (window size, terminal type, ...)
+    const TelnetParser& getTelnetOptions() const
+    {
+        return telnet;
+    }
+
+    TelnetClientHandler(int socket, Reactor* reactor, bool webSocket = false)
+        : clientSocket(socket), running(true), reactor(reactor), username(""),
+          webSocket(webSocket), wsCloseSent(false), wsLastByte('\n'),
+          strand(CommandExecutor::getInstance().makeStrand()), commandsInFlight(0), commandsStalled(false),
+          awaitingCommand(false), loggedIn(false), outcome(Outcome::NONE), flowWantsLine(false),
+          composingMail(false), mailTooLong(false), maxMailBody(0), prompt(Prompt::NONE), hidingInput(false),
+          throttled(false), resumed(false), resumedCompression(false), resumedWebSocketOpen(false), resumedObservedGame(-1)
     {
-        // Start the handler thread
-        handlerThread = std::thread(&TelnetClientHandler::handleClient, this);
-        handlerThread.detach();
     }
 
     ~TelnetClientHandler()
@@ -50,43 +163,542 @@ public:
         running = false;
     }
 
+    // Called once, on the reactor thread, when the connection goes away
+    void setDisconnectCallback(std::function<void(TelnetClientHandler*)> callback)
+    {
+        onDisconnected = std::move(callback);
+    }
+
+    // Set before the connection is handed to its reactor
+    void setTimeouts(const SessionTimeouts& limits)
+    {
+        timeouts = limits;
+    }
+
+    void setMaxMailBody(size_t bytes)
+    {
+        maxMailBody = bytes;
+    }
+
+    void setRateLimits(const RateLimits& limits)
+    {
+        chatBucket.configure(limits.chatPerSecond, limits.chatBurst);
+        gameBucket.configure(limits.gamePerSecond, limits.gameBurst);
+    }
+
+    // Reactor callbacks
+    void onOpen() override
+    {
+        startTimers();
+        if (resumed) {
+            resumeSession();
+            return;
+        }
+
+        // WebSocket clients are welcomed once the upgrade is done
+        if (webSocket) {
+            return;
+        }
+
+        telnet.beginNegotiation(*this);
+        sendWelcome();
+    }
+
+    void onData(const char* data, size_t len) override
+    {
+        lastInput = std::chrono::steady_clock::now();
+        if (webSocket) {
+            ws.parse(data, len, *this);
+        } else {
+            telnet.parse(data, len, *this);
+        }
+    }
+
+    void onClose() override
+    {
+        disconnect();
+    }
+
     bool sendMessage(const std::string& message) const
     {
         if (clientSocket >= 0) {
-            return SocketUtils::sendData(clientSocket, message + "\r\n");
+            // Other threads send here too, so the line is built in a
+            // buffer of the calling thread's, which keeps its capacity
+            ResponseBuffer line;
+            line.str() += message;
+            line.str() += "\r\n";
+            return reactor->send(getHandle(), line.view());
+        }
+        return false;
+    }
+
+    void sendWelcome() const
+    {
+        sendMessage("Welcome to Gomoku Server!");
+        sendMessage("Type 'help' or '?' for a list of commands.");
+    }
+
+    // Telnet parser callbacks
+    void onTelnetData(const char* data, size_t len) override
+    {
+        handleInput(data, len);
+    }
+
+    void onTelnetSend(const std::string& bytes) override
+    {
+        if (clientSocket >= 0) {
+            reactor->send(getHandle(), bytes);
+        }
+    }
+
+    void onTelnetOptionChanged(unsigned char option, bool local, bool enabled) override
+    {
+        if (option == Telnet::OPT_ECHO && local && enabled && !hidingInput) {
+            // Agreed to only after the prompt that wanted it was answered
+            std::string out;
+            telnet.requestLocal(Telnet::OPT_ECHO, false, out);
+            onTelnetSend(out);
+            return;
+        }
+        if (option != Telnet::OPT_COMPRESS2 || !local || clientSocket < 0) {
+            return;
+        }
+        if (enabled && !compressor) {
+            startCompression();
+        } else if (!enabled && compressor) {
+            reactor->setOutputFilter(getHandle(), nullptr);
+            recordCompression();
+            compressor.reset();
+        }
+    }
+
+    void startCompression()
+    {
+        // Everything after IAC SB COMPRESS2 IAC SE is compressed
+        auto filter = std::make_shared<DeflateFilter>();
+        if (!filter->isReady()) {
+            return;
+        }
+        const char start[] = { (char)Telnet::IAC, (char)Telnet::SB, (char)Telnet::OPT_COMPRESS2,
+                               (char)Telnet::IAC, (char)Telnet::SE };
+        reactor->send(getHandle(), std::string(start, sizeof(start)));
+        reactor->setOutputFilter(getHandle(), filter);
+        compressor = filter;
+        ServerMetrics::getInstance().recordCompressionStarted(clientSocket, filter->getCounters());
+    }
+
+    // Hot restart: everything needed to carry this session into the new
+    // process. Output filters are not saved; the old reactor finishes them
+    // and resumeSession() starts fresh ones. The executor has been drained,
+    // so nothing is running on the strand.
+    void saveState(SnapshotWriter& out) const
+    {
+        out.putString(username);
+        telnet.saveState(out);
+        out.putBool(compressor != nullptr);
+        ws.saveState(out);
+        out.putBool(wsFilter != nullptr);
+        out.putBool(wsCloseSent);
+        out.putU8(static_cast<uint8_t>(wsLastByte));
+        out.putBool(composingMail);
+        out.putString(mailRecipient);
+        out.putString(mailTitle);
+        out.putString(mailBody);
+        // steady_clock is CLOCK_MONOTONIC, which the next process shares
+        out.putI64(std::chrono::duration_cast<std::chrono::milliseconds>(mailStarted.time_since_epoch()).count());
+        out.putBool(mailTooLong);
+        out.putU8(static_cast<uint8_t>(prompt));
+        out.putString(promptUser);
+        out.putU8(static_cast<uint8_t>(outcome));
+        input.saveState(out);
+        out.putString(heldInput);
+        out.putString(throttledLine);
+
+        int observedGame = -1;
+        if (!username.empty()) {
+            auto user = UserManager::getInstance().getUserByUsername(username);
+            if (user && user->isUserObserving()) {
+                observedGame = user->getGameId();
+            }
+        }
+        out.putU32(static_cast<uint32_t>(observedGame));
+    }
+
+    // Called before the connection is added to its new reactor
+    void restoreState(SnapshotReader& in, const std::string& unsent)
+    {
+        username = in.getString();
+        loggedIn = !username.empty();
+        telnet.restoreState(in);
+        resumedCompression = in.getBool();
+        ws.restoreState(in);
+        resumedWebSocketOpen = in.getBool();
+        wsCloseSent = in.getBool();
+        wsLastByte = static_cast<char>(in.getU8());
+        composingMail = in.getBool();
+        mailRecipient = in.getString();
+        mailTitle = in.getString();
+        mailBody = in.getString();
+        mailStarted = std::chrono::steady_clock::time_point(std::chrono::milliseconds(in.getI64()));
+        mailTooLong = in.getBool();
+        prompt = static_cast<Prompt>(in.getU8());
+        promptUser = in.getString();
+        outcome = static_cast<Outcome>(in.getU8());
+        input.restoreState(in);
+        heldInput = in.getString();
+        throttledLine = in.getString();
+        throttled = !throttledLine.empty();
+        resumedObservedGame = static_cast<int>(in.getU32());
+        resumedOutput = unsent;
+        resumed = true;
+    }
+
+    // onOpen() for a connection from a hot restart
+    void resumeSession()
+    {
+        resumed = false;
+
+        // Finish what the old process started before anything new
+        if (!resumedOutput.empty()) {
+            reactor->send(getHandle(), resumedOutput);
+            resumedOutput.clear();
+        }
+
+        if (!username.empty()) {
+            UserManager::getInstance().resumeSession(username, getHandle());
+            auto user = UserManager::getInstance().getUserByUsername(username);
+            auto game = GameManager::getInstance().getGame(resumedObservedGame);
+            if (user && game) {
+                game->addObserver(getHandle());
+                user->setObserving(true);
+                user->setGameId(resumedObservedGame);
+            }
+        }
+
+        if (resumedWebSocketOpen) {
+            wsFilter = std::make_shared<WebSocketFilter>();
+            reactor->setOutputFilter(getHandle(), wsFilter);
+        } else if (resumedCompression) {
+            // The old stream was ended; the client decompresses a new one
+            startCompression();
         }
-        return false;    }
+
+        // A flow's frame stays behind; start it again from what it kept.
+        // The old reactor may also never have got to a command's outcome.
+        if (composingMail) {
+            startFlow(composeMail(true));
+        } else if (prompt != Prompt::NONE) {
+            startFlow(promptCredentials(prompt, promptUser));
+        } else if (!applyOutcome()) {
+            return;
+        }
+
+        // Lines that were held behind a command or a flow
+        resumeInput();
+    }
+
+    // WebSocket parser callbacks
+    void onWebSocketHandshake(bool accepted, const std::string& response) override
+    {
+        if (clientSocket < 0) {
+            return;
+        }
+        reactor->send(getHandle(), response);
+        if (!accepted) {
+            disconnect();
+            return;
+        }
+
+        // From here on everything we send is framed
+        wsFilter = std::make_shared<WebSocketFilter>();
+        reactor->setOutputFilter(getHandle(), wsFilter);
+        sendWelcome();
+    }
+
+    void onWebSocketData(const char* data, size_t len, const unsigned char* mask, size_t phase) override
+    {
+        wsLastByte = static_cast<char>(data[len - 1] ^ mask[(phase + len - 1) & 3]);
+        handleInput(data, len, mask, phase);
+    }
+
+    void onWebSocketMessageEnd() override
+    {
+        // Browsers send a command per message without a newline
+        if (wsLastByte != '\n') {
+            wsLastByte = '\n';
+            handleInput("\n", 1);
+        }
+    }
+
+    void onWebSocketControl(unsigned char opcode, const std::string& payload) override
+    {
+        if (opcode == WebSocket::OP_PING) {
+            sendWebSocketControl(WebSocket::OP_PONG, payload);
+        } else if (opcode == WebSocket::OP_CLOSE) {
+            // Echo the status code and hang up
+            sendWebSocketControl(WebSocket::OP_CLOSE, payload.substr(0, 2));
+            wsCloseSent = true;
+            disconnect();
+        }
+    }
+
+    void onWebSocketError(uint16_t closeCode) override
+    {
+        closeWebSocket(closeCode);
+        disconnect();
+    }
+
+    void sendWebSocketControl(unsigned char opcode, const std::string& payload)
+    {
+        if (!wsFilter || clientSocket < 0) {
+            return;
+        }
+        if (!reactor->isInLoopThread()) {
+            // Disconnected from another thread (server shutdown). The filter
+            // is the reactor's, so the frame is queued there, ahead of the
+            // removeConnection() that follows.
+            auto self = shared_from_this();
+            ConnectionHandle handle = getHandle();
+            reactor->post([self, handle, opcode, payload]() {
+                self->wsFilter->sendControl(opcode, payload);
+                self->reactor->send(handle, std::string());
+            });
+            return;
+        }
+        wsFilter->sendControl(opcode, payload);
+        // Nothing to write, but makes the reactor flush the filter
+        reactor->send(getHandle(), std::string());
+    }
+
+    void closeWebSocket(uint16_t closeCode)
+    {
+        if (!wsFilter || wsCloseSent) {
+            return;
+        }
+        std::string payload;
+        payload += static_cast<char>(closeCode >> 8);
+        payload += static_cast<char>(closeCode);
+        sendWebSocketControl(WebSocket::OP_CLOSE, payload);
+        wsCloseSent = true;
+    }
+
+    // Compression achieved on this connection, for the server stats
+    void recordCompression()
+    {
+        if (!compressor) {
+            return;
+        }
+        ServerMetrics::getInstance().recordCompression(compressor->getCounters());
+        std::cout << "Connection " << clientSocket << " compression: " << compressor->getBytesIn()
+                  << " -> " << compressor->getBytesOut() << " bytes (ratio "
+                  << compressor->getRatio() << ")" << std::endl;
+    }
 
     void disconnect()
     {
         if (running) {
             running = false;
 
-            // Handle game abandonment if the user is in a game
-            if (!username.empty()) {
-                auto currentUser = UserManager::getInstance().getUserByUsername(username);
-                if (currentUser && currentUser->isInGame()) {
-                    int gameId = currentUser->getGameId();
-                    auto game = GameManager::getInstance().getGame(gameId);
-                    if (game) {
-                        // Handle player disconnection in the game
-                        handlePlayerDisconnection(game, currentUser);
-                    }
-                }
+            // Leave the game and log out on the strand, after the commands
+            // already handed to it
+            auto self = shared_from_this();
+            strand->post([self]() { self->leaveSession(); });
+
+            recordCompression();
+            closeWebSocket(WebSocket::CLOSE_NORMAL);
+            cancelTimers();
 
-                // Log out user
-                UserManager::getInstance().logoutUser(clientSocket);
-                username = "";
+            // A suspended flow is just dropped. One that is running (it
+            // called us) finds running false at its next co_await.
+            if (flowWaiter && reactor->isInLoopThread()) {
+                flowWaiter = nullptr;
+                flow.reset();
             }
 
-            // Close the socket if it's valid
+            // Hand the socket back to the reactor to be closed
             if (clientSocket >= 0) {
-                close(clientSocket);
+                reactor->removeConnection(getHandle());
                 clientSocket = -1;
             }
+
+            if (onDisconnected) {
+                onDisconnected(this);
+            }
         }
     }
 
+    // Timers run on the reactor thread; one that fires after disconnect()
+    // finds running false and does nothing
+    void startTimers()
+    {
+        lastInput = std::chrono::steady_clock::now();
+        if (timeouts.login > 0 && !loggedIn) {
+            loginTimer = reactor->runAfter(std::chrono::seconds(timeouts.login), [this]() {
+                loginTimer = TimerWheel::TimerId();
+                if (running && !loggedIn) {
+                    sendTimeoutNotice("Login timed out.");
+                    disconnect();
+                }
+            });
+        }
+        if (timeouts.idle > 0) {
+            armIdleTimer(std::chrono::seconds(timeouts.idle));
+        }
+        if (throttled) {
+            armThrottleTimer();
+        }
+    }
+
+    void armIdleTimer(std::chrono::steady_clock::duration delay)
+    {
+        idleTimer = reactor->runAfter(std::chrono::duration_cast<std::chrono::milliseconds>(delay), [this]() {
+            idleTimer = TimerWheel::TimerId();
+            if (!running) {
+                return;
+            }
+            auto limit = std::chrono::seconds(timeouts.idle);
+            auto idleFor = std::chrono::steady_clock::now() - lastInput;
+            if (idleFor < limit) {
+                armIdleTimer(limit - idleFor);
+                return;
+            }
+            sendTimeoutNotice("Disconnected after " + std::to_string(timeouts.idle) + " seconds without input.");
+            disconnect();
+        });
+    }
+
+    // Time left for the mail being composed: to its idle limit or its
+    // deadline, whichever is sooner. max() if neither is set.
+    std::chrono::steady_clock::duration mailTimeLeft() const
+    {
+        auto now = std::chrono::steady_clock::now();
+        auto left = std::chrono::steady_clock::duration::max();
+        if (timeouts.mail > 0) {
+            left = std::min(left, lastMailInput + std::chrono::seconds(timeouts.mail) - now);
+        }
+        if (timeouts.mailDeadline > 0) {
+            left = std::min(left, mailStarted + std::chrono::seconds(timeouts.mailDeadline) - now);
+        }
+        return left;
+    }
+
+    void armMailTimer()
+    {
+        auto left = mailTimeLeft();
+        if (left == std::chrono::steady_clock::duration::max()) {
+            return;
+        }
+        left = std::max(left, std::chrono::steady_clock::duration::zero());
+        mailTimer = reactor->runAfter(std::chrono::ceil<std::chrono::milliseconds>(left), [this]() {
+            mailTimer = TimerWheel::TimerId();
+            if (!running || !composingMail) {
+                return;
+            }
+            if (mailTimeLeft() > std::chrono::steady_clock::duration::zero()) {
+                armMailTimer();
+                return;
+            }
+            // readLine() comes back empty and the flow gives up
+            if (flowWaitingForLine()) {
+                resumeFlow(std::nullopt);
+            }
+        });
+    }
+
+    void cancelTimers()
+    {
+        TimerWheel::TimerId timers[] = { loginTimer, idleTimer, mailTimer, throttleTimer };
+        loginTimer = idleTimer = mailTimer = throttleTimer = TimerWheel::TimerId();
+        if (reactor->isInLoopThread()) {
+            for (TimerWheel::TimerId timer : timers) {
+                reactor->cancelTimer(timer);
+            }
+            return;
+        }
+        // Disconnected from another thread (server shutdown)
+        Reactor* owner = reactor;
+        reactor->post([owner, timers]() {
+            for (TimerWheel::TimerId timer : timers) {
+                owner->cancelTimer(timer);
+            }
+        });
+    }
+
+    // The bucket a line is charged to. Lines a flow is waiting for (mail
+    // body, prompt answers) are free; the command that started it paid.
+    TokenBucket* bucketFor(std::string_view line)
+    {
+        if (flowWaitingForLine()) {
+            return nullptr;
+        }
+        std::string_view verb = CommandTable::verbOf(line);
+        if (verb.empty()) {
+            return nullptr;
+        }
+        const CommandTable::Spec* spec = CommandTable::find(verb);
+        if (spec && (spec->flags & CommandTable::CHAT)) {
+            return &chatBucket;
+        }
+        return &gameBucket;
+    }
+
+    // Wait for a token for throttledLine, then run it and whatever input
+    // queued up behind it
+    void armThrottleTimer()
+    {
+        TokenBucket* bucket = bucketFor(throttledLine);
+        auto delay = bucket ? bucket->timeUntilToken(std::chrono::steady_clock::now())
+                            : std::chrono::milliseconds(0);
+        throttleTimer = reactor->runAfter(delay, [this]() {
+            throttleTimer = TimerWheel::TimerId();
+            if (!running) {
+                return;
+            }
+            TokenBucket* bucket = bucketFor(throttledLine);
+            if (bucket && !bucket->take(std::chrono::steady_clock::now())) {
+                armThrottleTimer();
+                return;
+            }
+            throttled = false;
+            std::string line;
+            line.swap(throttledLine);
+            processLine(line);
+            processLines();
+        });
+    }
+
+    // A WebSocket client that never finished the upgrade cannot read text
+    void sendTimeoutNotice(const std::string& message)
+    {
+        if (!webSocket || wsFilter) {
+            sendMessage(message);
+        }
+    }
+
+    // On the strand, once the connection has gone
+    void leaveSession()
+    {
+        if (username.empty()) {
+            return;
+        }
+
+        // Handle game abandonment if the user is in a game
+        auto currentUser = UserManager::getInstance().getUserByUsername(username);
+        if (currentUser && currentUser->isInGame()) {
+            int gameId = currentUser->getGameId();
+            auto game = GameManager::getInstance().getGame(gameId);
+            if (game) {
+                // Handle player disconnection in the game
+                handlePlayerDisconnection(game, currentUser);
+            }
+        }
+
+        // Log out user
+        UserManager::getInstance().logoutUser(getHandle());
+        username = "";
+        loggedIn = false;
+    }
+
     // Helper method to handle player disconnection during a game
     void handlePlayerDisconnection(std::shared_ptr<Game> game, std::shared_ptr<User> player) {
         // Get the opponent
@@ -98,17 +710,7 @@ public:
         }
 
         // Notify the opponent and observers that this player disconnected
-        std::string disconnectMsg = player->getUsername() + " has disconnected. " +
-                                    opponent->getUsername() + " wins by default.";
-
-        if (opponent->getSocket() != -1) {
-            SocketUtils::sendData(opponent->getSocket(), disconnectMsg + "\r\n");
-        }
-
-        // Notify observers
-        for (int observerSocket : game->getObservers()) {
-            SocketUtils::sendData(observerSocket, disconnectMsg + "\r\n");
-        }
+        GameNotifier::playerDisconnected(game, player, opponent);
 
         // End the game with the opponent as winner
         game->playerDisconnected(player);
@@ -123,12 +725,14 @@ private:
     {
         // If already logged in, log out first
         if (!this->username.empty()) {
-            UserManager::getInstance().logoutUser(clientSocket);
+            UserManager::getInstance().logoutUser(getHandle());
             this->username = "";
+            loggedIn = false;
         }
 
-        if (UserManager::getInstance().loginUser(username, password, clientSocket)) {
+        if (UserManager::getInstance().loginUser(username, password, getHandle())) {
             this->username = username;
+            loggedIn = true;
             return "Login successful. Welcome, " + username + "!";
         } else {
             return "Login failed. Invalid username or password.";
@@ -181,87 +785,434 @@ private:
 
 
 
-    void handleClient()
+    // co_await readLine() in a flow: the next input line, printable
+    // characters only. Empty if the flow is cancelled: the mail timed out
+    // or the client went away.
+    struct LineAwaiter {
+        TelnetClientHandler* session;
+
+        bool await_ready() const { return !session->running; }
+
+        void await_suspend(std::coroutine_handle<> waiter)
+        {
+            session->flowWaiter = waiter;
+            session->flowWantsLine = true;
+        }
+
+        std::optional<std::string> await_resume()
+        {
+            std::optional<std::string> line;
+            line.swap(session->flowLine);
+            return line;
+        }
+    };
+
+    LineAwaiter readLine()
     {
-        int timeout_ms = 10000;
+        return LineAwaiter{this};
+    }
 
-        // Send welcome message
-        sendMessage("Welcome to Gomoku Server!");
-        sendMessage("Type 'help' or '?' for a list of commands.");
+    // co_await flush() in a flow: wait until everything sent so far has
+    // been handed to the socket. Input waits in the buffer meanwhile.
+    // False if the client went away.
+    struct FlushAwaiter {
+        TelnetClientHandler* session;
+
+        bool await_ready() const { return !session->running; }
 
-        // Main command loop
-        while (running)
+        bool await_suspend(std::coroutine_handle<> waiter)
         {
-            std::string rawData = SocketUtils::receiveData(clientSocket, timeout_ms);
+            TelnetClientHandler* self = session;
+            if (!self->reactor->whenFlushed(self->getHandle(), [self]() { self->outputFlushed(); })) {
+                return false;  // nothing to wait for
+            }
+            self->flowWaiter = waiter;
+            self->flowWantsLine = false;
+            return true;
+        }
+
+        bool await_resume() const { return session->running; }
+    };
+
+    FlushAwaiter flush()
+    {
+        return FlushAwaiter{this};
+    }
+
+    // co_await onStrand(task) in a flow: run task on a worker, behind the
+    // commands already handed to the strand, and carry on once it is done.
+    // Input waits in the buffer meanwhile. False if the client went away.
+    struct StrandAwaiter {
+        TelnetClientHandler* session;
+        std::function<void()> task;
+
+        bool await_ready() const { return !session->running; }
+
+        void await_suspend(std::coroutine_handle<> waiter)
+        {
+            session->flowWaiter = waiter;
+            session->flowWantsLine = false;
+            auto self = session->shared_from_this();
+            session->strand->post([self, task = std::move(task)]() {
+                if (self->running) {
+                    task();
+                }
+                self->handBack(&TelnetClientHandler::flowTaskDone);
+            });
+        }
+
+        bool await_resume() const { return session->running; }
+    };
+
+    StrandAwaiter onStrand(std::function<void()> task)
+    {
+        return StrandAwaiter{this, std::move(task)};
+    }
 
-            // Strip telnet control sequences and control characters
-            std::string result;
-            for (char c : rawData)
+    bool flowWaitingForLine() const
+    {
+        return flowWaiter && flowWantsLine;
+    }
+
+    // Suspended in flush() or onStrand()
+    bool flowBlocked() const
+    {
+        return flowWaiter && !flowWantsLine;
+    }
+
+    // Take over a flow that has just run up to its first co_await
+    void startFlow(SessionTask task)
+    {
+        flow = std::move(task);
+        if (flow.isDone()) {
+            flow.reset();
+        }
+    }
+
+    // Hand the suspended flow a line (or nothing) and let it run on
+    void resumeFlow(std::optional<std::string> line)
+    {
+        std::coroutine_handle<> waiter = flowWaiter;
+        flowWaiter = nullptr;
+        flowLine = std::move(line);
+        waiter.resume();
+        if (flow.isDone()) {
+            flow.reset();
+        }
+    }
+
+    // whenFlushed() callback: carry on with the flow, then with any input
+    // that arrived while it waited
+    void outputFlushed()
+    {
+        if (!running || !flowBlocked()) {
+            return;
+        }
+        resumeFlow(std::nullopt);
+        resumeInput();
+    }
+
+    // Back on the reactor after an onStrand() task, likewise
+    void flowTaskDone()
+    {
+        outputFlushed();
+    }
+
+    // From the strand: run step on the reactor thread
+    void handBack(void (TelnetClientHandler::*step)())
+    {
+        auto self = shared_from_this();
+        auto finished = std::chrono::steady_clock::now();
+        reactor->post([self, step, finished]() {
+            ServerMetrics::getInstance().recordCommandHandback(finished);
+            (self.get()->*step)();
+        });
+    }
+
+    // Prompts stay on the line the answer is typed on
+    void sendPrompt(const std::string& text)
+    {
+        if (clientSocket >= 0) {
+            reactor->send(getHandle(), text);
+        }
+    }
+
+    // Ask a telnet client to stop (or go back to) echoing what is typed,
+    // by offering to echo it ourselves and then not doing so
+    void hideInput(bool hide)
+    {
+        hidingInput = hide;
+        if (webSocket) {
+            return;
+        }
+        bool wasHidden = telnet.isLocalEnabled(Telnet::OPT_ECHO);
+        std::string out;
+        telnet.requestLocal(Telnet::OPT_ECHO, hide, out);
+        if (!out.empty()) {
+            onTelnetSend(out);
+        }
+        if (!hide && wasHidden) {
+            // The Enter after the hidden text was not echoed either
+            sendPrompt("\r\n");
+        }
+    }
+
+    // Handle one chunk of input read by the reactor. Every complete line
+    // is processed in order; a trailing partial line waits for the next read.
+    // mask and phase unmask WebSocket payload as it is copied in
+    void handleInput(const char* data, size_t len, const unsigned char* mask = nullptr, size_t phase = 0)
+    {
+        if (!heldInput.empty())
+        {
+            // Behind earlier input that is still waiting
+            holdInput(data, len, mask, phase);
+            return;
+        }
+        while (len > 0 && running)
+        {
+            size_t taken = input.append(data, len, mask, phase);
+            data += taken;
+            len -= taken;
+            phase += taken;
+
+            processLines();
+
+            if (running && input.isFull())
             {
-                if (c >= 32 && c < 127)
-                { // Printable ASCII
-                    result += c;
+                if (throttled) {
+                    // Still sending while held back, until the buffer is
+                    // full of commands waiting their turn
+                    ServerMetrics::getInstance().recordFloodDisconnect();
+                    sendMessage("Disconnected for flooding.");
+                    disconnect();
+                    return;
                 }
-                else if (c == '\r' || c == '\n')
-                {
-                    result += c;
+                if (linesHeld()) {
+                    // Whole lines waiting for a command or a flow; keep
+                    // the rest until they have gone
+                    holdInput(data, len, mask, phase);
+                    return;
                 }
+                input.discardPartialLine();
+                sendMessage("Line too long.");
             }
+        }
+    }
 
-            // Extract the first line
-            size_t pos = result.find("\r\n");
-            if (pos != std::string::npos)
-            {
-                result = result.substr(0, pos);
+    // Input kept back while the buffer is full of lines that cannot run yet
+    void holdInput(const char* data, size_t len, const unsigned char* mask, size_t phase)
+    {
+        if (heldInput.size() + len > MAX_HELD_INPUT) {
+            ServerMetrics::getInstance().recordFloodDisconnect();
+            sendMessage("Disconnected for flooding.");
+            disconnect();
+            return;
+        }
+        size_t start = heldInput.size();
+        heldInput.append(data, len);
+        if (mask) {
+            for (size_t i = 0; i < len; i++) {
+                heldInput[start + i] ^= static_cast<char>(mask[(phase + i) & 3]);
             }
+        }
+    }
 
-            if (result.empty())
-            {
-                // Socket might be closed or timed out
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                continue;
+    // Lines wait while a flow waits for output or a task, while a
+    // SESSION command runs, or while too many commands are in flight
+    bool linesHeld()
+    {
+        if (flowBlocked() || awaitingCommand) {
+            return true;
+        }
+        if (commandsInFlight.load() < MAX_COMMANDS_IN_FLIGHT) {
+            return false;
+        }
+        // The strand hands back once this is seen; check again in case
+        // the last command finished just before
+        commandsStalled.store(true);
+        return commandsInFlight.load() >= MAX_COMMANDS_IN_FLIGHT;
+    }
+
+    // Carry on with the buffered lines, then with input held behind them
+    void resumeInput()
+    {
+        processLines();
+        if (running && !heldInput.empty() && !linesHeld()) {
+            std::string held;
+            held.swap(heldInput);
+            handleInput(held.data(), held.size());
+        }
+    }
+
+    // Run the buffered lines, stopping at the first one over its rate, or
+    // while the lines have to wait
+    void processLines()
+    {
+        std::string_view line;
+        while (running && !throttled && !linesHeld() && input.nextLine(line))
+        {
+            TokenBucket* bucket = bucketFor(line);
+            if (bucket && !bucket->take(std::chrono::steady_clock::now())) {
+                ServerMetrics::getInstance().recordCommandThrottled();
+                throttledLine.assign(line.data(), line.size());
+                throttled = true;
+                armThrottleTimer();
+                break;
+            }
+            processLine(line);
+        }
+        postCommands();
+    }
+
+    // Handle one line of input
+    void processLine(std::string_view line)
+    {
+        // Strip control characters; telnet commands are already gone.
+        // The buffer is kept between lines so it stops allocating.
+        std::string& result = lineScratch;
+        result.clear();
+        for (char c : line)
+        {
+            if (c >= 32 && c < 127)
+            { // Printable ASCII
+                result += c;
             }
+        }
 
-            // Process the command
-            std::string response = processCommand(result);
-            sendMessage(response);
+        if (flowWaitingForLine())
+        {
+            postCommands();
+            resumeFlow(result);
+            return;
+        }
+
+        if (result.empty())
+        {
+            return;
+        }
+
+        // Parsed here, run on the strand with the rest of this read's lines
+        pendingCommands.push_back(CommandTable::parse(result));
+        const CommandTable::Spec* spec = pendingCommands.back().spec;
+        if (spec && (spec->flags & CommandTable::SESSION)) {
+            awaitingCommand = true;
+        }
+        commandsInFlight.fetch_add(1);
+    }
+
+    // Hand the parsed lines to the strand as one job
+    void postCommands()
+    {
+        if (pendingCommands.empty()) {
+            return;
+        }
+        auto self = shared_from_this();
+        // Moved into a vector of the right size; pendingCommands keeps its
+        // capacity for the next read
+        std::vector<CommandTable::Parsed> commands(std::make_move_iterator(pendingCommands.begin()),
+                                                   std::make_move_iterator(pendingCommands.end()));
+        pendingCommands.clear();
+        strand->post([self, commands = std::move(commands)]() {
+            Reactor::BatchedSends batch;
+            for (const CommandTable::Parsed& command : commands) {
+                self->runCommand(command);
+            }
+        });
+    }
+
+    // On the strand: run one command line and send its response
+    void runCommand(const CommandTable::Parsed& command)
+    {
+        if (running) {
+            ResponseBuffer response;
+            processCommand(command, response.str());
+            if (!response.empty() && clientSocket >= 0) {
+                response.str() += "\r\n";
+                reactor->send(getHandle(), response.view());
+            }
 
             // Handle exit command
-            if (result == "exit" || result == "quit") {
-                disconnect();
-                running = false;
-                break;
+            if (command.line == "exit" || command.line == "quit") {
+                outcome = Outcome::EXIT;
             }
         }
-        // Make sure socket is closed when thread ends
-        if (clientSocket >= 0) {
-            close(clientSocket);
-            clientSocket = -1;
+
+        // Held input waits for half the window to drain, so a pipelining
+        // client is resumed a batch at a time rather than a line at a time
+        int remaining = commandsInFlight.fetch_sub(1) - 1;
+        if (command.spec && (command.spec->flags & CommandTable::SESSION)) {
+            handBack(&TelnetClientHandler::sessionCommandDone);
+        } else if (remaining <= MAX_COMMANDS_IN_FLIGHT / 2 && commandsStalled.exchange(false)) {
+            handBack(&TelnetClientHandler::resumeInput);
+        }
+    }
+
+    // Back on the reactor after a SESSION command
+    void sessionCommandDone()
+    {
+        awaitingCommand = false;
+        if (running && applyOutcome()) {
+            resumeInput();
         }
     }
 
+    // Do what the last SESSION command left to the reactor. False if
+    // that was to hang up.
+    bool applyOutcome()
+    {
+        Outcome next = outcome;
+        outcome = Outcome::NONE;
+        switch (next) {
+        case Outcome::EXIT:
+            disconnect();
+            return false;
+        case Outcome::COMPOSE_MAIL:
+            startFlow(composeMail(false));
+            break;
+        case Outcome::LOGIN_PROMPT:
+            startFlow(promptCredentials(Prompt::LOGIN, promptUser));
+            break;
+        case Outcome::REGISTER_PROMPT:
+            startFlow(promptCredentials(Prompt::REGISTER, promptUser));
+            break;
+        case Outcome::NONE:
+            break;
+        }
+        return true;
+    }
+
     // List all current games
-std::string listCurrentGames() {
-    auto games = GameManager::getInstance().getAllGames();
+void listCurrentGames(std::string& out) {
+    // Reused between calls, and emptied so no game is kept alive by it
+    thread_local std::vector<std::shared_ptr<Game>> games;
+    GameManager::getInstance().getAllGames(games);
     if (games.empty()) {
-        return "No games in progress.";
+        out += "No games in progress.";
+        return;
     }
 
-    std::string result = "Current games:\n";
+    out += "Current games:\n";
     for (const auto& game : games) {
-        result += std::to_string(game->getId()) + ": " +
-                  game->getBlackPlayer()->getUsername() + " (Black) vs " +
-                  game->getWhitePlayer()->getUsername() + " (White)";
-
-        if (game->getStatus() == GameStatus::FINISHED) {
-            result += " [FINISHED - Winner: " + game->getWinner() + "]";
+        ResponseBuffer::appendInt(out, game->getId());
+        out += ": ";
+        out += game->getBlackPlayer()->getUsername();
+        out += " (Black) vs ";
+        out += game->getWhitePlayer()->getUsername();
+        out += " (White)";
+
+        if (game->isDraw()) {
+            out += " [FINISHED - Draw]";
+        } else if (game->getStatus() == GameStatus::FINISHED) {
+            out += " [FINISHED - Winner: ";
+            out += game->getWinner();
+            out += ']';
         } else {
-result += std::string(" [") + (game->getCurrentTurn() == StoneColor::BLACK ? "Black" : "White") + " to move]";        }
+            out += game->getCurrentTurn() == StoneColor::BLACK ? " [Black to move]" : " [White to move]";
+        }
 
-        result += "\n";
+        out += '\n';
     }
-
-    return result;
+    games.clear();
 }
 
 // Initiate a match with another player
@@ -294,7 +1245,7 @@ std::string initiateMatch(const std::string& opponentName, const std::string& co
         return opponent->getUsername() + " is already in a game.";
     }
 
-    if (opponent->getSocket() == -1) {
+    if (!opponent->getConnection().isValid()) {
         return opponent->getUsername() + " is not online.";
     }
 
@@ -305,20 +1256,16 @@ std::string initiateMatch(const std::string& opponentName, const std::string& co
     // Create the game
     int gameId = GameManager::getInstance().createGame(blackPlayer, whitePlayer, timeLimit);
 
-    // Get the game board
-    auto game = GameManager::getInstance().getGame(gameId);
-    std::string gameBoard = game->getBoardString();
-
-    // Prepare notification message
-    std::string gameStartMsg = "Game " + std::to_string(gameId) + " started: " +
-                               blackPlayer->getUsername() + " (Black) vs " +
-                               whitePlayer->getUsername() + " (White)";
-
     // Send notification and board to opponent
-    SocketUtils::sendData(opponent->getSocket(), gameStartMsg + "\r\n\n" + gameBoard + "\r\n");
+    auto game = GameManager::getInstance().getGame(gameId);
+    GameNotifier::gameStarted(game, opponent);
 
     // Return notification and board to current user
-    return gameStartMsg + "\n\n" + gameBoard;
+    std::string response;
+    GameNotifier::appendStartMessage(response, game);
+    response += "\n\n";
+    game->appendBoard(response);
+    return response;
 }
 // Resign from the current game
 std::string resignGame() {
@@ -345,22 +1292,17 @@ std::string resignGame() {
         opponent = game->getBlackPlayer();
     }
 
-    std::string resignMsg = username + " has resigned the game.";
-    SocketUtils::sendData(opponent->getSocket(), resignMsg + "\r\n");
-
-    // Notify observers
-    for (int observerSocket : game->getObservers()) {
-        SocketUtils::sendData(observerSocket, resignMsg + "\r\n");
-    }
+    GameNotifier::playerResigned(game, currentUser, opponent);
 
     return "You have resigned the game.";
 }
 
 // Refresh the current game board
-std::string refreshGame() {
+void refreshGame(std::string& out) {
     auto currentUser = UserManager::getInstance().getUserByUsername(username);
     if (!currentUser->isInGame() && !currentUser->isUserObserving()) {
-        return "You are not in or observing a game.";
+        out += "You are not in or observing a game.";
+        return;
     }
 
     int gameId = currentUser->getGameId();
@@ -369,38 +1311,45 @@ std::string refreshGame() {
         currentUser->setPlaying(false);
         currentUser->setObserving(false);
         currentUser->setGameId(-1);
-        return "Error: Game not found.";
+        out += "Error: Game not found.";
+        return;
     }
 
-    return game->getBoardString();
+    game->appendBoard(out);
 }
 
 // Observe a game
-std::string observeGame(int gameId) {
+void observeGame(int gameId, std::string& out) {
     auto currentUser = UserManager::getInstance().getUserByUsername(username);
     if (currentUser->isInGame()) {
-        return "You cannot observe while playing a game.";
+        out += "You cannot observe while playing a game.";
+        return;
     }
 
     auto game = GameManager::getInstance().getGame(gameId);
     if (!game) {
-        return "Game not found: " + std::to_string(gameId);
+        out += "Game not found: ";
+        ResponseBuffer::appendInt(out, gameId);
+        return;
     }
 
     // If already observing a different game, unobserve first
     if (currentUser->isUserObserving()) {
         auto oldGame = GameManager::getInstance().getGame(currentUser->getGameId());
         if (oldGame) {
-            oldGame->removeObserver(clientSocket);
+            oldGame->removeObserver(getHandle());
         }
     }
 
     // Add as observer
-    game->addObserver(clientSocket);
+    game->addObserver(getHandle());
     currentUser->setObserving(true);
     currentUser->setGameId(gameId);
 
-    return "You are now observing game " + std::to_string(gameId) + ".\n\n" + game->getBoardString();
+    out += "You are now observing game ";
+    ResponseBuffer::appendInt(out, gameId);
+    out += ".\n\n";
+    game->appendBoard(out);
 }
 
 // Stop observing a game
@@ -413,7 +1362,7 @@ std::string unobserveGame() {
     int gameId = currentUser->getGameId();
     auto game = GameManager::getInstance().getGame(gameId);
     if (game) {
-        game->removeObserver(clientSocket);
+        game->removeObserver(getHandle());
     }
 
     currentUser->setObserving(false);
@@ -422,10 +1371,11 @@ std::string unobserveGame() {
     return "You are no longer observing the game.";
 }
 
-    std::string makeMove(int row, int col) {
+    void makeMove(int row, int col, std::string& out) {
     auto currentUser = UserManager::getInstance().getUserByUsername(username);
     if (!currentUser->isInGame()) {
-        return "You are not in a game.";
+        out += "You are not in a game.";
+        return;
     }
 
     int gameId = currentUser->getGameId();
@@ -433,12 +1383,20 @@ std::string unobserveGame() {
     if (!game) {
         currentUser->setPlaying(false);
         currentUser->setGameId(-1);
-        return "Error: Game not found.";
+        out += "Error: Game not found.";
+        return;
     }
 
     // Check if game is already finished
+    if (game->isDraw()) {
+        out += "This game is already over. It was a draw.";
+        return;
+    }
     if (game->getStatus() == GameStatus::FINISHED) {
-        return "This game is already over. The winner was " + game->getWinner() + ".";
+        out += "This game is already over. The winner was ";
+        out += game->getWinner();
+        out += '.';
+        return;
     }
 
     // Check if it's this player's turn before trying to make a move
@@ -447,17 +1405,20 @@ std::string unobserveGame() {
     bool isBlackTurn = (game->getCurrentTurn() == StoneColor::BLACK);
 
     if ((isBlack && !isBlackTurn) || (isWhite && isBlackTurn)) {
-        return "It's not your turn to move. Please wait for your opponent.";
+        out += "It's not your turn to move. Please wait for your opponent.";
+        return;
     }
 
     // Check if the position is already occupied
     if (!game->isPositionEmpty(row, col)) {
-        return "Invalid move: that position is already occupied.";
+        out += "Invalid move: that position is already occupied.";
+        return;
     }
 
     // Now try to make the move
     if (!game->makeMove(currentUser, row, col)) {
-        return "Invalid move: an unexpected error occurred.";
+        out += "Invalid move: an unexpected error occurred.";
+        return;
     }
 
     // Get the opponent
@@ -468,36 +1429,11 @@ std::string unobserveGame() {
         opponent = game->getBlackPlayer();
     }
 
-    // Create move notification message
-    char colChar = 'A' + col;
-    std::string moveMsg = username + " played at " + colChar + std::to_string(row + 1);
-    std::string boardStr = game->getBoardString();
-
-    // Check if the game ended
-    if (game->getStatus() == GameStatus::FINISHED) {
-        std::string winMsg = game->getWinner() + " has won the game!";
-        moveMsg += "\n" + winMsg;
-
-        // Send notification with win message to opponent
-        SocketUtils::sendData(opponent->getSocket(), moveMsg + "\r\n\n" + boardStr + "\r\n");
-
-        // Notify observers
-        for (int observerSocket : game->getObservers()) {
-            SocketUtils::sendData(observerSocket, moveMsg + "\r\n\n" + boardStr + "\r\n");
-        }
-
-        return boardStr + "\n" + winMsg;
-    }
-
-    // Game continues - notify opponent about the move
-    SocketUtils::sendData(opponent->getSocket(), moveMsg + "\r\n\n" + boardStr + "\r\n");
+    // Notify the opponent and observers about the move
+    GameNotifier::movePlayed(game, currentUser, opponent, row, col);
 
-    // Notify observers
-    for (int observerSocket : game->getObservers()) {
-        SocketUtils::sendData(observerSocket, moveMsg + "\r\n\n" + boardStr + "\r\n");
-    }
-
-    return boardStr;
+    game->appendBoard(out);
+    GameNotifier::appendResult(out, game);
 }
 
     // Add these methods to your TelnetClientHandler class
@@ -515,10 +1451,10 @@ std::string shoutMessage(const std::string& message) {
     auto onlineUsers = UserManager::getInstance().getOnlineUsers();
     for (const auto& user : onlineUsers) {
         if (user->getUsername() != username &&
-            user->getSocket() != -1 &&
+            user->getConnection().isValid() &&
             !user->isInQuietMode() &&
             !user->isBlocked(username)) {
-            SocketUtils::sendData(user->getSocket(), formattedMsg + "\r\n");
+            ConnectionRegistry::getInstance().sendText(user->getConnection(), formattedMsg + "\r\n");
         }
     }
 
@@ -544,8 +1480,8 @@ std::string tellMessage(const std::string& recipient, const std::string& message
     std::string formattedMsg = "[Tell] " + username + ": " + message;
 
     // Send to recipient if online
-    if (recipientUser->getSocket() != -1) {
-        SocketUtils::sendData(recipientUser->getSocket(), formattedMsg + "\r\n");
+    if (recipientUser->getConnection().isValid()) {
+        ConnectionRegistry::getInstance().sendText(recipientUser->getConnection(), formattedMsg + "\r\n");
         return "Message sent to " + recipient + ".";
     } else {
         return recipient + " is offline.";
@@ -571,11 +1507,11 @@ std::string kibitzMessage(const std::string& message) {
     std::string formattedMsg = "[Kibitz] " + username + ": " + message;
 
     // Send to all observers of this game
-    for (int observerSocket : game->getObservers()) {
-        if (observerSocket != clientSocket) {
-            auto observerUser = UserManager::getInstance().getUserBySocket(observerSocket);
+    for (ConnectionHandle observer : game->getObservers()) {
+        if (observer != getHandle()) {
+            auto observerUser = UserManager::getInstance().getUserByConnection(observer);
             if (observerUser && !observerUser->isInQuietMode() && !observerUser->isBlocked(username)) {
-                SocketUtils::sendData(observerSocket, formattedMsg + "\r\n");
+                ConnectionRegistry::getInstance().sendText(observer, formattedMsg + "\r\n");
             }
         }
     }
@@ -583,12 +1519,12 @@ std::string kibitzMessage(const std::string& message) {
     // Also send to the players if they're not in quiet mode and haven't blocked the user
     auto blackPlayer = game->getBlackPlayer();
     if (!blackPlayer->isInQuietMode() && !blackPlayer->isBlocked(username)) {
-        SocketUtils::sendData(blackPlayer->getSocket(), formattedMsg + "\r\n");
+        ConnectionRegistry::getInstance().sendText(blackPlayer->getConnection(), formattedMsg + "\r\n");
     }
 
     auto whitePlayer = game->getWhitePlayer();
     if (!whitePlayer->isInQuietMode() && !whitePlayer->isBlocked(username)) {
-        SocketUtils::sendData(whitePlayer->getSocket(), formattedMsg + "\r\n");
+        ConnectionRegistry::getInstance().sendText(whitePlayer->getConnection(), formattedMsg + "\r\n");
     }
 
     return "Comment sent.";
@@ -655,23 +1591,18 @@ std::string kibitzMessage(const std::string& message) {
         return "Unblocked communication from " + targetUsername + ".";
     }
     // List mail headers
-std::string listMail() {
+void listMail(std::string& out) {
     if (username == "guest") {
-        return "Guests cannot use mail. Please register an account.";
+        out += "Guests cannot use mail. Please register an account.";
+        return;
     }
 
-    auto messages = MessageManager::getInstance().getMessages(username);
-
-    if (messages.empty()) {
-        return "Your mailbox is empty.";
-    }
-
-    std::string result = "Mail messages:\n";
-    for (const auto& message : messages) {
-        result += message->getFormattedHeader() + "\n";
+    size_t start = out.size();
+    out += "Mail messages:\n";
+    if (MessageManager::getInstance().appendHeaders(username, out) == 0) {
+        out.resize(start);
+        out += "Your mailbox is empty.";
     }
-
-    return result;
 }
 
 // Read a specific mail
@@ -721,33 +1652,95 @@ std::string sendMail(const std::string& recipient, const std::string& title) {
         return "User not found: " + recipient;
     }
 
-    sendMessage("Enter your message. End with a line containing only a period (.)");
-
-    std::string content;
-    std::string line;
-    while (true) {
-        line = SocketUtils::receiveData(clientSocket, 60000); // 1 minute timeout
-
-        // Clean up line endings
-        if (!line.empty() && line.back() == '\n') line.pop_back();
-        if (!line.empty() && line.back() == '\r') line.pop_back();
+    // The reactor collects the body
+    mailRecipient = recipient;
+    mailTitle = title;
+    mailBody.clear();
+    outcome = Outcome::COMPOSE_MAIL;
+    return "";
+}
 
-        if (line == ".") {
-            break;
+// Collect the body of the mail to mailRecipient line by line, up to a lone
+// ".", then send it; "~q" cancels. Past maxMailBody the body is dropped
+// and lines are swallowed up to the end, so none of them run as commands.
+// The mail is given up if the client stops typing for timeouts.mail or
+// is still at it after timeouts.mailDeadline. resuming picks up a mail
+// carried over a hot restart.
+SessionTask composeMail(bool resuming)
+{
+    composingMail = true;
+    if (!resuming) {
+        mailTooLong = false;
+        sendMessage("Enter your message. End with a line containing only a period (.), or ~q to cancel.");
+        // A slow client gets the whole time from when the prompt left
+        co_await flush();
+        mailStarted = std::chrono::steady_clock::now();
+    }
+    lastMailInput = std::chrono::steady_clock::now();
+    armMailTimer();
+
+    std::optional<std::string> line;
+    while ((line = co_await readLine()) && *line != "." && *line != "~q") {
+        lastMailInput = std::chrono::steady_clock::now();
+        if (mailTooLong) {
+            continue;
+        }
+        if (maxMailBody > 0 && mailBody.size() + line->size() + 1 > maxMailBody) {
+            mailTooLong = true;
+            mailBody.clear();
+            sendMessage("Mail is over " + std::to_string(maxMailBody) +
+                        " bytes and will not be sent. End it with a line containing only a period (.)");
+            continue;
+        }
+        mailBody += *line;
+        mailBody += '\n';
+    }
+
+    composingMail = false;
+    reactor->cancelTimer(mailTimer);
+    mailTimer = TimerWheel::TimerId();
+    if (!line || *line == "~q" || mailTooLong) {
+        std::string reason;
+        if (line && *line == "~q") {
+            reason = "cancelled.";
+        } else if (line) {
+            reason = "over " + std::to_string(maxMailBody) + " bytes.";
+        } else if (timeouts.mailDeadline > 0 &&
+                   std::chrono::steady_clock::now() - mailStarted >= std::chrono::seconds(timeouts.mailDeadline)) {
+            reason = "not finished within " + std::to_string(timeouts.mailDeadline) + " seconds.";
+        } else {
+            reason = "no input for " + std::to_string(timeouts.mail) + " seconds.";
         }
-
-        content += line + "\n";
+        mailBody.clear();
+        mailTooLong = false;
+        if (running) {
+            sendMessage("Mail to " + mailRecipient + " not sent: " + reason);
+        }
+        co_return;
     }
 
-    MessageManager::getInstance().sendMessage(username, recipient, title, content);
+    std::string body;
+    body.swap(mailBody);
+    // Named, not a temporary in the co_await: captures must live in the task
+    std::function<void()> deliver = [this, recipient = mailRecipient, title = mailTitle, body = std::move(body)]() {
+        deliverMail(recipient, title, body);
+    };
+    co_await onStrand(std::move(deliver));
+}
+
+// On the strand: store a finished mail and tell the recipient
+void deliverMail(const std::string& recipient, const std::string& title, const std::string& body)
+{
+    MessageManager::getInstance().sendMessage(username, recipient, title, body);
 
     // Notify recipient if online
-    if (recipientUser->getSocket() != -1) {
+    auto recipientUser = UserManager::getInstance().getUserByUsername(recipient);
+    if (recipientUser && recipientUser->getConnection().isValid()) {
         std::string notifyMsg = "You have received a new mail from " + username;
-        SocketUtils::sendData(recipientUser->getSocket(), notifyMsg + "\r\n");
+        ConnectionRegistry::getInstance().sendText(recipientUser->getConnection(), notifyMsg + "\r\n");
     }
 
-    return "Mail sent to " + recipient;
+    sendMessage("Mail sent to " + recipient);
 }
     // Update user info
     std::string setUserInfo(const std::string& info) {
@@ -763,284 +1756,270 @@ std::string sendMail(const std::string& recipient, const std::string& title) {
         currentUser->setInfo(info);
         return "Your information has been updated.";
     }
-    std::string processCommand(const std::string& command)
+    // Run one command line and return the response
+    void processCommand(const CommandTable::Parsed& parsed, std::string& out)
     {
-        // Split the command into tokens
-        std::istringstream iss(command);
-        std::vector<std::string> tokens;
-        std::string token;
-        std::regex moveAttemptPattern("^([A-Za-z])([0-9]+)$");
-        std::smatch moveAttemptMatches;
-
-        while (iss >> token) {
-            tokens.push_back(token);
+        // Views into the line; the vector keeps its capacity between lines
+        const std::string& command = parsed.line;
+        std::vector<std::string_view>& tokens = tokenScratch;
+        CommandTable::split(command, tokens);
+        if (tokens.empty()) {
+            out += "Empty command";
+            return;
         }
 
-        if (tokens.empty()) {
-            return "Empty command";
-        }
-
-        // Get the base command (first token)
-        std::string cmd = tokens[0];
-        // Convert to lowercase for case-insensitive comparison
-        std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::tolower);
-        std::string cmdStr = cmd;  // Assuming cmd is already a std::string
-        if (std::regex_match(cmdStr, moveAttemptMatches, moveAttemptPattern)) {
-            auto currentUser = UserManager::getInstance().getUserByUsername(username);
-            if (!currentUser->isInGame()) {
-                return "You are not in a game. Join a game first to make moves.";
+        int row = parsed.row, col = parsed.col;
+        MoveSyntax move = parsed.move;
+        if (move != MoveSyntax::NOT_A_MOVE) {
+            if (!isInGame()) {
+                out += "You are not in a game. Join a game first to make moves.";
+                return;
             }
-            char colChar = toupper(moveAttemptMatches[1].str()[0]);
-            int row;
-
-            try {
-                row = std::stoi(moveAttemptMatches[2].str());
-            } catch (...) {
-                return "Invalid move format. Moves should be in the format 'A1' to 'O15'.";
+            if (move == MoveSyntax::MALFORMED) {
+                out += "Invalid move format. Moves should be in the format 'A1' to 'O15'.";
+                return;
             }
-
-            // Check if the move is within board bounds
-            if (colChar < 'A' || colChar > 'O' || row < 1 || row > 15) {
-                return "Invalid move: out of bounds. The board is 15x15 (A1 to O15).";
+            if (move == MoveSyntax::OUT_OF_BOUNDS) {
+                out += "Invalid move: out of bounds. The board is 15x15 (A1 to O15).";
+                return;
             }
+            makeMove(row, col, out);
+            return;
+        }
 
-            // If we get here, it's a valid format move, process it
-            row = row - 1; // Convert to 0-based
-            int col = colChar - 'A';
-
-            return makeMove(row, col);
+        const CommandTable::Spec* spec = parsed.spec;
+        if (username.empty() && (!spec || !(spec->flags & CommandTable::BEFORE_LOGIN))) {
+            out += "Please login first using 'login <username> <password>' or 'guest'.";
+            return;
+        }
+        if (!spec) {
+            std::string cmd(tokens[0]);
+            std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::tolower);
+            out += "Unknown command: " + cmd + ". Type 'help' or '?' for a list of commands.";
+            return;
         }
 
-        // Process login-related commands regardless of login status
-        if (cmd == "login") {
+        switch (spec->command) {
+        case Command::LOGIN:
             if (tokens.size() < 3) {
-                return "Usage: login <username> <password>";
+                // The reactor asks for whatever is missing
+                promptUser = tokens.size() > 1 ? std::string(tokens[1]) : "";
+                outcome = Outcome::LOGIN_PROMPT;
+                return;
             }
-            return loginUser(tokens[1], tokens[2]);
-        }
-        else if (cmd == "testsave") {
+            out += loginUser(std::string(tokens[1]), std::string(tokens[2]));
+            return;
+
+        case Command::GUEST:
+            out += loginGuest();
+            return;
+
+        case Command::REGISTER:
+            if (tokens.size() < 3) {
+                if (username != "guest") {
+                    out += "You must be logged in as guest to register.";
+                    return;
+                }
+                promptUser = tokens.size() > 1 ? std::string(tokens[1]) : "";
+                outcome = Outcome::REGISTER_PROMPT;
+                return;
+            }
+            out += registerUser(std::string(tokens[1]), std::string(tokens[2]));
+            return;
+
+        case Command::EXIT:
+            out += "Goodbye!";
+            return;
+
+        case Command::HELP:
+            out += showHelp();
+            return;
+
+        case Command::TESTSAVE: {
             std::cout << "Testing save functionality" << std::endl;
             std::ofstream testFile("/tmp/test_save.txt");
             if (testFile.is_open()) {
                 testFile << "Test save at " << time(nullptr) << std::endl;
                 testFile.close();
                 std::cout << "Test file written successfully" << std::endl;
-                return "Test save successful. Check for test_save.txt";
-            } else {
-                std::cout << "Failed to open test file" << std::endl;
-                return "Test save failed. Check server permissions.";
+                out += "Test save successful. Check for test_save.txt";
+                return;
             }
-            testFile.close();
-        }
-        else if (cmd == "quiet") {
-            return setQuietMode(true);
+            std::cout << "Failed to open test file" << std::endl;
+            out += "Test save failed. Check server permissions.";
+            return;
         }
-        else if (cmd == "info") {
-            // Extract everything after "info "
-            size_t cmdPos = command.find("info");
-            if (cmdPos == std::string::npos || cmdPos + 5 >= command.length()) {
-                return "Usage: info <message>";
-            }
 
-            std::string infoText = command.substr(cmdPos + 5);
-            return setUserInfo(infoText);
-        }
-        else if (cmd == "nonquiet") {
-            return setQuietMode(false);
-        }
-        else if (cmd == "listmail") {
-            return listMail();
-        }
-        else if (cmd == "readmail") {
-            if (tokens.size() < 2) {
-                return "Usage: readmail <msg_num>";
-            }
+        case Command::WHO:
+            UserManager::getInstance().appendOnlineUsers(out);
+            return;
 
-            int messageId;
-            try {
-                messageId = std::stoi(tokens[1]);
-            } catch (...) {
-                return "Invalid message number.";
-            }
+        case Command::STATS:
+            out += showUserStats(tokens.size() > 1 ? std::string(tokens[1]) : username);
+            return;
 
-            return readMail(messageId);
-        }
-        else if (cmd == "deletemail") {
-            if (tokens.size() < 2) {
-                return "Usage: deletemail <msg_num>";
+        case Command::INFO: {
+            std::string infoText = CommandTable::restOfLine(command, tokens[0]);
+            if (infoText.empty()) {
+                out += "Usage: info <message>";
+                return;
             }
-
-            int messageId;
-            try {
-                messageId = std::stoi(tokens[1]);
-            } catch (...) {
-                return "Invalid message number.";
-            }
-
-            return deleteMail(messageId);
+            out += setUserInfo(infoText);
+            return;
         }
-        else if (cmd == "mail") {
-            if (tokens.size() < 3) {
-                return "Usage: mail <id> <title>";
+
+        case Command::PASSWD:
+            if (tokens.size() < 2) {
+                out += "Usage: passwd <new>";
+                return;
             }
+            out += changePassword(std::string(tokens[1]));
+            return;
 
-            std::string recipient = tokens[1];
+        case Command::QUIET:
+            out += setQuietMode(true);
+            return;
 
-            // Extract title (everything after the recipient)
-            std::string title = command.substr(command.find(recipient) + recipient.length() + 1);
+        case Command::NONQUIET:
+            out += setQuietMode(false);
+            return;
 
-            return sendMail(recipient, title);
-        }
-        else if (cmd == "guest") {
-            return loginGuest();
-        }
-        else if (cmd == "block") {
+        case Command::BLOCK:
             if (tokens.size() < 2) {
-                return "Usage: block <id>";
+                out += "Usage: block <id>";
+                return;
             }
-            return blockUser(tokens[1]);
-        }
-        else if (cmd == "unblock") {
-            if (tokens.size() < 2) {
-                return "Usage: unblock <id>";
-            }
-            return unblockUser(tokens[1]);
-        }
-        else if (cmd == "register") {
-            if (tokens.size() < 3) {
-                return "Usage: register <username> <password>";
-            }
-            return registerUser(tokens[1], tokens[2]);
-        }
-        else if (cmd == "exit" || cmd == "quit") {
-            return "Goodbye!";
-        }
-        else if (cmd == "help" || cmd == "?") {
-            return showHelp();
-        }
-        // Game-related commands
-        else if (cmd == "game") {
-            return listCurrentGames();
-        }
-        else if (cmd == "match") {
-            if (tokens.size() < 3) {
-                return "Usage: match <name> <b|w> [t]";
-            }
-            std::string opponentName = tokens[1];
-            std::string colorStr = tokens[2];
-            int timeLimit = 600; // Default 10 minutes
+            out += blockUser(std::string(tokens[1]));
+            return;
 
-            if (tokens.size() > 3) {
-                try {
-                    timeLimit = std::stoi(tokens[3]);
-                } catch (...) {
-                    return "Invalid time limit. Using default (600 seconds).";
-                }
-            }
-
-            return initiateMatch(opponentName, colorStr, timeLimit);
-        }
-        else if (cmd == "resign") {
-            return resignGame();
-        }
-        else if (cmd == "refresh") {
-            return refreshGame();
-        }
-        else if (cmd == "observe") {
+        case Command::UNBLOCK:
             if (tokens.size() < 2) {
-                return "Usage: observe <game_num>";
+                out += "Usage: unblock <id>";
+                return;
             }
-            int gameId;
-            try {
-                gameId = std::stoi(tokens[1]);
-            } catch (...) {
-                return "Invalid game number.";
-            }
-            return observeGame(gameId);
-        }
-        else if (cmd == "unobserve") {
-            return unobserveGame();
-        }
+            out += unblockUser(std::string(tokens[1]));
+            return;
 
-        // For all other commands, check if user is logged in
-        if (username.empty()) {
-            return "Please login first using 'login <username> <password>' or 'guest'.";
+        case Command::SHOUT: {
+            std::string message = CommandTable::restOfLine(command, tokens[0]);
+            if (message.empty()) {
+                out += "Usage: shout <message>";
+                return;
+            }
+            out += shoutMessage(message);
+            return;
         }
 
-        // Process commands for logged-in users
-        if (cmd == "who") {
-            return UserManager::getInstance().getOnlineUsersList();
+        case Command::TELL: {
+            std::string message = tokens.size() > 2 ? CommandTable::restOfLine(command, tokens[1]) : "";
+            if (message.empty()) {
+                out += "Usage: tell <name> <message>";
+                return;
+            }
+            out += tellMessage(std::string(tokens[1]), message);
+            return;
         }
-        // In processCommand method, add:
-        else if (cmd == "shout") {
-            std::string message = command.substr(command.find(' ') + 1);
 
+        case Command::KIBITZ: {
+            std::string message = CommandTable::restOfLine(command, tokens[0]);
             if (message.empty()) {
-                return "Usage: shout <message>";
+                out += "Usage: kibitz <message> or ' <message>";
+                return;
             }
-
-            return shoutMessage(message);
+            out += kibitzMessage(message);
+            return;
         }
-        else if (cmd == "tell") {
-            // Check if there's anything after "tell"
-            size_t cmdPos = command.find("tell");
-            if (cmdPos == std::string::npos || cmdPos + 5 >= command.length()) {
-                return "Usage: tell <name> <message>";
-            }
 
-            // Extract everything after "tell "
-            std::string rest = command.substr(cmdPos + 5);
+        case Command::LISTMAIL:
+            listMail(out);
+            return;
 
-            // Find the first space after the recipient name
-            size_t spacePos = rest.find_first_of(" \t");
-            if (spacePos == std::string::npos) {
-                return "Usage: tell <name> <message>";
+        case Command::READMAIL:
+        case Command::DELETEMAIL: {
+            if (tokens.size() < 2) {
+                out += spec->command == Command::READMAIL ? "Usage: readmail <msg_num>"
+                                                          : "Usage: deletemail <msg_num>";
+                return;
             }
-
-            // Extract recipient and message
-            std::string recipient = rest.substr(0, spacePos);
-            std::string message = rest.substr(spacePos + 1);
-
-            if (recipient.empty() || message.empty()) {
-                return "Usage: tell <name> <message>";
+            int messageId;
+            if (!parseNumber(tokens[1], messageId)) {
+                out += "Invalid message number.";
+                return;
             }
-
-            return tellMessage(recipient, message);
+            out += spec->command == Command::READMAIL ? readMail(messageId) : deleteMail(messageId);
+            return;
         }
-        else if (cmd == "kibitz" || cmd == "'") {
-            std::string message = command.substr(command.find(' ') + 1);
 
-            if (message.empty()) {
-                return "Usage: kibitz <message> or ' <message>";
+        case Command::MAIL:
+            if (tokens.size() < 3) {
+                out += "Usage: mail <id> <title>";
+                return;
             }
+            // The title is everything after the recipient
+            out += sendMail(std::string(tokens[1]), CommandTable::restOfLine(command, tokens[1]));
+            return;
 
-            return kibitzMessage(message);
-        }
-        else if (cmd == "stats") {
-            if (tokens.size() > 1) {
-                return showUserStats(tokens[1]);
-            } else {
-                return showUserStats(username);
+        case Command::GAME:
+            listCurrentGames(out);
+            return;
+
+        case Command::MATCH: {
+            if (tokens.size() < 3) {
+                out += "Usage: match <name> <b|w> [t]";
+                return;
             }
-        }
-        else if (cmd == "info") {
-            // Combine remaining tokens into the info string
-            std::string info;
-            for (size_t i = 1; i < tokens.size(); i++) {
-                info += tokens[i] + " ";
+            int timeLimit = 600; // Default 10 minutes
+            if (tokens.size() > 3 && !parseNumber(tokens[3], timeLimit)) {
+                out += "Invalid time limit. Using default (600 seconds).";
+                return;
             }
-            return updateUserInfo(info);
+            out += initiateMatch(std::string(tokens[1]), std::string(tokens[2]), timeLimit);
+            return;
         }
-        else if (cmd == "passwd") {
+
+        case Command::RESIGN:
+            out += resignGame();
+            return;
+
+        case Command::REFRESH:
+            refreshGame(out);
+            return;
+
+        case Command::OBSERVE: {
             if (tokens.size() < 2) {
-                return "Usage: passwd <new>";
+                out += "Usage: observe <game_num>";
+                return;
             }
-            return changePassword(tokens[1]);
+            int gameId;
+            if (!parseNumber(tokens[1], gameId)) {
+                out += "Invalid game number.";
+                return;
+            }
+            observeGame(gameId, out);
+            return;
+        }
+
+        case Command::UNOBSERVE:
+            out += unobserveGame();
+            return;
         }
-        // Other command handlers will be added here...
+    }
 
-        // Unknown command
-        return "Unknown command: " + cmd + ". Type 'help' or '?' for a list of commands.";
+    bool isInGame() const
+    {
+        auto currentUser = UserManager::getInstance().getUserByUsername(username);
+        return currentUser && currentUser->isInGame();
+    }
+
+    // A leading integer, as std::stoi reads it
+    static bool parseNumber(std::string_view token, int& value)
+    {
+        try {
+            value = std::stoi(std::string(token));
+            return true;
+        } catch (...) {
+            return false;
+        }
     }
 
 
@@ -1049,12 +2028,14 @@ std::string sendMail(const std::string& recipient, const std::string& title) {
     {
         // If already logged in, log out first
         if (!this->username.empty()) {
-            UserManager::getInstance().logoutUser(clientSocket);
+            UserManager::getInstance().logoutUser(getHandle());
             this->username = "";
+            loggedIn = false;
         }
 
-        UserManager::getInstance().loginGuest(clientSocket);
+        UserManager::getInstance().loginGuest(getHandle());
         this->username = "guest";
+        loggedIn = true;
         return "Logged in as guest. You can register a new account using 'register <username> <password>'.";
     }
 
@@ -1066,7 +2047,7 @@ std::string sendMail(const std::string& recipient, const std::string& title) {
             return "You must be logged in as guest to register.";
         }
 
-        if (UserManager::getInstance().registerUser(username, password, clientSocket)) {
+        if (UserManager::getInstance().registerUser(username, password, getHandle())) {
             this->username = username;
             return "Registration successful. You are now logged in as " + username + ".";
         } else {
@@ -1074,6 +2055,53 @@ std::string sendMail(const std::string& recipient, const std::string& title) {
         }
     }
 
+    // "login" or "register" without both arguments: ask for the name if
+    // it is missing, then for the password with the client's echo off
+    SessionTask promptCredentials(Prompt kind, std::string name)
+    {
+        prompt = kind;
+        promptUser = name;
+        if (name.empty()) {
+            sendPrompt("Username: ");
+            std::optional<std::string> line = co_await readLine();
+            name = line ? firstWord(*line) : "";
+            promptUser = name;
+        }
+
+        std::optional<std::string> password;
+        if (!name.empty()) {
+            hideInput(true);
+            sendPrompt("Password: ");
+            password = co_await readLine();
+            hideInput(false);
+        }
+        prompt = Prompt::NONE;
+        promptUser.clear();
+
+        if (!running) {
+            co_return;
+        }
+        std::string secret = password ? firstWord(*password) : "";
+        if (secret.empty()) {
+            sendMessage(kind == Prompt::LOGIN ? "Login cancelled." : "Registration cancelled.");
+            co_return;
+        }
+        std::function<void()> answer = [this, kind, name, secret]() {
+            sendMessage(kind == Prompt::LOGIN ? loginUser(name, secret) : registerUser(name, secret));
+        };
+        co_await onStrand(std::move(answer));
+    }
+
+    // Names and passwords are single words, as in the command forms
+    static std::string firstWord(const std::string& line)
+    {
+        size_t start = line.find_first_not_of(' ');
+        if (start == std::string::npos) {
+            return "";
+        }
+        return line.substr(start, line.find(' ', start) - start);
+    }
+
     // Show user statistics
     std::string showUserStats(const std::string& targetUser)
     {
@@ -0,0 +1,371 @@
+#ifndef TELNETPROTOCOL_H
+#define TELNETPROTOCOL_H
+
+#include <cstring>
+#include <string>
+
+#include "Snapshot.h"
+
+// Telnet command bytes (RFC 854)
+namespace Telnet {
+    const unsigned char SE = 240;
+    const unsigned char NOP = 241;
+    const unsigned char GA = 249;
+    const unsigned char SB = 250;
+    const unsigned char WILL = 251;
+    const unsigned char WONT = 252;
+    const unsigned char DO = 253;
+    const unsigned char DONT = 254;
+    const unsigned char IAC = 255;
+
+    // Options
+    const unsigned char OPT_BINARY = 0;   // RFC 856
+    const unsigned char OPT_ECHO = 1;     // RFC 857; we only offer it to hide passwords
+    const unsigned char OPT_SGA = 3;      // suppress go-ahead, RFC 858
+    const unsigned char OPT_TTYPE = 24;   // terminal type, RFC 1091
+    const unsigned char OPT_NAWS = 31;    // window size, RFC 1073
+    const unsigned char OPT_COMPRESS2 = 86; // MCCP2 output compression
+
+    // TTYPE subnegotiation codes
+    const unsigned char TTYPE_IS = 0;
+    const unsigned char TTYPE_SEND = 1;
+}
+
+// Incremental telnet protocol parser with option negotiation. Runs over
+// each received chunk in place: plain data is passed on as runs pointing
+// into the chunk, and IAC sequences are consumed. Sequences split across
+// reads are handled because all state lives in the parser.
+//
+// Negotiation follows the RFC 1143 "Q method" (without the queue bits),
+// so neither side can get into a WILL/DO loop.
+class TelnetParser {
+public:
+    // Receives the parser's output
+    class Listener {
+    public:
+        virtual ~Listener() {}
+
+        // Plain data with all telnet commands removed
+        virtual void onTelnetData(const char* data, size_t len) = 0;
+
+        // Raw bytes (negotiation replies) to write to the client
+        virtual void onTelnetSend(const std::string& bytes) = 0;
+
+        // An option was enabled or disabled on either side:
+        // (option, local, enabled)
+        virtual void onTelnetOptionChanged(unsigned char, bool, bool) {}
+    };
+
+    TelnetParser() : state(STATE_DATA), windowWidth(0), windowHeight(0) {
+        memset(localState, NO, sizeof(localState));
+        memset(remoteState, NO, sizeof(remoteState));
+    }
+
+    // Start negotiating the options we want: we suppress go-ahead and
+    // offer compression, and ask the client for its window size and
+    // terminal type
+    void beginNegotiation(Listener& listener) {
+        std::string out;
+        requestLocal(Telnet::OPT_SGA, true, out);
+        requestLocal(Telnet::OPT_COMPRESS2, true, out);
+        requestRemote(Telnet::OPT_NAWS, true, out);
+        requestRemote(Telnet::OPT_TTYPE, true, out);
+        listener.onTelnetSend(out);
+    }
+
+    // Ask to enable or disable an option on our side / the client's side
+    void requestLocal(unsigned char option, bool enable, std::string& out) {
+        request(localState[option], option, enable, Telnet::WILL, Telnet::WONT, out);
+    }
+
+    void requestRemote(unsigned char option, bool enable, std::string& out) {
+        request(remoteState[option], option, enable, Telnet::DO, Telnet::DONT, out);
+    }
+
+    void parse(const char* data, size_t len, Listener& listener) {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+        const unsigned char* end = p + len;
+        std::string replies;
+
+        while (p < end) {
+            if (state == STATE_DATA) {
+                // Pass the longest run of plain bytes straight through
+                const unsigned char* run = p;
+                while (p < end && *p != Telnet::IAC && *p != 0) {
+                    p++;
+                }
+                if (p > run) {
+                    listener.onTelnetData(reinterpret_cast<const char*>(run), static_cast<size_t>(p - run));
+                }
+                if (p == end) {
+                    break;
+                }
+                // NUL (as in CR NUL) carries nothing
+                if (*p == Telnet::IAC) {
+                    state = STATE_IAC;
+                }
+                p++;
+                continue;
+            }
+
+            unsigned char c = *p++;
+            switch (state) {
+            case STATE_IAC:
+                switch (c) {
+                case Telnet::IAC: {
+                    // Escaped 255 data byte
+                    char byte = static_cast<char>(Telnet::IAC);
+                    listener.onTelnetData(&byte, 1);
+                    state = STATE_DATA;
+                    break;
+                }
+                case Telnet::WILL: state = STATE_WILL; break;
+                case Telnet::WONT: state = STATE_WONT; break;
+                case Telnet::DO: state = STATE_DO; break;
+                case Telnet::DONT: state = STATE_DONT; break;
+                case Telnet::SB: state = STATE_SB_OPTION; break;
+                default:
+                    // NOP, GA, AYT, ... carry no data for us
+                    state = STATE_DATA;
+                    break;
+                }
+                break;
+            case STATE_WILL:
+                receiveWill(c, true, replies, listener);
+                state = STATE_DATA;
+                break;
+            case STATE_WONT:
+                receiveWill(c, false, replies, listener);
+                state = STATE_DATA;
+                break;
+            case STATE_DO:
+                receiveDo(c, true, replies, listener);
+                state = STATE_DATA;
+                break;
+            case STATE_DONT:
+                receiveDo(c, false, replies, listener);
+                state = STATE_DATA;
+                break;
+            case STATE_SB_OPTION:
+                sbOption = c;
+                sbData.clear();
+                state = STATE_SB_DATA;
+                break;
+            case STATE_SB_DATA:
+                if (c == Telnet::IAC) {
+                    state = STATE_SB_IAC;
+                } else if (sbData.size() < MAX_SUBNEGOTIATION) {
+                    sbData += static_cast<char>(c);
+                }
+                break;
+            case STATE_SB_IAC:
+                if (c == Telnet::SE) {
+                    handleSubnegotiation();
+                    state = STATE_DATA;
+                } else if (c == Telnet::IAC) {
+                    if (sbData.size() < MAX_SUBNEGOTIATION) {
+                        sbData += static_cast<char>(c);
+                    }
+                    state = STATE_SB_DATA;
+                } else {
+                    // Malformed; give up on this subnegotiation
+                    state = STATE_DATA;
+                }
+                break;
+            default:
+                state = STATE_DATA;
+                break;
+            }
+        }
+
+        if (!replies.empty()) {
+            listener.onTelnetSend(replies);
+        }
+    }
+
+    // Negotiated state
+    bool isLocalEnabled(unsigned char option) const { return localState[option] == YES; }
+    bool isRemoteEnabled(unsigned char option) const { return remoteState[option] == YES; }
+    bool isBinaryMode() const { return isLocalEnabled(Telnet::OPT_BINARY) && isRemoteEnabled(Telnet::OPT_BINARY); }
+    bool isSuppressGoAhead() const { return isLocalEnabled(Telnet::OPT_SGA); }
+    int getWindowWidth() const { return windowWidth; }
+    int getWindowHeight() const { return windowHeight; }
+    std::string getTerminalType() const { return terminalType; }
+
+    // Everything negotiated so far, for a hot restart
+    void saveState(SnapshotWriter& out) const {
+        out.putU8(static_cast<uint8_t>(state));
+        out.putBytes(localState, sizeof(localState));
+        out.putBytes(remoteState, sizeof(remoteState));
+        out.putU8(sbOption);
+        out.putString(sbData);
+        out.putU32(static_cast<uint32_t>(windowWidth));
+        out.putU32(static_cast<uint32_t>(windowHeight));
+        out.putString(terminalType);
+    }
+
+    void restoreState(SnapshotReader& in) {
+        state = static_cast<State>(in.getU8());
+        in.getBytes(localState, sizeof(localState));
+        in.getBytes(remoteState, sizeof(remoteState));
+        sbOption = in.getU8();
+        sbData = in.getString();
+        windowWidth = static_cast<int>(in.getU32());
+        windowHeight = static_cast<int>(in.getU32());
+        terminalType = in.getString();
+    }
+
+private:
+    enum State {
+        STATE_DATA, STATE_IAC, STATE_WILL, STATE_WONT, STATE_DO, STATE_DONT,
+        STATE_SB_OPTION, STATE_SB_DATA, STATE_SB_IAC
+    };
+
+    // Per-option negotiation state (RFC 1143)
+    enum OptionState : unsigned char { NO, YES, WANTNO, WANTYES };
+
+    static const size_t MAX_SUBNEGOTIATION = 64;
+
+    // Options we are willing to enable on our side / accept from the client.
+    // Options we ask for ourselves (ECHO) are enabled by the client's
+    // answer without being listed here.
+    static bool supportsLocal(unsigned char option) {
+        return option == Telnet::OPT_SGA || option == Telnet::OPT_BINARY ||
+               option == Telnet::OPT_COMPRESS2;
+    }
+
+    static bool supportsRemote(unsigned char option) {
+        return option == Telnet::OPT_SGA || option == Telnet::OPT_BINARY ||
+               option == Telnet::OPT_NAWS || option == Telnet::OPT_TTYPE;
+    }
+
+    static void appendCommand(std::string& out, unsigned char verb, unsigned char option) {
+        out += static_cast<char>(Telnet::IAC);
+        out += static_cast<char>(verb);
+        out += static_cast<char>(option);
+    }
+
+    static void request(OptionState& current, unsigned char option, bool enable,
+                        unsigned char yesVerb, unsigned char noVerb, std::string& out) {
+        if (enable && current == NO) {
+            current = WANTYES;
+            appendCommand(out, yesVerb, option);
+        } else if (!enable && current == YES) {
+            current = WANTNO;
+            appendCommand(out, noVerb, option);
+        }
+    }
+
+    // Client sent WILL (enable) or WONT (!enable) for an option on its side
+    void receiveWill(unsigned char option, bool enable, std::string& out, Listener& listener) {
+        OptionState& current = remoteState[option];
+        if (enable) {
+            if (current == NO) {
+                if (supportsRemote(option)) {
+                    current = YES;
+                    appendCommand(out, Telnet::DO, option);
+                    remoteEnabled(option, out, listener);
+                } else {
+                    appendCommand(out, Telnet::DONT, option);
+                }
+            } else if (current == WANTYES) {
+                current = YES;
+                remoteEnabled(option, out, listener);
+            } else if (current == WANTNO) {
+                current = NO;
+            }
+        } else {
+            if (current == YES) {
+                current = NO;
+                appendCommand(out, Telnet::DONT, option);
+                optionChanged(option, false, false, out, listener);
+            } else if (current != NO) {
+                current = NO;
+            }
+        }
+    }
+
+    // Client sent DO (enable) or DONT (!enable) for an option on our side
+    void receiveDo(unsigned char option, bool enable, std::string& out, Listener& listener) {
+        OptionState& current = localState[option];
+        if (enable) {
+            if (current == NO) {
+                if (supportsLocal(option)) {
+                    current = YES;
+                    appendCommand(out, Telnet::WILL, option);
+                    optionChanged(option, true, true, out, listener);
+                } else {
+                    appendCommand(out, Telnet::WONT, option);
+                }
+            } else if (current == WANTYES) {
+                current = YES;
+                optionChanged(option, true, true, out, listener);
+            } else if (current == WANTNO) {
+                current = NO;
+            }
+        } else {
+            if (current == YES) {
+                current = NO;
+                appendCommand(out, Telnet::WONT, option);
+                optionChanged(option, true, false, out, listener);
+            } else if (current != NO) {
+                current = NO;
+            }
+        }
+    }
+
+    void remoteEnabled(unsigned char option, std::string& out, Listener& listener) {
+        if (option == Telnet::OPT_TTYPE) {
+            // Ask for the terminal name
+            out += static_cast<char>(Telnet::IAC);
+            out += static_cast<char>(Telnet::SB);
+            out += static_cast<char>(Telnet::OPT_TTYPE);
+            out += static_cast<char>(Telnet::TTYPE_SEND);
+            out += static_cast<char>(Telnet::IAC);
+            out += static_cast<char>(Telnet::SE);
+        }
+        optionChanged(option, false, true, out, listener);
+    }
+
+    // Send the replies so far before telling the listener, so anything it
+    // sends in response (like the MCCP2 start marker) follows them
+    static void optionChanged(unsigned char option, bool local, bool enabled,
+                              std::string& out, Listener& listener) {
+        if (!out.empty()) {
+            listener.onTelnetSend(out);
+            out.clear();
+        }
+        listener.onTelnetOptionChanged(option, local, enabled);
+    }
+
+    void handleSubnegotiation() {
+        const unsigned char* d = reinterpret_cast<const unsigned char*>(sbData.data());
+        if (sbOption == Telnet::OPT_NAWS && sbData.size() == 4) {
+            windowWidth = (d[0] << 8) | d[1];
+            windowHeight = (d[2] << 8) | d[3];
+        } else if (sbOption == Telnet::OPT_TTYPE && !sbData.empty() && d[0] == Telnet::TTYPE_IS) {
+            terminalType.clear();
+            for (size_t i = 1; i < sbData.size(); i++) {
+                if (d[i] >= 32 && d[i] < 127) {
+                    terminalType += static_cast<char>(d[i]);
+                }
+            }
+        }
+    }
+
+private:
+    State state;
+    OptionState localState[256];
+    OptionState remoteState[256];
+
+    // Subnegotiation being collected
+    unsigned char sbOption;
+    std::string sbData;
+
+    // Values reported by the client
+    int windowWidth;
+    int windowHeight;
+    std::string terminalType;
+};
+
+#endif //TELNETPROTOCOL_H
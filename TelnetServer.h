@@ -2,7 +2,10 @@
 #define TELNETSERVER_H
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <ostream>
 #include <sys/socket.h>
@@ -12,10 +15,22 @@
 #include <arpa/inet.h>
 #include <vector>
 #include <mutex>
+#include <unordered_map>
+#include <deque>
+#include <algorithm>
 
 
 #include "SocketUtils.h"
+#include "Snapshot.h"
+#include "HotRestart.h"
+#include "RateLimit.h"
+#include "Metrics.h"
+#include "ServerConfig.h"
+#include "EpollReactor.h"
+#include "UringReactor.h"
 #include "TelnetClientHandler.h"
+#include "BinaryClientHandler.h"
+#include "CommandExecutor.h"
 //#include "User.h"
 #include "Game.h"
 
@@ -25,135 +40,360 @@
 class TelnetServer
 {
 public:
-    TelnetServer() : serverSocket(-1), running(false)
+    TelnetServer() : unixListenSocket(-1), binaryUnixListenSocket(-1), running(false), ioBackend(IoBackend::EPOLL),
+                     outboundHighWaterMark(0), maxMailBody(0)
     {
     }
 
-    bool start(int port)
+    // Start listening on config.port. Each of the config.reactorThreads
+    // event loops owns its own SO_REUSEPORT listener, accepts on it and
+    // keeps the connections it accepts. Bots get the same arrangement on
+    // config.binaryPort, and browsers on config.webSocketPort. Local
+    // clients can also use the Unix domain sockets in config.unixSocketPath
+    // and config.binaryUnixSocketPath. With config.resumeFd set, take over the listeners, connections, games and
+    // mail of the process that started us for a hot restart.
+    bool start(const ServerConfig& config)
     {
-        //
-        // Create a socket.
-        // Arguments:
-        //     domain: AF_INET = IPv4
-        //     type: SOCK_STREAM = TCP
-        //     protocol: 0 = let system choose
-        // Returns:
-        //     file descriptor, used for subsequent socket operations
-        //
-        serverSocket = socket(AF_INET, SOCK_STREAM, 0);
-        if (serverSocket < 0)
-        {
-            perror("socket");
-            return false;
+        int port = config.port;
+        int reactorThreads = config.reactorThreads;
+        if (reactorThreads <= 0)
+        {
+            reactorThreads = std::max(1u, std::thread::hardware_concurrency());
         }
 
-        //
-        // Set socket options
-        // Arguments:
-        //     file descriptor returned by socket()
-        //     protocol level: SOL_SOCKET = socket level options
-        //     optname: SO_REUSEADDR = allows reuse of local addresses
-        //     optval: pointer to the value of the option (1 == true)
-        //     size of option value variable
-        //
-        int opt = 1;
-        if (setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
-        {
-            perror("setsockopt");
-            close(serverSocket);
-            return false;
+        IoBackend backend = config.ioBackend;
+        if (backend == IoBackend::IO_URING && !UringReactor::isSupported())
+        {
+            std::cout << "io_uring is not available, falling back to epoll" << std::endl;
+            backend = IoBackend::EPOLL;
+        }
+        int commandThreads = config.commandThreads;
+        if (commandThreads == 0)
+        {
+            commandThreads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        // Before any connection can hand it a command
+        CommandExecutor::getInstance().start(commandThreads);
+
+        ioBackend = backend;
+        outboundHighWaterMark = config.outboundHighWaterMark;
+        timeouts = config.timeouts;
+        maxMailBody = config.maxMailBody;
+        limits = config.limits;
+        trustedUids = config.trustedUids;
+        connectionLimiter.setMaxPerAddress(limits.connectionsPerAddress);
+
+        // A hot restart hands us the old process's sockets and a snapshot.
+        // Users are read from users_data.txt, which it saved before sending.
+        std::vector<int> inheritedFds;
+        std::string snapshot;
+        if (config.resumeFd >= 0)
+        {
+            if (!HotRestart::notify(config.resumeFd, HotRestart::READY) ||
+                !HotRestart::receive(config.resumeFd, inheritedFds, snapshot))
+            {
+                std::cerr << "Hot restart: nothing received from the old process" << std::endl;
+                return false;
+            }
+        }
+        SnapshotReader in(snapshot);
+        int64_t pausedAt = 0;
+        size_t nextFd = 0;
+        std::deque<int> inheritedListeners[PORT_KINDS];
+        if (config.resumeFd >= 0)
+        {
+            pausedAt = in.getI64();
+            uint32_t listenerCount = in.getU32();
+            for (uint32_t i = 0; i < listenerCount && nextFd < inheritedFds.size(); i++)
+            {
+                uint8_t kind = in.getU8();
+                inheritedListeners[kind % PORT_KINDS].push_back(inheritedFds[nextFd++]);
+            }
+            MessageManager::getInstance().restoreState(in);
+            GameManager::getInstance().restoreState(in);
         }
 
-        // Socket binding address info
-        struct sockaddr_in serverAddr;
-        memset(&serverAddr, 0, sizeof(serverAddr));
-        serverAddr.sin_family = AF_INET;  // IPv4
-        serverAddr.sin_addr.s_addr = INADDR_ANY;  // Listen on all available interfaces
-        serverAddr.sin_port = htons(port);  // Convert from host byte order to network byte order
-
-        //
-        // Bind the socket to a local address and port number
-        // Arguments:
-        //   file descriptor
-        //   pointer to variable containing address info
-        //   size of address info struct
-        //
-        if (bind(serverSocket, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) < 0)
-        {
-            // If failed, close socket and return error
-            perror("bind");
-            close(serverSocket);
-            return false;
+        // A Unix domain socket cannot be shared out with SO_REUSEPORT, so
+        // every reactor accepts from the same one
+        if (!config.unixSocketPath.empty())
+        {
+            unixListenSocket = openUnixListener(inheritedListeners[UNIX_TELNET_PORT], config.unixSocketPath,
+                                                config.listenBacklog);
+            if (unixListenSocket < 0)
+            {
+                closeListeners();
+                return false;
+            }
+            unixSocketPath = config.unixSocketPath;
+        }
+        if (!config.binaryUnixSocketPath.empty())
+        {
+            binaryUnixListenSocket = openUnixListener(inheritedListeners[UNIX_BINARY_PORT],
+                                                      config.binaryUnixSocketPath, config.listenBacklog);
+            if (binaryUnixListenSocket < 0)
+            {
+                closeListeners();
+                return false;
+            }
+            binaryUnixSocketPath = config.binaryUnixSocketPath;
         }
 
-        if (listen(serverSocket, 10) < 0) {
-            perror("listen");
-            close(serverSocket);
-            return false;
+        // Start the reactors that will own the client sockets
+        for (int i = 0; i < reactorThreads; i++)
+        {
+            int listenSocket = openListener(inheritedListeners[TELNET_PORT], port, config.listenBacklog);
+            if (listenSocket < 0)
+            {
+                closeListeners();
+                reactors.clear();
+                return false;
+            }
+            listenSockets.push_back(listenSocket);
+
+            if (config.binaryPort > 0)
+            {
+                int binarySocket = openListener(inheritedListeners[BINARY_PORT], config.binaryPort,
+                                                config.listenBacklog);
+                if (binarySocket < 0)
+                {
+                    closeListeners();
+                    reactors.clear();
+                    return false;
+                }
+                binaryListenSockets.push_back(binarySocket);
+            }
+
+            if (config.webSocketPort > 0)
+            {
+                int webSocket = openListener(inheritedListeners[WEBSOCKET_PORT], config.webSocketPort,
+                                             config.listenBacklog);
+                if (webSocket < 0)
+                {
+                    closeListeners();
+                    reactors.clear();
+                    return false;
+                }
+                webSocketListenSockets.push_back(webSocket);
+            }
+
+            std::unique_ptr<Reactor> reactor = createReactor(backend, i);
+            reactor->setOutboundHighWaterMark(config.outboundHighWaterMark);
+            if (!reactor->start())
+            {
+                closeListeners();
+                reactors.clear();
+                return false;
+            }
+            reactors.push_back(std::move(reactor));
         }
 
-        // Set the server to non-blocking mode
-        if (!SocketUtils::setNonBlocking(serverSocket))
+        // Listeners the old process had and we have no reactor for
+        for (auto& leftover : inheritedListeners)
         {
-            close(serverSocket);
-            return false;
+            for (int fd : leftover)
+            {
+                close(fd);
+            }
         }
 
-        running = true;
+        for (size_t i = 0; i < reactors.size(); i++)
+        {
+            startAccepting(i);
+        }
 
-        // Start the thread to accept new connections
-        acceptThread = std::thread(&TelnetServer::acceptConnections, this);
+        size_t resumedConnections = 0;
+        if (config.resumeFd >= 0)
+        {
+            resumedConnections = resumeConnections(in, inheritedFds, nextFd);
+        }
 
-        // Start the game cleanup thread
-        cleanupThread = std::thread(&TelnetServer::cleanupGames, this);
+        startBackgroundThreads();
 
-        // Start the game timeout checking thread
-        gameTimeoutThread = std::thread(&TelnetServer::checkGameTimeouts, this);
+        std::cout << "Gomoku server started on port " << port
+                  << " with " << reactorThreads << " " << reactors[0]->getBackendName()
+                  << " reactor thread(s) and " << CommandExecutor::getInstance().getThreadCount()
+                  << " command worker(s), listen backlog " << config.listenBacklog << std::endl;
+        if (config.binaryPort > 0)
+        {
+            std::cout << "Binary protocol listening on port " << config.binaryPort << std::endl;
+        }
+        if (config.webSocketPort > 0)
+        {
+            std::cout << "WebSocket listening on port " << config.webSocketPort << std::endl;
+        }
+        if (unixListenSocket >= 0)
+        {
+            std::cout << "Telnet listening on " << unixSocketPath << std::endl;
+        }
+        if (binaryUnixListenSocket >= 0)
+        {
+            std::cout << "Binary protocol listening on " << binaryUnixSocketPath << std::endl;
+        }
 
-        std::cout << "Gomoku server started on port " << port << std::endl;
+        if (config.resumeFd >= 0)
+        {
+            HotRestart::notify(config.resumeFd, HotRestart::DONE);
+            close(config.resumeFd);
+            std::cout << "Hot restart: resumed " << resumedConnections << " connection(s) and "
+                      << GameManager::getInstance().getAllGames().size() << " game(s), "
+                      << (nowNanoseconds() - pausedAt) / 1000 << " us after the old process paused"
+                      << std::endl;
+        }
         return true;
     }
 
-    void stop()
+    // Hand everything over to a new copy of this binary, started with the
+    // same arguments. Returns false, with the server still running, if the
+    // new process could not be started or did not confirm that it took
+    // over. Once it returns true the new process owns every socket and the
+    // caller must exit without saving or closing anything.
+    bool hotRestart(char* argv[])
     {
-        running = false;
-
-        if (acceptThread.joinable())
+        pid_t child;
+        int channel = HotRestart::spawn(argv, 5000, child);
+        if (channel < 0)
         {
-            acceptThread.join();
+            return false;
         }
 
-        if (cleanupThread.joinable())
+        // From here on clients see nothing but a short pause
+        int64_t pausedAt = nowNanoseconds();
+        stopBackgroundThreads();
+        for (auto& reactor : reactors)
         {
-            cleanupThread.join();
+            reactor->pause();
         }
+        // Let the commands already handed over finish, so the sessions
+        // are saved with nothing half done. What they send waits in the
+        // reactors' outboxes and goes out with the unsent output.
+        CommandExecutor::getInstance().drain();
+        std::vector<std::vector<ReleasedConnection>> released;
+        for (auto& reactor : reactors)
+        {
+            released.push_back(reactor->release());
+        }
+        UserManager::getInstance().saveUsers();
 
-        if (gameTimeoutThread.joinable())
+        SnapshotWriter out;
+        std::vector<int> fds;
+        out.putI64(pausedAt);
+        std::vector<int> unixListenSockets;
+        std::vector<int> binaryUnixListenSockets;
+        if (unixListenSocket >= 0)
         {
-            gameTimeoutThread.join();
+            unixListenSockets.push_back(unixListenSocket);
+        }
+        if (binaryUnixListenSocket >= 0)
+        {
+            binaryUnixListenSockets.push_back(binaryUnixListenSocket);
+        }
+        out.putU32(static_cast<uint32_t>(listenSockets.size() + binaryListenSockets.size() +
+                                         webSocketListenSockets.size() + unixListenSockets.size() +
+                                         binaryUnixListenSockets.size()));
+        addListeners(out, fds, listenSockets, TELNET_PORT);
+        addListeners(out, fds, binaryListenSockets, BINARY_PORT);
+        addListeners(out, fds, webSocketListenSockets, WEBSOCKET_PORT);
+        addListeners(out, fds, unixListenSockets, UNIX_TELNET_PORT);
+        addListeners(out, fds, binaryUnixListenSockets, UNIX_BINARY_PORT);
+        MessageManager::getInstance().saveState(out);
+        GameManager::getInstance().saveState(out);
+
+        // Where the connections start, should they have to be taken back
+        size_t connectionsAt = out.getData().size();
+        size_t connectionFds = fds.size();
+        size_t connectionCount = 0;
+        for (const auto& connections : released)
+        {
+            connectionCount += connections.size();
+        }
+        out.putU32(static_cast<uint32_t>(connectionCount));
+        for (size_t i = 0; i < released.size(); i++)
+        {
+            for (const ReleasedConnection& connection : released[i])
+            {
+                TelnetClientHandler* client = dynamic_cast<TelnetClientHandler*>(connection.handler.get());
+                BinaryClientHandler* bot = dynamic_cast<BinaryClientHandler*>(connection.handler.get());
+                out.putU8(client ? (client->isWebSocket() ? WEBSOCKET_PORT : TELNET_PORT) : BINARY_PORT);
+                out.putU32(static_cast<uint32_t>(i));
+                out.putString(connection.unsent);
+                if (client)
+                {
+                    client->saveState(out);
+                }
+                else
+                {
+                    bot->saveState(out);
+                }
+                fds.push_back(connection.fd);
+            }
         }
+        int64_t packedAt = nowNanoseconds();
+
+        bool sent = HotRestart::send(channel, fds, out.getData());
+        int64_t sentAt = nowNanoseconds();
+        char reply = 0;
+        bool done = sent && HotRestart::readByte(channel, reply, 10000) && reply == HotRestart::DONE;
+        int64_t doneAt = nowNanoseconds();
+        close(channel);
+
+        std::cout << "Hot restart: " << connectionCount << " connection(s), " << fds.size() << " fd(s), "
+                  << out.getData().size() << " byte snapshot; paused and packed in "
+                  << (packedAt - pausedAt) / 1000 << " us, sent in " << (sentAt - packedAt) / 1000
+                  << " us, new process (pid " << child << ") resumed after "
+                  << (doneAt - pausedAt) / 1000 << " us" << std::endl;
+        if (!done)
+        {
+            // It may have taken some of the sockets over, so it must not
+            // outlive the handoff
+            std::cerr << "Hot restart: the new process did not confirm the handoff, serving again" << std::endl;
+            kill(child, SIGKILL);
+            waitpid(child, nullptr, 0);
+            std::string connections = out.getData().substr(connectionsAt);
+            SnapshotReader in(connections);
+            takeBack(in, fds, connectionFds);
+        }
+        return done;
+    }
 
+    void stop()
+    {
+        stopBackgroundThreads();
+
+        // Disconnect all clients. Take the set first, since each disconnect
+        // removes its client from it.
+        std::unordered_map<TelnetClientHandler*, std::shared_ptr<TelnetClientHandler>> remaining;
+        std::unordered_map<BinaryClientHandler*, std::shared_ptr<BinaryClientHandler>> remainingBots;
         {
             std::lock_guard<std::mutex> lock(mutex);
+            remaining.swap(clients);
+            remainingBots.swap(bots);
+        }
+        for (auto& client : remaining)
+        {
+            client.second->disconnect();
+        }
+        for (auto& bot : remainingBots)
+        {
+            bot.second->disconnect();
+        }
 
-            // Disconnect all clients
-            for (auto& client : clients)
-            {
-                client->disconnect();
-            }
-            clients.clear();
+        // Run what the sessions handed over, their goodbyes included,
+        // while the reactors can still take the replies
+        CommandExecutor::getInstance().stop();
+
+        // Stop the event loops; this closes any sockets they still own
+        for (auto& reactor : reactors)
+        {
+            reactor->stop();
         }
+        reactors.clear();
 
         // Save user data before stopping
         std::cout << "Saving user data before server shutdown" << std::endl;
         UserManager::getInstance().saveUsers();
         std::cout << "User data saved successfully" << std::endl;
 
-        if (serverSocket >= 0)
-        {
-            close(serverSocket);
-            serverSocket = -1;
-        }
+        closeListeners();
 
         std::cout << "Server stopped" << std::endl;
     }
@@ -161,8 +401,9 @@ public:
     void broadcastMessage(const std::string& msg, const std::string& excludeUsername = "")
     {
         std::lock_guard<std::mutex> lock(mutex);
-        for (auto& client : clients)
+        for (auto& entry : clients)
         {
+            auto& client = entry.second;
             if (client->isLoggedIn() && client->getUsername() != excludeUsername)
             {
                 // Check if user is in quiet mode
@@ -176,47 +417,453 @@ public:
     }
 
 private:
-    void acceptConnections()
+    // What a listener or connection serves, as recorded in a hot restart
+    // snapshot. Connections on the Unix sockets are recorded as
+    // TELNET_PORT or BINARY_PORT and recognised again by their socket.
+    enum PortKind : uint8_t { TELNET_PORT, BINARY_PORT, WEBSOCKET_PORT, UNIX_TELNET_PORT, UNIX_BINARY_PORT,
+                              PORT_KINDS };
+
+    // Where a connection came from. TCP peers are counted against their
+    // address; local peers on a Unix socket are not, and those running as
+    // a trusted uid also skip the command rate limits.
+    struct Peer
     {
-        while (running)
+        bool isLocal;
+        uint32_t address;  // IPv4 address, TCP only
+        bool trusted;
+
+        static Peer remote(uint32_t address) { return Peer{false, address, false}; }
+        static Peer local(bool trusted) { return Peer{true, 0, trusted}; }
+    };
+
+    static int64_t nowNanoseconds()
+    {
+        // steady_clock is CLOCK_MONOTONIC, so both processes agree on it
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // A listener inherited from the old process if one is left, else a new one
+    static int openListener(std::deque<int>& inherited, int port, int backlog)
+    {
+        if (!inherited.empty())
         {
-            struct sockaddr_in clientAddr;
-            socklen_t clientAddrLen = sizeof(clientAddr);
+            int fd = inherited.front();
+            inherited.pop_front();
+            return fd;
+        }
+        return SocketUtils::createListenSocket(port, backlog, true);
+    }
+
+    static int openUnixListener(std::deque<int>& inherited, const std::string& path, int backlog)
+    {
+        if (!inherited.empty())
+        {
+            int fd = inherited.front();
+            inherited.pop_front();
+            return fd;
+        }
+        return SocketUtils::createUnixListenSocket(path, backlog);
+    }
 
-            // Non-blocking accept
-            int clientSocket = accept(serverSocket, (struct sockaddr*)&clientAddr, &clientAddrLen);
+    static void addListeners(SnapshotWriter& out, std::vector<int>& fds, const std::vector<int>& listeners,
+                             PortKind kind)
+    {
+        for (int fd : listeners)
+        {
+            out.putU8(kind);
+            fds.push_back(fd);
+        }
+    }
 
-            if (clientSocket < 0)
+    // Have reactor i accept on its own listeners and the shared Unix sockets
+    void startAccepting(size_t i)
+    {
+        Reactor* reactor = reactors[i].get();
+        reactor->addListener(listenSockets[i], [this, reactor](int clientSocket) {
+            acceptConnection(clientSocket, reactor);
+        });
+        if (i < binaryListenSockets.size())
+        {
+            reactor->addListener(binaryListenSockets[i], [this, reactor](int clientSocket) {
+                acceptBinaryConnection(clientSocket, reactor);
+            });
+        }
+        if (i < webSocketListenSockets.size())
+        {
+            reactor->addListener(webSocketListenSockets[i], [this, reactor](int clientSocket) {
+                acceptConnection(clientSocket, reactor, true);
+            });
+        }
+        if (unixListenSocket >= 0)
+        {
+            reactor->addListener(unixListenSocket, [this, reactor](int clientSocket) {
+                acceptLocalConnection(clientSocket, reactor, false);
+            });
+        }
+        if (binaryUnixListenSocket >= 0)
+        {
+            reactor->addListener(binaryUnixListenSocket, [this, reactor](int clientSocket) {
+                acceptLocalConnection(clientSocket, reactor, true);
+            });
+        }
+    }
+
+    // A hot restart the new process did not confirm: serve the released
+    // connections again from the snapshot it was sent, on new reactors,
+    // the same way the new process would have
+    void takeBack(SnapshotReader& in, const std::vector<int>& fds, size_t nextFd)
+    {
+        // The old handlers go, and with them their logins, the games they
+        // watch and their places under the per-address cap. The snapshot
+        // brings all of it back with the new ones.
+        std::unordered_map<TelnetClientHandler*, std::shared_ptr<TelnetClientHandler>> oldClients;
+        std::unordered_map<BinaryClientHandler*, std::shared_ptr<BinaryClientHandler>> oldBots;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            oldClients.swap(clients);
+            oldBots.swap(bots);
+        }
+        auto games = GameManager::getInstance().getAllGames();
+        auto forget = [&games](ConnectionHandle handle) {
+            UserManager::getInstance().logoutUser(handle);
+            for (auto& game : games)
             {
-                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                game->removeObserver(handle);
+            }
+        };
+        for (auto& client : oldClients)
+        {
+            forget(client.second->getHandle());
+        }
+        for (auto& bot : oldBots)
+        {
+            forget(bot.second->getHandle());
+        }
+        connectionLimiter.clear();
+
+        size_t reactorCount = reactors.size();
+        reactors.clear();
+        for (size_t i = 0; i < reactorCount; i++)
+        {
+            std::unique_ptr<Reactor> reactor = createReactor(ioBackend, static_cast<int>(i));
+            reactor->setOutboundHighWaterMark(outboundHighWaterMark);
+            if (!reactor->start())
+            {
+                // Every socket is out of its loop, with nowhere to go
+                std::cerr << "Hot restart: could not start reactor " << i << " again" << std::endl;
+                _exit(1);
+            }
+            reactors.push_back(std::move(reactor));
+        }
+        for (size_t i = 0; i < reactors.size(); i++)
+        {
+            startAccepting(i);
+        }
+
+        size_t resumed = resumeConnections(in, fds, nextFd);
+        startBackgroundThreads();
+        std::cout << "Hot restart: serving " << resumed << " connection(s) again" << std::endl;
+    }
+
+    // Recreate the handlers for the connections in a hot restart snapshot,
+    // each on the reactor of the same index as before
+    size_t resumeConnections(SnapshotReader& in, const std::vector<int>& fds, size_t nextFd)
+    {
+        size_t resumed = 0;
+        uint32_t count = in.getU32();
+        for (uint32_t i = 0; i < count && nextFd < fds.size(); i++)
+        {
+            uint8_t kind = in.getU8();
+            Reactor* reactor = reactors[in.getU32() % reactors.size()].get();
+            std::string unsent = in.getString();
+            int fd = fds[nextFd++];
+
+            std::shared_ptr<ConnectionHandler> handler;
+            if (kind == BINARY_PORT)
+            {
+                auto bot = std::make_shared<BinaryClientHandler>(fd, reactor);
+                bot->restoreState(in, unsent);
+                handler = bot;
+                if (in.isOk())
                 {
-                    // No pending connections, sleep a bit
-                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                    continue;
+                    trackBot(bot, resumedPeer(fd));
                 }
-                else
+            }
+            else
+            {
+                auto client = std::make_shared<TelnetClientHandler>(fd, reactor, kind == WEBSOCKET_PORT);
+                client->restoreState(in, unsent);
+                handler = client;
+                if (in.isOk())
                 {
-                    perror("accept");
-                    continue;
+                    trackClient(client, resumedPeer(fd));
                 }
             }
-
-            // Set client socket to non-blocking mode
-            if (!SocketUtils::setNonBlocking(clientSocket))
+            if (!in.isOk())
             {
-                close(clientSocket);
-                continue;
+                std::cerr << "Hot restart: snapshot ends early" << std::endl;
+                close(fd);
+                break;
             }
+            reactor->addConnection(handler);
+            resumed++;
+        }
 
-            // Create a client handler for this connection
-            std::lock_guard<std::mutex> lock(mutex);
-            clients.push_back(std::make_shared<TelnetClientHandler>(clientSocket));
+        // Sockets the snapshot had no record for
+        for (; nextFd < fds.size(); nextFd++)
+        {
+            close(fds[nextFd]);
+        }
+        return resumed;
+    }
+
+    void startBackgroundThreads()
+    {
+        running = true;
+
+        // Start the game cleanup thread
+        cleanupThread = std::thread(&TelnetServer::cleanupGames, this);
+
+        // Start the game timeout checking thread
+        gameTimeoutThread = std::thread(&TelnetServer::checkGameTimeouts, this);
+    }
+
+    // Stop the cleanup and timeout threads without waiting out their sleep
+    void stopBackgroundThreads()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            running = false;
+        }
+        sleepCondition.notify_all();
+
+        if (cleanupThread.joinable())
+        {
+            cleanupThread.join();
+        }
+
+        if (gameTimeoutThread.joinable())
+        {
+            gameTimeoutThread.join();
+        }
+    }
 
-            // Log connection
-            char clientIP[INET_ADDRSTRLEN];
-            inet_ntop(AF_INET, &(clientAddr.sin_addr), clientIP, INET_ADDRSTRLEN);
-            std::cout << "New connection from " << clientIP << ":" << ntohs(clientAddr.sin_port) << std::endl;
+    // Sleep that stopBackgroundThreads() cuts short
+    void sleepWhileRunning(std::chrono::seconds duration)
+    {
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepCondition.wait_for(lock, duration, [this]() { return !running; });
+    }
+
+    static std::unique_ptr<Reactor> createReactor(IoBackend backend, int id)
+    {
+        if (backend == IoBackend::IO_URING)
+        {
+            return std::unique_ptr<Reactor>(new UringReactor(id));
         }
+        return std::unique_ptr<Reactor>(new EpollReactor(id));
+    }
+
+    void closeListeners()
+    {
+        for (int listenSocket : listenSockets)
+        {
+            close(listenSocket);
+        }
+        listenSockets.clear();
+        for (int listenSocket : binaryListenSockets)
+        {
+            close(listenSocket);
+        }
+        binaryListenSockets.clear();
+        for (int listenSocket : webSocketListenSockets)
+        {
+            close(listenSocket);
+        }
+        webSocketListenSockets.clear();
+
+        // The socket files go with the server, unless a new process has
+        // taken them over (then this is never called)
+        if (unixListenSocket >= 0)
+        {
+            close(unixListenSocket);
+            unlink(unixSocketPath.c_str());
+            unixListenSocket = -1;
+        }
+        if (binaryUnixListenSocket >= 0)
+        {
+            close(binaryUnixListenSocket);
+            unlink(binaryUnixSocketPath.c_str());
+            binaryUnixListenSocket = -1;
+        }
+    }
+
+    // Called on a reactor for each socket accepted on its listener; the
+    // connection stays on that reactor. WebSocket clients use the same
+    // handler, with frames in place of telnet.
+    void acceptConnection(int clientSocket, Reactor* reactor, bool webSocket = false)
+    {
+        struct sockaddr_in clientAddr;
+        socklen_t clientAddrLen = sizeof(clientAddr);
+        memset(&clientAddr, 0, sizeof(clientAddr));
+        getpeername(clientSocket, (struct sockaddr*)&clientAddr, &clientAddrLen);
+        SocketUtils::setNoDelay(clientSocket);
+        if (!admit(clientSocket, clientAddr, webSocket ? nullptr : "Too many connections from your address.\r\n"))
+        {
+            return;
+        }
+
+        // Create a client handler for this connection
+        auto client = std::make_shared<TelnetClientHandler>(clientSocket, reactor, webSocket);
+        trackClient(client, Peer::remote(clientAddr.sin_addr.s_addr));
+        reactor->addConnection(client);
+
+        // Log connection
+        char clientIP[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &(clientAddr.sin_addr), clientIP, INET_ADDRSTRLEN);
+        std::cout << (webSocket ? "New WebSocket connection from " : "New connection from ") << clientIP << ":" << ntohs(clientAddr.sin_port) << std::endl;
+    }
+
+    // Same as acceptConnection, for the binary protocol port
+    void acceptBinaryConnection(int clientSocket, Reactor* reactor)
+    {
+        struct sockaddr_in clientAddr;
+        socklen_t clientAddrLen = sizeof(clientAddr);
+        memset(&clientAddr, 0, sizeof(clientAddr));
+        getpeername(clientSocket, (struct sockaddr*)&clientAddr, &clientAddrLen);
+        SocketUtils::setNoDelay(clientSocket);
+        if (!admit(clientSocket, clientAddr, nullptr))
+        {
+            return;
+        }
+
+        auto bot = std::make_shared<BinaryClientHandler>(clientSocket, reactor);
+        trackBot(bot, Peer::remote(clientAddr.sin_addr.s_addr));
+        reactor->addConnection(bot);
+
+        char clientIP[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &(clientAddr.sin_addr), clientIP, INET_ADDRSTRLEN);
+        std::cout << "New binary connection from " << clientIP << ":" << ntohs(clientAddr.sin_port) << std::endl;
+    }
+
+    // Same, for the Unix domain sockets. Whoever can open the socket file
+    // may connect, so there is no per-address cap; the peer's uid decides
+    // whether its commands are rate limited.
+    void acceptLocalConnection(int clientSocket, Reactor* reactor, bool binary)
+    {
+        struct ucred peer;
+        if (!SocketUtils::getPeerCredentials(clientSocket, peer))
+        {
+            close(clientSocket);
+            return;
+        }
+        bool trusted = isTrusted(peer.uid);
+
+        if (binary)
+        {
+            auto bot = std::make_shared<BinaryClientHandler>(clientSocket, reactor);
+            trackBot(bot, Peer::local(trusted));
+            reactor->addConnection(bot);
+        }
+        else
+        {
+            auto client = std::make_shared<TelnetClientHandler>(clientSocket, reactor, false);
+            trackClient(client, Peer::local(trusted));
+            reactor->addConnection(client);
+        }
+
+        std::cout << (binary ? "New local binary connection from pid " : "New local connection from pid ")
+                  << peer.pid << " uid " << peer.uid << " gid " << peer.gid
+                  << (trusted ? " (trusted)" : "") << std::endl;
+    }
+
+    bool isTrusted(uid_t uid) const
+    {
+        return std::find(trustedUids.begin(), trustedUids.end(), uid) != trustedUids.end();
+    }
+
+    // Per-address connection cap. A refused client gets refusal, if any,
+    // and is closed at once.
+    bool admit(int clientSocket, const struct sockaddr_in& clientAddr, const char* refusal)
+    {
+        if (connectionLimiter.admit(clientAddr.sin_addr.s_addr))
+        {
+            return true;
+        }
+        ServerMetrics::getInstance().recordConnectionRefused();
+        if (refusal)
+        {
+            ssize_t sent = ::send(clientSocket, refusal, strlen(refusal), MSG_DONTWAIT | MSG_NOSIGNAL);
+            (void)sent;
+        }
+        close(clientSocket);
+        return false;
+    }
+
+    // Where an inherited connection came from. Its place under the
+    // per-address cap is taken whatever the count.
+    Peer resumedPeer(int fd)
+    {
+        if (SocketUtils::isUnixSocket(fd))
+        {
+            struct ucred peer;
+            return Peer::local(SocketUtils::getPeerCredentials(fd, peer) && isTrusted(peer.uid));
+        }
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        memset(&addr, 0, sizeof(addr));
+        getpeername(fd, (struct sockaddr*)&addr, &len);
+        connectionLimiter.admit(addr.sin_addr.s_addr, true);
+        return Peer::remote(addr.sin_addr.s_addr);
+    }
+
+    // Rate limits for a connection from peer
+    RateLimits limitsFor(const Peer& peer) const
+    {
+        RateLimits peerLimits = limits;
+        if (peer.trusted)
+        {
+            peerLimits.chatPerSecond = 0;
+            peerLimits.gamePerSecond = 0;
+        }
+        return peerLimits;
+    }
+
+    // Keep a handler in the live set until it disconnects, counted against
+    // its source address
+    void trackClient(const std::shared_ptr<TelnetClientHandler>& client, const Peer& peer)
+    {
+        client->setTimeouts(timeouts);
+        client->setMaxMailBody(maxMailBody);
+        client->setRateLimits(limitsFor(peer));
+        client->setDisconnectCallback([this, peer](TelnetClientHandler* handler) {
+            if (!peer.isLocal)
+            {
+                connectionLimiter.release(peer.address);
+            }
+            // The reactor holds the last reference until the socket is closed
+            std::lock_guard<std::mutex> lock(mutex);
+            clients.erase(handler);
+        });
+        std::lock_guard<std::mutex> lock(mutex);
+        clients[client.get()] = client;
+    }
+
+    void trackBot(const std::shared_ptr<BinaryClientHandler>& bot, const Peer& peer)
+    {
+        bot->setTimeouts(timeouts);
+        bot->setRateLimits(limitsFor(peer));
+        bot->setDisconnectCallback([this, peer](BinaryClientHandler* handler) {
+            if (!peer.isLocal)
+            {
+                connectionLimiter.release(peer.address);
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            bots.erase(handler);
+        });
+        std::lock_guard<std::mutex> lock(mutex);
+        bots[bot.get()] = bot;
     }
 
     void cleanupGames()
@@ -225,26 +872,10 @@ private:
         {
             // Clean up finished games periodically
             GameManager::getInstance().cleanupGames();
-
-            // Check for disconnected clients
-            {
-                std::lock_guard<std::mutex> lock(mutex);
-                auto it = clients.begin();
-                while (it != clients.end())
-                {
-                    if (!(*it)->isConnected())
-                    {
-                        it = clients.erase(it);
-                    }
-                    else
-                    {
-                        ++it;
-                    }
-                }
-            }
+            std::cout << ServerMetrics::getInstance().getReport();
 
             // Sleep for a while
-            std::this_thread::sleep_for(std::chrono::seconds(30));
+            sleepWhileRunning(std::chrono::seconds(30));
         }
     }
 
@@ -263,43 +894,41 @@ private:
                         // A game has ended due to timeout
                         std::cout << "Game " << game->getId() << " ended due to timeout" << std::endl;
 
-                        // Notify players
-                        std::string timeoutMsg = "Game ended: " + game->getWinner() + " wins due to timeout.";
-
-                        auto blackPlayer = game->getBlackPlayer();
-                        auto whitePlayer = game->getWhitePlayer();
-
-                        if (blackPlayer->getSocket() != -1)
-                        {
-                            SocketUtils::sendData(blackPlayer->getSocket(), timeoutMsg + "\r\n");
-                        }
-
-                        if (whitePlayer->getSocket() != -1)
-                        {
-                            SocketUtils::sendData(whitePlayer->getSocket(), timeoutMsg + "\r\n");
-                        }
-
-                        // Notify observers
-                        for (int observerSocket : game->getObservers())
-                        {
-                            SocketUtils::sendData(observerSocket, timeoutMsg + "\r\n");
-                        }
+                        // Notify players and observers
+                        GameNotifier::gameTimedOut(game);
                     }
                 }
             }
 
             // Check every second
-            std::this_thread::sleep_for(std::chrono::seconds(1));
+            sleepWhileRunning(std::chrono::seconds(1));
         }
     }
 
 private:
-    int serverSocket;
+    std::vector<int> listenSockets; // one SO_REUSEPORT listener per reactor
+    std::vector<int> binaryListenSockets; // same, for the binary port
+    std::vector<int> webSocketListenSockets; // and for the WebSocket port
+    int unixListenSocket;       // shared by every reactor, -1 if disabled
+    int binaryUnixListenSocket; // same, for bots
+    std::string unixSocketPath;
+    std::string binaryUnixSocketPath;
     std::atomic<bool> running;
-    std::thread acceptThread;
+    std::mutex sleepMutex;             // with sleepCondition, wakes the threads below to stop
+    std::condition_variable sleepCondition;
     std::thread cleanupThread;
     std::thread gameTimeoutThread;
-    std::vector<std::shared_ptr<TelnetClientHandler>> clients;
+    std::vector<std::unique_ptr<Reactor>> reactors;
+    IoBackend ioBackend;          // what the reactors were started with,
+    size_t outboundHighWaterMark; // for starting them again
+    SessionTimeouts timeouts; // handed to every client
+    size_t maxMailBody;
+    RateLimits limits;        // likewise
+    std::vector<uid_t> trustedUids; // local peers exempt from limits
+    ConnectionLimiter connectionLimiter; // open connections per source address
+    // Live clients; each removes itself when it disconnects
+    std::unordered_map<TelnetClientHandler*, std::shared_ptr<TelnetClientHandler>> clients;
+    std::unordered_map<BinaryClientHandler*, std::shared_ptr<BinaryClientHandler>> bots;
     std::mutex mutex;
 };
 
@@ -0,0 +1,195 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Hierarchical timing wheel: four levels of 64 slots, each level's slot
+// covering one full turn of the level below. Scheduling and cancelling
+// are O(1); a tick only touches the one slot that is due, plus a cascade
+// of one higher-level slot every 64 ticks. Timers live in a pool and are
+// named by index and generation, like connections, so a stale id cannot
+// cancel somebody else's timer. Not thread-safe; each reactor owns one.
+class TimerWheel {
+public:
+    struct TimerId {
+        uint32_t index;
+        uint32_t generation;  // 0 means no timer
+
+        TimerId() : index(0), generation(0) {}
+        TimerId(uint32_t index, uint32_t generation) : index(index), generation(generation) {}
+
+        bool isValid() const { return generation != 0; }
+    };
+
+    typedef std::function<void()> Callback;
+
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+    // Longest delay; anything later fires at this point
+    static const uint64_t MAX_DELAY = (uint64_t(1) << (LEVELS * SLOT_BITS)) - 1;
+
+    TimerWheel() : lastTick(0), count(0), freeList(NONE), nextGeneration(1) {
+        for (int i = 0; i < LEVELS * SLOTS; i++) {
+            slots[i] = NONE;
+        }
+    }
+
+    // Run callback when the wheel reaches delay ticks from now (at least one)
+    TimerId schedule(uint64_t delay, Callback callback) {
+        if (delay == 0) {
+            delay = 1;
+        } else if (delay > MAX_DELAY) {
+            delay = MAX_DELAY;
+        }
+
+        uint32_t index;
+        if (freeList != NONE) {
+            index = freeList;
+            freeList = nodes[index].next;
+        } else {
+            index = static_cast<uint32_t>(nodes.size());
+            nodes.emplace_back();
+        }
+        Node& node = nodes[index];
+        node.expires = lastTick + delay;
+        node.generation = nextGeneration++;
+        if (nextGeneration == 0) {
+            nextGeneration = 1;
+        }
+        node.callback = std::move(callback);
+        link(index, lastTick + 1);
+        count++;
+        return TimerId(index, node.generation);
+    }
+
+    // Returns false if the timer already fired or was cancelled
+    bool cancel(TimerId id) {
+        if (!id.isValid() || id.index >= nodes.size() ||
+            nodes[id.index].generation != id.generation || nodes[id.index].slot == NONE) {
+            return false;
+        }
+        unlink(id.index);
+        release(id.index);
+        return true;
+    }
+
+    // Run every timer due up to and including tick. Callbacks may
+    // schedule and cancel timers.
+    void advance(uint64_t tick) {
+        if (count == 0) {
+            // Nothing to cascade; skip the idle stretch in one step
+            if (tick > lastTick) {
+                lastTick = tick;
+            }
+            return;
+        }
+
+        while (lastTick < tick) {
+            lastTick++;
+            uint32_t slot = static_cast<uint32_t>(lastTick & (SLOTS - 1));
+
+            // On wrapping a level, spread the next higher slot over the
+            // levels below
+            for (int level = 1; level < LEVELS && ((lastTick >> ((level - 1) * SLOT_BITS)) & (SLOTS - 1)) == 0;
+                 level++) {
+                cascade(level, static_cast<uint32_t>((lastTick >> (level * SLOT_BITS)) & (SLOTS - 1)));
+            }
+
+            // Unlink each timer before running it, so a callback can touch
+            // the slot safely
+            while (slots[slot] != NONE) {
+                uint32_t index = slots[slot];
+                unlink(index);
+                Callback callback = std::move(nodes[index].callback);
+                release(index);
+                callback();
+            }
+
+            if (count == 0 && lastTick < tick) {
+                lastTick = tick;
+            }
+        }
+    }
+
+    uint64_t getTick() const { return lastTick; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+private:
+    static const uint32_t NONE = 0xffffffffu;
+
+    struct Node {
+        uint64_t expires;
+        uint32_t generation;
+        uint32_t slot;  // index into slots, NONE when not scheduled
+        uint32_t prev;
+        uint32_t next;  // also links the free list
+        Callback callback;
+
+        Node() : expires(0), generation(0), slot(NONE), prev(NONE), next(NONE) {}
+    };
+
+    // The lowest level whose span covers the time from tick "from" (the
+    // first one not yet run) to the expiry, at the slot the expiry falls in
+    void link(uint32_t index, uint64_t from) {
+        Node& node = nodes[index];
+        uint64_t delta = node.expires - from;
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= (uint64_t(1) << ((level + 1) * SLOT_BITS))) {
+            level++;
+        }
+        uint32_t slot = static_cast<uint32_t>(level * SLOTS +
+                                              ((node.expires >> (level * SLOT_BITS)) & (SLOTS - 1)));
+        node.slot = slot;
+        node.prev = NONE;
+        node.next = slots[slot];
+        if (node.next != NONE) {
+            nodes[node.next].prev = index;
+        }
+        slots[slot] = index;
+    }
+
+    void unlink(uint32_t index) {
+        Node& node = nodes[index];
+        if (node.prev != NONE) {
+            nodes[node.prev].next = node.next;
+        } else {
+            slots[node.slot] = node.next;
+        }
+        if (node.next != NONE) {
+            nodes[node.next].prev = node.prev;
+        }
+        node.slot = NONE;
+    }
+
+    void release(uint32_t index) {
+        Node& node = nodes[index];
+        node.callback = nullptr;
+        node.generation = 0;
+        node.next = freeList;
+        freeList = index;
+        count--;
+    }
+
+    void cascade(int level, uint32_t slot) {
+        uint32_t index = slots[level * SLOTS + slot];
+        slots[level * SLOTS + slot] = NONE;
+        while (index != NONE) {
+            uint32_t next = nodes[index].next;
+            link(index, lastTick);
+            index = next;
+        }
+    }
+
+    uint64_t lastTick;  // last tick whose timers have run
+    size_t count;
+    uint32_t slots[LEVELS * SLOTS];  // head of each slot's list
+    std::vector<Node> nodes;
+    uint32_t freeList;
+    uint32_t nextGeneration;
+};
+
+#endif //TIMERWHEEL_H
@@ -0,0 +1,1020 @@
+#ifndef URINGREACTOR_H
+#define URINGREACTOR_H
+
+#include <cstdlib>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+
+#include "BufferPool.h"
+#include "ConnectionRegistry.h"
+#include "Metrics.h"
+#include "Reactor.h"
+#include "SocketUtils.h"
+
+// Completion-based reactor built on io_uring. Listeners use multishot
+// accept, connections use multishot recv into a ring of provided buffers,
+// and every send queued during one loop iteration goes to the kernel in a
+// single io_uring_enter call.
+class UringReactor : public Reactor {
+public:
+    explicit UringReactor(int id)
+        : Reactor(id), ringFd(-1), wakeFd(-1), wakeValue(0), timerValue(0), releaseTimeout{},
+          releasing(false), activeAccepts(0),
+          sqRingPtr(nullptr), cqRingPtr(nullptr), sqes(nullptr),
+          sqRingSize(0), cqRingSize(0), sqesSize(0), sqLocalTail(0), toSubmit(0),
+          bufRing(nullptr), bufPool(nullptr), bufRingTail(0),
+          connections(0, std::hash<int>(), std::equal_to<int>(), ConnectionAllocator(&connectionSlab)),
+          nextGeneration(1) {}
+
+    ~UringReactor() {
+        stop();
+    }
+
+    // Whether this kernel can run the io_uring backend (multishot recv and
+    // provided buffer rings need Linux 6.0)
+    static bool isSupported() {
+        struct utsname info;
+        if (uname(&info) != 0) {
+            return false;
+        }
+        int major = 0, minor = 0;
+        if (sscanf(info.release, "%d.%d", &major, &minor) != 2 || major < 6) {
+            return false;
+        }
+
+        // Make sure io_uring is not disabled or filtered
+        UringReactor probe(-1);
+        if (!probe.setupRing()) {
+            return false;
+        }
+        probe.teardownRing();
+        return true;
+    }
+
+    const char* getBackendName() const override { return "io_uring"; }
+
+    bool start() override {
+        if (!setupRing()) {
+            return false;
+        }
+
+        // eventfd used to wake the loop when work is posted from another thread
+        wakeFd = eventfd(0, EFD_CLOEXEC);
+        if (wakeFd < 0) {
+            perror("eventfd");
+            teardownRing();
+            return false;
+        }
+        armWakeup();
+
+        // timerfd that drives the timer wheel, read the same way
+        timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        if (timerFd < 0) {
+            perror("timerfd_create");
+            teardownRing();
+            close(wakeFd);
+            wakeFd = -1;
+            return false;
+        }
+        armTimerRead();
+
+        running = true;
+        loopThread = std::thread(&UringReactor::run, this);
+        return true;
+    }
+
+    void stop() override {
+        if (!running.exchange(false)) {
+            return;
+        }
+        wakeup();
+        if (loopThread.joinable()) {
+            loopThread.join();
+        }
+
+        // Tear the ring down first so the kernel is done with our buffers
+        teardownRing();
+        close(wakeFd);
+        close(timerFd);
+        wakeFd = timerFd = -1;
+
+        // Close whatever is still registered
+        for (auto& pair : connections) {
+            ConnectionRegistry::getInstance().remove(pair.second.handle);
+            dropOutput(pair.second);
+            close(pair.first);
+        }
+        connections.clear();
+        listeners.clear();
+        connectionCount = 0;
+    }
+
+    // The kernel may still be accepting, receiving and sending for us, so
+    // the loop cancels that first and stops once every operation has
+    // completed, or once RELEASE_DEADLINE_MS has passed
+    void pause() override {
+        if (!running) {
+            return;
+        }
+        post([this]() { beginRelease(); });
+        if (loopThread.joinable()) {
+            loopThread.join();
+        }
+    }
+
+    std::vector<ReleasedConnection> release() override {
+        // Output sent from other reactors after our loop stopped
+        drainOutbox([this](ConnectionHandle handle, std::string_view data) {
+            auto it = findConnection(handle);
+            if (it != connections.end()) {
+                appendOutput(it->second, data);
+            }
+        });
+
+        teardownRing();
+        close(wakeFd);
+        close(timerFd);
+        wakeFd = timerFd = -1;
+
+        std::vector<ReleasedConnection> released;
+        for (auto& pair : connections) {
+            Connection& conn = pair.second;
+            ConnectionRegistry::getInstance().remove(conn.handle);
+            if (conn.closing || conn.peerClosed) {
+                // Already on its way out
+                dropOutput(conn);
+                close(pair.first);
+                continue;
+            }
+
+            if (conn.filter) {
+                std::string tail;
+                conn.filter->finish(tail);
+                conn.output.append(chunks, tail);
+                conn.filter.reset();
+            }
+
+            ReleasedConnection out;
+            out.handler = conn.handler;
+            out.fd = pair.first;
+            out.unsent = conn.output.toString();
+            dropOutput(conn);
+            released.push_back(std::move(out));
+        }
+        connections.clear();
+        listeners.clear();
+        dirtyFds.clear();
+        recvRetry.clear();
+        connectionCount = 0;
+        return released;
+    }
+
+    void addListener(int fd, AcceptCallback onAccept) override {
+        post([this, fd, onAccept]() {
+            listeners[fd] = onAccept;
+            armAccept(fd);
+        });
+    }
+
+    void addConnection(std::shared_ptr<ConnectionHandler> handler) override {
+        connectionCount++;
+        post([this, handler]() {
+            int fd = handler->getSocket();
+            ConnectionHandle handle = ConnectionRegistry::getInstance().add(fd, this, handler->getProtocol());
+            if (!handle.isValid()) {
+                std::cerr << "No connection slot for socket " << fd << std::endl;
+                close(fd);
+                connectionCount--;
+                return;
+            }
+            Connection& conn = connections[fd];
+            conn.handler = handler;
+            conn.handle = handle;
+            conn.generation = nextGeneration++ & GENERATION_MASK;
+            armRecv(fd, conn);
+            handler->setHandle(handle);
+            handler->onOpen();
+        });
+    }
+
+    void removeConnection(ConnectionHandle handle) override {
+        post([this, handle]() {
+            auto it = findConnection(handle);
+            if (it == connections.end()) {
+                return;
+            }
+            it->second.closing = true;
+
+            finishFilterBatch(it->first, it->second);
+
+            // Let queued output reach the socket before closing it
+            if (!it->second.sendInFlight && it->second.output.empty()) {
+                closeConnection(it);
+            }
+        });
+    }
+
+    bool send(ConnectionHandle handle, std::string_view data) override {
+        if (!isInLoopThread()) {
+            enqueueOutbound(handle, data);
+            return true;
+        }
+        catchUpOutbox();
+
+        auto it = findConnection(handle);
+        if (it == connections.end() || it->second.closing || it->second.peerClosed) {
+            return false;
+        }
+        int fd = it->first;
+        Connection& conn = it->second;
+        if (conn.lastOutputTick != loopTick) {
+            conn.lastOutputTick = loopTick;
+            conn.responses++;
+        }
+
+        if (!conn.filter) {
+            return queueOutput(fd, conn, data);
+        }
+
+        // The filter's output is completed by finishFilterBatch() just
+        // before the next submission
+        if (!conn.filterPending) {
+            conn.filterPending = true;
+            dirtyFds.push_back(fd);
+        }
+        filterScratch.clear();
+        conn.filter->write(data, filterScratch);
+        return queueOutput(fd, conn, filterScratch);
+    }
+
+    void setOutputFilter(ConnectionHandle handle, std::shared_ptr<OutputFilter> filter) override {
+        if (!isInLoopThread()) {
+            post([this, handle, filter]() { setOutputFilter(handle, filter); });
+            return;
+        }
+
+        auto it = findConnection(handle);
+        if (it == connections.end()) {
+            return;
+        }
+        Connection& conn = it->second;
+        if (conn.filter) {
+            std::string tail;
+            conn.filter->finish(tail);
+            conn.filterPending = false;
+            queueOutput(it->first, conn, tail);
+        }
+        conn.filter = filter;
+    }
+
+    bool whenFlushed(ConnectionHandle handle, std::function<void()> callback) override {
+        auto it = findConnection(handle);
+        if (it == connections.end() || it->second.closing || it->second.peerClosed) {
+            return false;
+        }
+        Connection& conn = it->second;
+        if (conn.output.empty() && !conn.sendInFlight && !conn.filterPending) {
+            return false;
+        }
+        conn.onFlushed = std::move(callback);
+        return true;
+    }
+
+protected:
+    void wakeup() override {
+        uint64_t one = 1;
+        ssize_t n = write(wakeFd, &one, sizeof(one));
+        (void)n;
+    }
+
+private:
+    // Chunks one SENDMSG covers
+    static const int SEND_IOVECS = 16;
+
+    // Per-socket state kept by the loop thread
+    struct Connection {
+        std::shared_ptr<ConnectionHandler> handler;
+        ConnectionHandle handle;
+        uint32_t generation;   // tags this connection's CQEs
+        ChunkChain output;     // not yet sent, in the reactor's chunks
+        struct msghdr sendMsg; // the SENDMSG in flight, over the head of output
+        struct iovec sendIov[SEND_IOVECS];
+        uint64_t lastOutputTick; // loop tick of the latest send()
+        uint64_t responses;    // ticks that produced output
+        std::shared_ptr<OutputFilter> filter;
+        bool filterPending;    // filter has output to flush this iteration
+        bool sendInFlight;
+        bool recvArmed;        // a multishot recv is active
+        bool closing;          // removeConnection() was called
+        bool peerClosed;       // onClose() already delivered
+        std::function<void()> onFlushed; // whenFlushed() callback
+
+        Connection() : generation(0), lastOutputTick(UINT64_MAX), responses(0),
+                       filterPending(false), sendInFlight(false), recvArmed(false), closing(false), peerClosed(false) {}
+    };
+
+    typedef SlabAllocator<std::pair<const int, Connection>> ConnectionAllocator;
+    typedef std::unordered_map<int, Connection, std::hash<int>, std::equal_to<int>, ConnectionAllocator>
+        ConnectionMap;
+
+    // Operations encoded in the top byte of user_data
+    enum Op : uint64_t {
+        OP_ACCEPT = 1, OP_RECV = 2, OP_SEND = 3, OP_WAKE = 4, OP_CANCEL = 5, OP_TIMER = 6, OP_DEADLINE = 7
+    };
+
+    static const unsigned RING_ENTRIES = 256;
+    static const unsigned BUFFER_COUNT = 256;    // power of two
+    static const unsigned BUFFER_SIZE = 4096;
+    static const uint16_t BUFFER_GROUP = 0;
+    static const uint32_t GENERATION_MASK = 0xffffff;
+    static const long RELEASE_DEADLINE_MS = 1000;  // how long pause() waits for cancellations
+
+    // user_data = op:8 | generation:24 | fd:32, so completions for a closed
+    // socket whose fd number was reused can be recognised and dropped
+    static uint64_t makeUserData(Op op, uint32_t generation, int fd) {
+        return (static_cast<uint64_t>(op) << 56) |
+               (static_cast<uint64_t>(generation & GENERATION_MASK) << 32) |
+               static_cast<uint32_t>(fd);
+    }
+
+    bool setupRing() {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = RING_ENTRIES * 4;
+
+        ringFd = static_cast<int>(syscall(__NR_io_uring_setup, RING_ENTRIES, &params));
+        if (ringFd < 0) {
+            return false;
+        }
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)) {
+            close(ringFd);
+            ringFd = -1;
+            return false;
+        }
+
+        // Map the submission/completion rings (shared mapping) and the SQE array
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        if (cqRingSize > sqRingSize) {
+            sqRingSize = cqRingSize;
+        }
+        sqRingPtr = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ringFd, IORING_OFF_SQ_RING);
+        if (sqRingPtr == MAP_FAILED) {
+            sqRingPtr = nullptr;
+            teardownRing();
+            return false;
+        }
+        cqRingPtr = sqRingPtr;
+
+        sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes = static_cast<struct io_uring_sqe*>(
+            mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED) {
+            sqes = nullptr;
+            teardownRing();
+            return false;
+        }
+
+        char* sq = static_cast<char*>(sqRingPtr);
+        sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqEntries = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sqLocalTail = *sqTail;
+
+        char* cq = static_cast<char*>(cqRingPtr);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        return setupBufferRing();
+    }
+
+    // Register the ring of receive buffers the kernel picks from
+    bool setupBufferRing() {
+        size_t ringBytes = BUFFER_COUNT * sizeof(struct io_uring_buf);
+        if (posix_memalign(reinterpret_cast<void**>(&bufRing), 4096, ringBytes) != 0) {
+            bufRing = nullptr;
+            teardownRing();
+            return false;
+        }
+        memset(bufRing, 0, ringBytes);
+        bufPool = static_cast<char*>(malloc(BUFFER_COUNT * BUFFER_SIZE));
+        if (!bufPool) {
+            teardownRing();
+            return false;
+        }
+
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<uint64_t>(bufRing);
+        reg.ring_entries = BUFFER_COUNT;
+        reg.bgid = BUFFER_GROUP;
+        if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            teardownRing();
+            return false;
+        }
+
+        bufRingTail = 0;
+        for (unsigned bid = 0; bid < BUFFER_COUNT; bid++) {
+            addBuffer(static_cast<uint16_t>(bid));
+        }
+        publishBuffers();
+        return true;
+    }
+
+    void teardownRing() {
+        if (sqes) {
+            munmap(sqes, sqesSize);
+            sqes = nullptr;
+        }
+        if (sqRingPtr) {
+            munmap(sqRingPtr, sqRingSize);
+            sqRingPtr = cqRingPtr = nullptr;
+        }
+        if (ringFd >= 0) {
+            close(ringFd);
+            ringFd = -1;
+        }
+        free(bufRing);
+        bufRing = nullptr;
+        free(bufPool);
+        bufPool = nullptr;
+    }
+
+    // Give a receive buffer back to the kernel (visible after publishBuffers)
+    void addBuffer(uint16_t bid) {
+        struct io_uring_buf* buf = &bufRing[bufRingTail & (BUFFER_COUNT - 1)];
+        buf->addr = reinterpret_cast<uint64_t>(bufPool + static_cast<size_t>(bid) * BUFFER_SIZE);
+        buf->len = BUFFER_SIZE;
+        buf->bid = bid;
+        bufRingTail++;
+    }
+
+    // The ring tail overlays the resv field of the first entry
+    void publishBuffers() {
+        __atomic_store_n(&bufRing[0].resv, bufRingTail, __ATOMIC_RELEASE);
+    }
+
+    struct io_uring_sqe* getSqe() {
+        unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        if (sqLocalTail - head >= sqEntries) {
+            // Submission queue full; push what we have to the kernel first
+            submit(0);
+            head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+            if (sqLocalTail - head >= sqEntries) {
+                return nullptr;
+            }
+        }
+        unsigned index = sqLocalTail & sqMask;
+        struct io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqArray[index] = index;
+        sqLocalTail++;
+        toSubmit++;
+        return sqe;
+    }
+
+    // Submit prepared SQEs and optionally wait for completions
+    int submit(unsigned waitFor) {
+        __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+        unsigned flags = waitFor > 0 ? IORING_ENTER_GETEVENTS : 0;
+        int ret = static_cast<int>(syscall(__NR_io_uring_enter, ringFd, toSubmit, waitFor, flags, nullptr, 0));
+        if (ret >= 0) {
+            toSubmit -= static_cast<unsigned>(ret) < toSubmit ? static_cast<unsigned>(ret) : toSubmit;
+        }
+        return ret;
+    }
+
+    void armWakeup() {
+        struct io_uring_sqe* sqe = getSqe();
+        if (!sqe) {
+            return;
+        }
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = wakeFd;
+        sqe->addr = reinterpret_cast<uint64_t>(&wakeValue);
+        sqe->len = sizeof(wakeValue);
+        sqe->user_data = makeUserData(OP_WAKE, 0, wakeFd);
+    }
+
+    void armTimerRead() {
+        struct io_uring_sqe* sqe = getSqe();
+        if (!sqe) {
+            return;
+        }
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = timerFd;
+        sqe->addr = reinterpret_cast<uint64_t>(&timerValue);
+        sqe->len = sizeof(timerValue);
+        sqe->user_data = makeUserData(OP_TIMER, 0, timerFd);
+    }
+
+    void armAccept(int listenFd) {
+        struct io_uring_sqe* sqe = getSqe();
+        if (!sqe) {
+            return;
+        }
+        activeAccepts++;
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = listenFd;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        sqe->user_data = makeUserData(OP_ACCEPT, 0, listenFd);
+    }
+
+    void armRecv(int fd, Connection& conn) {
+        if (releasing) {
+            // Unread data stays in the socket for the next process
+            return;
+        }
+        struct io_uring_sqe* sqe = getSqe();
+        if (!sqe) {
+            // The kernel has not taken the queue yet; try again next time
+            // round the loop rather than never reading this client again
+            recvRetry.push_back(fd);
+            return;
+        }
+        conn.recvArmed = true;
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = fd;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUFFER_GROUP;
+        sqe->user_data = makeUserData(OP_RECV, conn.generation, fd);
+    }
+
+    void armSend(int fd, Connection& conn) {
+        struct io_uring_sqe* sqe = getSqe();
+        if (!sqe) {
+            // Back on the list for the next flushSends()
+            dirtyFds.push_back(fd);
+            return;
+        }
+        // Bytes appended while this is in flight go into later chunks or
+        // past the ends recorded here, so the kernel's view stays intact
+        memset(&conn.sendMsg, 0, sizeof(conn.sendMsg));
+        conn.sendMsg.msg_iov = conn.sendIov;
+        conn.sendMsg.msg_iovlen = conn.output.fillIovec(conn.sendIov, SEND_IOVECS);
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(&conn.sendMsg);
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = makeUserData(OP_SEND, conn.generation, fd);
+        conn.sendInFlight = true;
+        ServerMetrics::getInstance().recordWriteCall();
+    }
+
+    // Queue bytes that are ready for the socket, coalescing with anything
+    // else queued this iteration; the SEND is prepared in flushSends()
+    // just before the next submission
+    bool queueOutput(int fd, Connection& conn, std::string_view data) {
+        if (data.empty()) {
+            return true;
+        }
+        if (conn.output.empty() && !conn.sendInFlight) {
+            dirtyFds.push_back(fd);
+        }
+        conn.output.append(chunks, data);
+        ServerMetrics::getInstance().recordOutboundQueued(static_cast<int64_t>(data.size()), conn.output.size());
+
+        if (conn.output.size() > outboundHighWaterMark) {
+            // The client is not reading; drop it rather than buffer forever
+            std::cout << "Connection " << fd << " exceeded outbound high-water mark ("
+                      << conn.output.size() << " bytes), disconnecting" << std::endl;
+            ServerMetrics::getInstance().recordOutboundOverflow();
+            if (!conn.sendInFlight) {
+                // A SENDMSG in flight still points into the chunks; its
+                // completion drops them
+                dropOutput(conn);
+            }
+            conn.peerClosed = true;
+
+            // Deliver the close from the loop rather than from inside
+            // whatever handler is sending to this connection
+            std::shared_ptr<ConnectionHandler> handler = conn.handler;
+            post([handler]() { handler->onClose(); });
+            return false;
+        }
+        return true;
+    }
+
+    // Queue output without submitting it, for release()
+    void appendOutput(Connection& conn, std::string_view data) {
+        if (conn.filter) {
+            filterScratch.clear();
+            conn.filter->write(data, filterScratch);
+            data = filterScratch;
+        }
+        conn.output.append(chunks, data);
+        ServerMetrics::getInstance().recordOutboundQueued(static_cast<int64_t>(data.size()), conn.output.size());
+    }
+
+    void dropOutput(Connection& conn) {
+        ServerMetrics::getInstance().recordOutboundQueued(-static_cast<int64_t>(conn.output.size()), 0);
+        conn.output.clear(chunks);
+    }
+
+    // Complete the filter's output for this iteration's batch
+    void finishFilterBatch(int fd, Connection& conn) {
+        if (!conn.filterPending) {
+            return;
+        }
+        conn.filterPending = false;
+        filterScratch.clear();
+        conn.filter->flush(filterScratch);
+        queueOutput(fd, conn, filterScratch);
+    }
+
+    // RECVs that found the submission queue full
+    void retryRecvs() {
+        if (recvRetry.empty()) {
+            return;
+        }
+        std::vector<int> fds;
+        fds.swap(recvRetry);
+        for (int fd : fds) {
+            auto it = connections.find(fd);
+            if (it != connections.end() && !it->second.recvArmed &&
+                !it->second.closing && !it->second.peerClosed) {
+                armRecv(fd, it->second);
+            }
+        }
+    }
+
+    void flushSends() {
+        // Completing a filter batch can queue more dirty fds; take the list
+        // first. Both vectors keep their capacity from one submission to
+        // the next.
+        flushing.swap(dirtyFds);
+        for (int fd : flushing) {
+            auto it = connections.find(fd);
+            if (it == connections.end()) {
+                continue;
+            }
+            Connection& conn = it->second;
+            finishFilterBatch(fd, conn);
+            if (conn.sendInFlight) {
+                continue;
+            }
+            if (conn.output.empty()) {
+                // A filter batch that came to nothing
+                if (conn.onFlushed) {
+                    notifyFlushed(conn);
+                }
+                continue;
+            }
+            armSend(fd, conn);
+        }
+        flushing.clear();
+    }
+
+    // The connection a handle refers to, unless it has since closed
+    ConnectionMap::iterator findConnection(ConnectionHandle handle) {
+        auto it = connections.find(static_cast<int>(handle.slot));
+        if (it != connections.end() && it->second.handle != handle) {
+            return connections.end();
+        }
+        return it;
+    }
+
+    void closeConnection(ConnectionMap::iterator it) {
+        int fd = it->first;
+        ConnectionRegistry::getInstance().remove(it->second.handle);
+        ServerMetrics::getInstance().recordConnectionOutput(it->second.responses,
+                                                            SocketUtils::getDataSegmentsOut(fd));
+        dropOutput(it->second);
+
+        // Shut the socket down so the multishot recv terminates, and cancel
+        // it in case the kernel still holds it
+        shutdown(fd, SHUT_RDWR);
+        cancelOp(OP_RECV, fd, it->second.generation);
+        close(fd);
+        connections.erase(it);
+        connectionCount--;
+    }
+
+    void cancelOp(Op op, int fd, uint32_t generation) {
+        struct io_uring_sqe* sqe = getSqe();
+        if (sqe) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = makeUserData(op, generation, fd);
+            sqe->user_data = makeUserData(OP_CANCEL, 0, fd);
+        }
+    }
+
+    // Cancel accepts, receives and sends. A cancelled send keeps its
+    // output for the next process; a client that stopped reading would
+    // otherwise hold its SENDMSG, and pause(), forever
+    void beginRelease() {
+        releasing = true;
+        for (auto& listener : listeners) {
+            cancelOp(OP_ACCEPT, listener.first, 0);
+        }
+        for (auto& pair : connections) {
+            if (pair.second.recvArmed) {
+                cancelOp(OP_RECV, pair.first, pair.second.generation);
+            }
+            if (pair.second.sendInFlight) {
+                cancelOp(OP_SEND, pair.first, pair.second.generation);
+            }
+        }
+
+        // Backstop for anything the cancellations miss
+        struct io_uring_sqe* sqe = getSqe();
+        if (sqe) {
+            releaseTimeout.tv_sec = RELEASE_DEADLINE_MS / 1000;
+            releaseTimeout.tv_nsec = (RELEASE_DEADLINE_MS % 1000) * 1000000;
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->addr = reinterpret_cast<uint64_t>(&releaseTimeout);
+            sqe->len = 1;
+            sqe->user_data = makeUserData(OP_DEADLINE, 0, 0);
+        }
+    }
+
+    // The release deadline passed with operations still in the kernel. Shut
+    // their sockets down, which completes them; those connections are lost,
+    // but the release goes on
+    void forceRelease() {
+        for (auto& pair : connections) {
+            if (pair.second.recvArmed || pair.second.sendInFlight) {
+                std::cout << "Connection " << pair.first << " did not settle for the release, dropping it" << std::endl;
+                shutdown(pair.first, SHUT_RDWR);
+            }
+        }
+    }
+
+    // Nothing of ours is left in the kernel
+    bool releaseSettled() const {
+        if (activeAccepts > 0) {
+            return false;
+        }
+        for (const auto& pair : connections) {
+            if (pair.second.recvArmed || pair.second.sendInFlight) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void run() {
+        while (running) {
+            if (releasing) {
+                if (releaseSettled()) {
+                    running = false;
+                    break;
+                }
+            } else {
+                retryRecvs();
+                flushSends();
+            }
+
+            int ret = submit(1);
+            if (ret < 0 && errno != EINTR && errno != EBUSY) {
+                perror("io_uring_enter");
+                break;
+            }
+            readyTime = std::chrono::steady_clock::now();
+
+            processCompletions();
+            runTasks();
+        }
+
+        // Drain anything posted during shutdown
+        runTasks();
+    }
+
+    void processCompletions() {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        bool recycled = false;
+
+        while (head != tail) {
+            struct io_uring_cqe* cqe = &cqes[head & cqMask];
+            uint64_t userData = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            head++;
+
+            Op op = static_cast<Op>(userData >> 56);
+            uint32_t generation = static_cast<uint32_t>(userData >> 32) & GENERATION_MASK;
+            int fd = static_cast<int>(static_cast<uint32_t>(userData));
+
+            switch (op) {
+            case OP_WAKE:
+                armWakeup();
+                break;
+            case OP_TIMER:
+                // Timers wait for the next process once a release starts
+                if (!releasing) {
+                    expireTimers();
+                    armTimerRead();
+                }
+                break;
+            case OP_ACCEPT:
+                handleAccept(fd, res, flags);
+                break;
+            case OP_RECV:
+                handleRecv(fd, generation, res, flags);
+                if (flags & IORING_CQE_F_BUFFER) {
+                    addBuffer(static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT));
+                    recycled = true;
+                }
+                break;
+            case OP_SEND:
+                handleSend(fd, generation, res);
+                break;
+            case OP_DEADLINE:
+                if (releasing) {
+                    forceRelease();
+                }
+                break;
+            default:
+                break;
+            }
+        }
+
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        if (recycled) {
+            publishBuffers();
+        }
+    }
+
+    void handleAccept(int listenFd, int res, unsigned flags) {
+        if (!(flags & IORING_CQE_F_MORE)) {
+            activeAccepts--;
+        }
+        auto listener = listeners.find(listenFd);
+        if (listener == listeners.end()) {
+            if (res >= 0) {
+                close(res);
+            }
+            return;
+        }
+
+        if (res >= 0) {
+            ServerMetrics::getInstance().recordAccept(readyTime);
+            listener->second(res);
+        } else if (res != -ECANCELED) {
+            errno = -res;
+            perror("accept");
+        }
+
+        // The kernel ends a multishot accept on error; start a new one
+        if (!(flags & IORING_CQE_F_MORE) && running && !releasing) {
+            armAccept(listenFd);
+        }
+    }
+
+    void handleRecv(int fd, uint32_t generation, int res, unsigned flags) {
+        auto it = connections.find(fd);
+        if (it == connections.end() || it->second.generation != generation) {
+            return;
+        }
+        if (!(flags & IORING_CQE_F_MORE)) {
+            it->second.recvArmed = false;
+        }
+        if (it->second.peerClosed) {
+            return;
+        }
+        // Keep the handler alive while its callbacks run
+        std::shared_ptr<ConnectionHandler> handler = it->second.handler;
+
+        if (res > 0) {
+            uint16_t bid = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+            handler->onData(bufPool + static_cast<size_t>(bid) * BUFFER_SIZE, static_cast<size_t>(res));
+        } else if (res == -ENOBUFS) {
+            // Ran out of provided buffers; fall through and re-arm
+        } else if (res == -ECANCELED && releasing) {
+            // Cancelled by beginRelease(); the socket itself is fine
+            return;
+        } else {
+            // Peer closed the connection or the socket failed
+            it->second.peerClosed = true;
+            handler->onClose();
+            return;
+        }
+
+        it = connections.find(fd);
+        if (it != connections.end() && it->second.generation == generation &&
+            !it->second.closing && !(flags & IORING_CQE_F_MORE)) {
+            armRecv(fd, it->second);
+        }
+    }
+
+    void handleSend(int fd, uint32_t generation, int res) {
+        auto it = connections.find(fd);
+        if (it == connections.end() || it->second.generation != generation) {
+            return;
+        }
+        Connection& conn = it->second;
+        conn.sendInFlight = false;
+
+        if (res == -ECANCELED && releasing) {
+            // Cancelled by beginRelease() before any of it went out; the
+            // whole output goes to the next process
+            return;
+        }
+
+        // Still over the high-water mark: queueOutput() gave up on this
+        // client but had to leave the chunks to the kernel until now
+        if (res < 0 || conn.output.size() > outboundHighWaterMark) {
+            dropOutput(conn);
+            if (conn.closing) {
+                closeConnection(it);
+            } else if (!conn.peerClosed) {
+                conn.peerClosed = true;
+                std::shared_ptr<ConnectionHandler> handler = conn.handler;
+                handler->onClose();
+            }
+            return;
+        }
+
+        conn.output.consume(chunks, static_cast<size_t>(res));
+        ServerMetrics::getInstance().recordOutboundQueued(-static_cast<int64_t>(res), 0);
+        if (releasing) {
+            // Whatever is left, the rest of a send cut short by
+            // beginRelease() included, goes to the next process
+            return;
+        }
+        if (!conn.output.empty()) {
+            // The rest of a short send, or what was queued behind it
+            armSend(fd, conn);
+        } else if (conn.closing) {
+            closeConnection(it);
+        } else if (conn.onFlushed) {
+            notifyFlushed(conn);
+        }
+    }
+
+    // Run the whenFlushed() callback as a task, so it never runs inside
+    // completion handling; it is dropped if the connection is gone by then
+    void notifyFlushed(Connection& conn) {
+        std::function<void()> callback = std::move(conn.onFlushed);
+        conn.onFlushed = nullptr;
+        ConnectionHandle handle = conn.handle;
+        post([this, handle, callback]() {
+            if (findConnection(handle) != connections.end()) {
+                callback();
+            }
+        });
+    }
+
+private:
+    int ringFd;
+    int wakeFd;
+    uint64_t wakeValue;
+    uint64_t timerValue;
+    struct __kernel_timespec releaseTimeout; // the release deadline
+    bool releasing;      // pause() in progress: no new accepts, receives or sends
+    int activeAccepts;   // multishot accepts the kernel still holds
+
+    // Mapped ring state
+    void* sqRingPtr;
+    void* cqRingPtr;
+    struct io_uring_sqe* sqes;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    size_t sqesSize;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqArray;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned sqLocalTail;
+    unsigned toSubmit;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe* cqes;
+
+    // Provided receive buffers. Indexed as a plain array because C++ lays
+    // out io_uring_buf_ring's flexible array member at the wrong offset.
+    struct io_uring_buf* bufRing;
+    char* bufPool;
+    uint16_t bufRingTail;
+
+    // Owned by the loop thread. The pools come first so they outlive
+    // everything that holds their memory.
+    ChunkPool chunks;         // output queues
+    SlabPool connectionSlab;  // nodes of connections
+    ConnectionMap connections;
+    std::unordered_map<int, AcceptCallback> listeners;
+    std::vector<int> dirtyFds;
+    std::vector<int> flushing;  // dirtyFds being flushed
+    std::vector<int> recvRetry; // RECVs to arm once the submission queue has room
+    std::string filterScratch;  // output filter result, reused
+    uint32_t nextGeneration;
+    std::chrono::steady_clock::time_point readyTime; // when the loop last woke
+};
+
+#endif //URINGREACTOR_H
@@ -3,16 +3,21 @@
 
 #include <string>
 #include <vector>
+#include <unordered_map>
 #include <unordered_set>
 #include <memory>
 #include <atomic>
 #include <mutex>
 #include <fstream>
+#include <sstream>
 #include <filesystem>
 #include <iostream>
 #include <thread>
 #include <chrono>
 
+#include "Reactor.h"
+#include "ResponseBuffer.h"
+
 class User {
 private:
     std::string username;
@@ -24,7 +29,7 @@ private:
     bool isQuiet;
     std::unordered_set<std::string> blockedUsers;
     std::mutex userMutex;
-    int clientSocket;
+    std::atomic<uint64_t> connection; // packed ConnectionHandle; read from any thread
     bool isGuest;
     bool isPlaying;
     bool isObserving;
@@ -33,9 +38,9 @@ private:
 public:
 
 
-    User(const std::string& username, const std::string& password, int socket)
+    User(const std::string& username, const std::string& password, ConnectionHandle conn)
         : username(username), password(password), info(""), wins(0), losses(0), rating(1500.0f),
-          isQuiet(false), clientSocket(socket), isGuest(username == "guest"),
+          isQuiet(false), connection(conn.pack()), isGuest(username == "guest"),
           isPlaying(false), isObserving(false), gameId(-1) {
 
           }
@@ -43,7 +48,7 @@ public:
     // Getters and setters
     std::string getPassword() const { return password; }
 
-    std::string getUsername() const { return username; }
+    const std::string& getUsername() const { return username; }  // never changes
     bool checkPassword(const std::string& pwd) const { return password == pwd; }
     void setPassword(const std::string& pwd) { password = pwd; }
     void setInfo(const std::string& newInfo) { info = newInfo; }
@@ -53,8 +58,9 @@ public:
     float getRating() const { return rating; }
     bool isInQuietMode() const { return isQuiet; }
     void setQuietMode(bool quiet) { isQuiet = quiet; }
-    int getSocket() const { return clientSocket; }
-    void setSocket(int socket) { clientSocket = socket; }
+    // Connection the user is logged in on; invalid while offline
+    ConnectionHandle getConnection() const { return ConnectionHandle::unpack(connection.load()); }
+    void setConnection(ConnectionHandle conn) { connection = conn.pack(); }
     bool isUserGuest() const { return isGuest; }
     bool isInGame() const { return isPlaying; }
     void setPlaying(bool playing) { isPlaying = playing; }
@@ -105,8 +111,9 @@ private:
 class UserManager {
 private:
     std::unordered_map<std::string, std::shared_ptr<User>> users;
-    std::unordered_map<int, std::string> socketToUser;
+    std::unordered_map<ConnectionHandle, std::string> connectionToUser;
     std::mutex usersMutex;
+    std::mutex saveMutex;  // one save writes users_data.txt at a time
     std::thread autosaveThread;
     std::atomic<bool> running;
 
@@ -124,7 +131,7 @@ private:
     // Private constructor for singleton
     UserManager() : running(true){
         // Create default guest account
-        users["guest"] = std::make_shared<User>("guest", "", -1);
+        users["guest"] = std::make_shared<User>("guest", "", ConnectionHandle());
 
         // Load existing users
         loadUsers();
@@ -149,18 +156,19 @@ public:
     }
 
     // User registration and login
-    bool registerUser(const std::string& username, const std::string& password, int socket) {
-        std::lock_guard<std::mutex> lock(usersMutex);
-
-        // Check if username already exists
-        if (users.find(username) != users.end()) {
-            return false;
-        }
+    bool registerUser(const std::string& username, const std::string& password, ConnectionHandle conn) {
+        {
+            std::lock_guard<std::mutex> lock(usersMutex);
 
-        // Create new user
-        users[username] = std::make_shared<User>(username, password, socket);
-        socketToUser[socket] = username;
+            // Check if username already exists
+            if (users.find(username) != users.end()) {
+                return false;
+            }
 
+            // Create new user
+            users[username] = std::make_shared<User>(username, password, conn);
+            connectionToUser[conn] = username;
+        }
 
         // Save user data to disk
         std::cout << "calling save users" << std::endl;
@@ -170,7 +178,7 @@ public:
         return true;
     }
 
-    bool loginUser(const std::string& username, const std::string& password, int socket) {
+    bool loginUser(const std::string& username, const std::string& password, ConnectionHandle conn) {
         std::lock_guard<std::mutex> lock(usersMutex);
 
         auto it = users.find(username);
@@ -178,37 +186,52 @@ public:
             return false;
         }
 
-        // Update socket and track connection
-        it->second->setSocket(socket);
-        socketToUser[socket] = username;
+        // Update and track the user's connection
+        it->second->setConnection(conn);
+        connectionToUser[conn] = username;
 
         return true;
     }
 
-    bool loginGuest(int socket) {
+    bool loginGuest(ConnectionHandle conn) {
         std::lock_guard<std::mutex> lock(usersMutex);
-        socketToUser[socket] = "guest";
+        connectionToUser[conn] = "guest";
         return true;
     }
 
-    void logoutUser(int socket) {
+    // Put a session carried over by a hot restart back on its new connection
+    void resumeSession(const std::string& username, ConnectionHandle conn) {
+        std::lock_guard<std::mutex> lock(usersMutex);
+
+        auto it = users.find(username);
+        if (it == users.end()) {
+            return;
+        }
+        // Guests share one account, as in loginGuest()
+        if (username != "guest") {
+            it->second->setConnection(conn);
+        }
+        connectionToUser[conn] = username;
+    }
+
+    void logoutUser(ConnectionHandle conn) {
         std::lock_guard<std::mutex> lock(usersMutex);
 
-        auto it = socketToUser.find(socket);
-        if (it != socketToUser.end()) {
+        auto it = connectionToUser.find(conn);
+        if (it != connectionToUser.end()) {
             std::string username = it->second;
             if (username != "guest" && users.find(username) != users.end()) {
-                users[username]->setSocket(-1); // Mark as disconnected
+                users[username]->setConnection(ConnectionHandle()); // Mark as disconnected
             }
-            socketToUser.erase(it);
+            connectionToUser.erase(it);
         }
     }
 
-    std::string getUsernameBySocket(int socket) {
+    std::string getUsernameByConnection(ConnectionHandle conn) {
         std::lock_guard<std::mutex> lock(usersMutex);
 
-        auto it = socketToUser.find(socket);
-        if (it != socketToUser.end()) {
+        auto it = connectionToUser.find(conn);
+        if (it != connectionToUser.end()) {
             return it->second;
         }
         return "";
@@ -224,8 +247,8 @@ public:
         return nullptr;
     }
 
-    std::shared_ptr<User> getUserBySocket(int socket) {
-        std::string username = getUsernameBySocket(socket);
+    std::shared_ptr<User> getUserByConnection(ConnectionHandle conn) {
+        std::string username = getUsernameByConnection(conn);
         if (!username.empty()) {
             return getUserByUsername(username);
         }
@@ -236,7 +259,7 @@ public:
         std::lock_guard<std::mutex> lock(usersMutex);
 
         std::vector<std::shared_ptr<User>> result;
-        for (const auto& pair : socketToUser) {
+        for (const auto& pair : connectionToUser) {
             std::string username = pair.second;
             if (username != "guest" && users.find(username) != users.end()) {
                 result.push_back(users[username]);
@@ -247,16 +270,14 @@ public:
 
 // Replace the saveUsers() and loadUsers() functions in User.h with these improved versions
 
+// The table is locked only while it is copied out; the file is written
+// after, so logins and lookups never wait on the disk
 void saveUsers() {
-    std::lock_guard<std::mutex> lock(usersMutex);
+    std::lock_guard<std::mutex> saveLock(saveMutex);
 
     try {
-        // Open file for writing
-        std::ofstream file("users_data.txt");
-        if (!file.is_open()) {
-            std::cerr << "Failed to open users_data.txt for writing" << std::endl;
-            return;
-        }
+        std::ostringstream file;
+        std::unique_lock<std::mutex> lock(usersMutex);
 
         // Write each user (except guest)
         for (const auto& pair : users) {
@@ -286,8 +307,16 @@ void saveUsers() {
 
             file << "USER_END\n";
         }
+        lock.unlock();
 
-        file.close();
+        // Open file for writing
+        std::ofstream out("users_data.txt");
+        if (!out.is_open()) {
+            std::cerr << "Failed to open users_data.txt for writing" << std::endl;
+            return;
+        }
+        out << file.str();
+        out.close();
         std::cout << "User data saved successfully to users_data.txt" << std::endl;
     }
     catch (const std::exception& e) {
@@ -328,7 +357,7 @@ void loadUsers() {
             else if (line == "USER_END") {
                 if (inUserSection && !username.empty()) {
                     // Create user and add to map
-                    auto user = std::make_shared<User>(username, password, -1);
+                    auto user = std::make_shared<User>(username, password, ConnectionHandle());
                     user->setInfo(info);
                     user->setQuietMode(isQuiet);
 
@@ -429,54 +458,61 @@ bool changePassword(const std::string& username, const std::string& newPassword)
 }
 
 // Add this method since it's used in TelnetClientHandler
-std::string getOnlineUsersList() {
-    std::lock_guard<std::mutex> lock(usersMutex);
-
-    // Count regular users
-    std::vector<std::shared_ptr<User>> onlineRegularUsers;
-    for (const auto& pair : socketToUser) {
-        std::string username = pair.second;
-        if (username != "guest" && users.find(username) != users.end()) {
-            onlineRegularUsers.push_back(users[username]);
-        }
-    }
-
-    // Count guest connections
+// Only the lookups hold the lock; the list is written after
+void appendOnlineUsers(std::string& out) {
+    // Reused between calls, and emptied before returning so no user is
+    // kept alive by it
+    thread_local std::vector<std::shared_ptr<User>> onlineRegularUsers;
     int guestCount = 0;
-    for (const auto& pair : socketToUser) {
-        if (pair.second == "guest") {
-            guestCount++;
+    {
+        std::lock_guard<std::mutex> lock(usersMutex);
+        for (const auto& pair : connectionToUser) {
+            if (pair.second == "guest") {
+                guestCount++;
+                continue;
+            }
+            auto it = users.find(pair.second);
+            if (it != users.end()) {
+                onlineRegularUsers.push_back(it->second);
+            }
         }
     }
 
-    // If no one is online (neither guests nor regular users), return a message
+    // If no one is online (neither guests nor regular users), say so
     if (onlineRegularUsers.empty() && guestCount == 0) {
-        return "No users online.";
+        out += "No users online.";
+        return;
     }
 
-    std::string result = "Online users:\n";
+    out += "Online users:\n";
 
     // Add regular users to the list
     for (const auto& user : onlineRegularUsers) {
-        result += "- " + user->getUsername();
+        out += "- ";
+        out += user->getUsername();
         if (user->isInGame()) {
-            result += " (playing in game " + std::to_string(user->getGameId()) + ")";
+            out += " (playing in game ";
+            ResponseBuffer::appendInt(out, user->getGameId());
+            out += ')';
         } else if (user->isUserObserving()) {
-            result += " (observing game " + std::to_string(user->getGameId()) + ")";
+            out += " (observing game ";
+            ResponseBuffer::appendInt(out, user->getGameId());
+            out += ')';
         }
-        result += "\n";
+        out += '\n';
     }
+    onlineRegularUsers.clear();
 
     // Add guests to the list
     if (guestCount > 0) {
         if (guestCount == 1) {
-            result += "- 1 guest\n";
+            out += "- 1 guest\n";
         } else {
-            result += "- " + std::to_string(guestCount) + " guests\n";
+            out += "- ";
+            ResponseBuffer::appendInt(out, guestCount);
+            out += " guests\n";
         }
     }
-
-    return result;
 }
 };
 
@@ -0,0 +1,389 @@
+#ifndef WEBSOCKETPROTOCOL_H
+#define WEBSOCKETPROTOCOL_H
+
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+#include "Reactor.h"
+#include "Snapshot.h"
+
+// WebSocket constants (RFC 6455)
+namespace WebSocket {
+    const unsigned char OP_CONTINUATION = 0x0;
+    const unsigned char OP_TEXT = 0x1;
+    const unsigned char OP_BINARY = 0x2;
+    const unsigned char OP_CLOSE = 0x8;
+    const unsigned char OP_PING = 0x9;
+    const unsigned char OP_PONG = 0xA;
+
+    const unsigned char FIN = 0x80;
+    const unsigned char MASKED = 0x80;
+
+    // Close status codes
+    const uint16_t CLOSE_NORMAL = 1000;
+    const uint16_t CLOSE_PROTOCOL_ERROR = 1002;
+    const uint16_t CLOSE_TOO_BIG = 1009;
+
+    const char* const ACCEPT_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+    // Sec-WebSocket-Accept value for a client's Sec-WebSocket-Key
+    inline std::string acceptKey(const std::string& key) {
+        std::string input = key + ACCEPT_GUID;
+        unsigned char digest[SHA_DIGEST_LENGTH];
+        SHA1(reinterpret_cast<const unsigned char*>(input.data()), input.size(), digest);
+        unsigned char encoded[4 * ((SHA_DIGEST_LENGTH + 2) / 3) + 1];
+        int length = EVP_EncodeBlock(encoded, digest, SHA_DIGEST_LENGTH);
+        return std::string(reinterpret_cast<char*>(encoded), length);
+    }
+
+    // Append a frame header for an unmasked (server to client) frame
+    inline void appendHeader(std::string& out, unsigned char opcode, uint64_t length) {
+        out += static_cast<char>(FIN | opcode);
+        if (length < 126) {
+            out += static_cast<char>(length);
+        } else if (length <= 0xFFFF) {
+            out += static_cast<char>(126);
+            out += static_cast<char>(length >> 8);
+            out += static_cast<char>(length);
+        } else {
+            out += static_cast<char>(127);
+            for (int shift = 56; shift >= 0; shift -= 8) {
+                out += static_cast<char>(length >> shift);
+            }
+        }
+    }
+}
+
+// Incremental WebSocket server-side parser. Handles the HTTP upgrade
+// request, then frames. Like TelnetParser it never copies payload: data
+// frames are handed to the listener as runs pointing into the received
+// chunk together with the masking key, so the listener can unmask while
+// copying into its own buffer. Only control frame payloads (at most 125
+// bytes) are collected here.
+class WebSocketParser {
+public:
+    // Receives the parser's output
+    class Listener {
+    public:
+        virtual ~Listener() {}
+
+        // The upgrade request was read; response is the HTTP reply to send
+        // before any frames
+        virtual void onWebSocketHandshake(bool accepted, const std::string& response) = 0;
+
+        // Masked payload bytes of a text or binary message. Byte i is
+        // unmasked with mask[(phase + i) % 4].
+        virtual void onWebSocketData(const char* data, size_t len, const unsigned char* mask, size_t phase) = 0;
+
+        // The last frame of a message has been passed on
+        virtual void onWebSocketMessageEnd() = 0;
+
+        // Ping, pong or close from the client, already unmasked
+        virtual void onWebSocketControl(unsigned char opcode, const std::string& payload) = 0;
+
+        // The client broke the protocol; close with this status code
+        virtual void onWebSocketError(uint16_t closeCode) = 0;
+    };
+
+    WebSocketParser() : state(STATE_HANDSHAKE), headerLen(0), opcode(0), fin(false),
+                        inMessage(false), remaining(0), offset(0) {
+        memset(header, 0, sizeof(header));
+        memset(mask, 0, sizeof(mask));
+    }
+
+    bool isOpen() const { return state == STATE_HEADER || state == STATE_PAYLOAD; }
+
+    // Parser position, down to a half-read frame, for a hot restart
+    void saveState(SnapshotWriter& out) const {
+        out.putU8(static_cast<uint8_t>(state));
+        out.putString(request);
+        out.putBytes(header, sizeof(header));
+        out.putU8(static_cast<uint8_t>(headerLen));
+        out.putU8(opcode);
+        out.putBool(fin);
+        out.putBool(inMessage);
+        out.putBytes(mask, sizeof(mask));
+        out.putI64(static_cast<int64_t>(remaining));
+        out.putI64(static_cast<int64_t>(offset));
+        out.putString(control);
+    }
+
+    void restoreState(SnapshotReader& in) {
+        state = static_cast<State>(in.getU8());
+        request = in.getString();
+        in.getBytes(header, sizeof(header));
+        headerLen = in.getU8();
+        opcode = in.getU8();
+        fin = in.getBool();
+        inMessage = in.getBool();
+        in.getBytes(mask, sizeof(mask));
+        remaining = static_cast<uint64_t>(in.getI64());
+        offset = static_cast<uint64_t>(in.getI64());
+        control = in.getString();
+    }
+
+    void parse(const char* data, size_t len, Listener& listener) {
+        const char* p = data;
+        const char* end = data + len;
+
+        if (state == STATE_HANDSHAKE) {
+            p = readHandshake(p, end, listener);
+        }
+
+        while (p < end && isOpen()) {
+            if (state == STATE_HEADER) {
+                p = readHeader(p, end, listener);
+                continue;
+            }
+
+            size_t chunk = static_cast<size_t>(end - p);
+            if (chunk > remaining) {
+                chunk = static_cast<size_t>(remaining);
+            }
+            if (isControl()) {
+                for (size_t i = 0; i < chunk; i++) {
+                    control += static_cast<char>(p[i] ^ mask[(offset + i) & 3]);
+                }
+            } else if (chunk > 0) {
+                listener.onWebSocketData(p, chunk, mask, static_cast<size_t>(offset & 3));
+            }
+            p += chunk;
+            offset += chunk;
+            remaining -= chunk;
+            if (remaining == 0) {
+                endFrame(listener);
+            }
+        }
+    }
+
+private:
+    enum State { STATE_HANDSHAKE, STATE_HEADER, STATE_PAYLOAD, STATE_CLOSED };
+
+    static const size_t MAX_REQUEST = 8192;
+    static const uint64_t MAX_FRAME = 1 << 20;  // larger frames are refused
+
+    bool isControl() const { return (opcode & 0x8) != 0; }
+
+    // Collect the HTTP request; returns where the frames start
+    const char* readHandshake(const char* p, const char* end, Listener& listener) {
+        size_t before = request.size();
+        request.append(p, static_cast<size_t>(end - p));
+        size_t headerEnd = request.find("\r\n\r\n");
+        if (headerEnd == std::string::npos) {
+            if (request.size() > MAX_REQUEST) {
+                reject(listener);
+            }
+            return end;
+        }
+
+        std::string key;
+        if (!checkRequest(request.substr(0, headerEnd), key)) {
+            reject(listener);
+            return end;
+        }
+
+        std::string response = "HTTP/1.1 101 Switching Protocols\r\n"
+                               "Upgrade: websocket\r\n"
+                               "Connection: Upgrade\r\n"
+                               "Sec-WebSocket-Accept: " + WebSocket::acceptKey(key) + "\r\n\r\n";
+        request.clear();
+        request.shrink_to_fit();
+        state = STATE_HEADER;
+        listener.onWebSocketHandshake(true, response);
+
+        // Anything after the blank line is already framed
+        return p + (headerEnd + 4 - before);
+    }
+
+    void reject(Listener& listener) {
+        state = STATE_CLOSED;
+        listener.onWebSocketHandshake(false, "HTTP/1.1 400 Bad Request\r\n"
+                                             "Sec-WebSocket-Version: 13\r\n"
+                                             "Connection: close\r\n"
+                                             "Content-Length: 0\r\n\r\n");
+    }
+
+    static std::string lower(std::string text) {
+        for (char& c : text) {
+            c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        }
+        return text;
+    }
+
+    // A GET with Upgrade: websocket, version 13 and a key
+    static bool checkRequest(const std::string& head, std::string& key) {
+        if (head.compare(0, 4, "GET ") != 0) {
+            return false;
+        }
+        bool upgrade = false, connection = false, version = false;
+        size_t pos = head.find("\r\n");
+        while (pos != std::string::npos) {
+            size_t start = pos + 2;
+            pos = head.find("\r\n", start);
+            std::string line = head.substr(start, pos == std::string::npos ? std::string::npos : pos - start);
+            size_t colon = line.find(':');
+            if (colon == std::string::npos) {
+                continue;
+            }
+            std::string name = lower(line.substr(0, colon));
+            size_t valueStart = line.find_first_not_of(" \t", colon + 1);
+            size_t valueEnd = line.find_last_not_of(" \t");
+            std::string value = valueStart == std::string::npos ? "" : line.substr(valueStart, valueEnd - valueStart + 1);
+
+            if (name == "upgrade") {
+                upgrade = lower(value).find("websocket") != std::string::npos;
+            } else if (name == "connection") {
+                connection = lower(value).find("upgrade") != std::string::npos;
+            } else if (name == "sec-websocket-version") {
+                version = value == "13";
+            } else if (name == "sec-websocket-key") {
+                key = value;
+            }
+        }
+        return upgrade && connection && version && !key.empty();
+    }
+
+    // Collect the 2-14 header bytes of a frame
+    const char* readHeader(const char* p, const char* end, Listener& listener) {
+        while (p < end) {
+            header[headerLen++] = static_cast<unsigned char>(*p++);
+            if (headerLen == 2 && !(header[1] & WebSocket::MASKED)) {
+                // Clients must mask; without a key the header size is wrong too
+                fail(WebSocket::CLOSE_PROTOCOL_ERROR, listener);
+                break;
+            }
+            if (headerLen < 2 || headerLen < headerSize()) {
+                continue;
+            }
+            startFrame(listener);
+            break;
+        }
+        return p;
+    }
+
+    size_t headerSize() const {
+        unsigned char length = header[1] & 0x7F;
+        return 2 + (length == 126 ? 2 : length == 127 ? 8 : 0) + 4;
+    }
+
+    void startFrame(Listener& listener) {
+        headerLen = 0;
+        unsigned char op = header[0] & 0x0F;
+        bool final = (header[0] & WebSocket::FIN) != 0;
+
+        uint64_t length = header[1] & 0x7F;
+        size_t pos = 2;
+        if (length == 126) {
+            length = (static_cast<uint64_t>(header[2]) << 8) | header[3];
+            pos = 4;
+        } else if (length == 127) {
+            length = 0;
+            for (int i = 0; i < 8; i++) {
+                length = (length << 8) | header[2 + i];
+            }
+            pos = 10;
+        }
+        memcpy(mask, header + pos, 4);
+
+        // No extensions, no fragmented control frames, and data messages
+        // must not interleave
+        bool controlFrame = (op & 0x8) != 0;
+        if ((header[0] & 0x70) ||
+            (op > WebSocket::OP_BINARY && op < WebSocket::OP_CLOSE) || op > WebSocket::OP_PONG ||
+            (controlFrame && (!final || length > 125)) ||
+            (!controlFrame && (op == WebSocket::OP_CONTINUATION) != inMessage)) {
+            fail(WebSocket::CLOSE_PROTOCOL_ERROR, listener);
+            return;
+        }
+        if (length > MAX_FRAME) {
+            fail(WebSocket::CLOSE_TOO_BIG, listener);
+            return;
+        }
+
+        opcode = op;
+        fin = final;
+        remaining = length;
+        offset = 0;
+        if (!controlFrame) {
+            inMessage = !final;
+        }
+        control.clear();
+        state = STATE_PAYLOAD;
+        if (remaining == 0) {
+            endFrame(listener);
+        }
+    }
+
+    void endFrame(Listener& listener) {
+        state = STATE_HEADER;
+        if (isControl()) {
+            if (opcode == WebSocket::OP_CLOSE) {
+                state = STATE_CLOSED;
+            }
+            listener.onWebSocketControl(opcode, control);
+        } else if (fin) {
+            listener.onWebSocketMessageEnd();
+        }
+    }
+
+    void fail(uint16_t closeCode, Listener& listener) {
+        state = STATE_CLOSED;
+        listener.onWebSocketError(closeCode);
+    }
+
+private:
+    State state;
+    std::string request;      // Upgrade request collected so far
+    unsigned char header[14]; // Frame header collected so far
+    size_t headerLen;
+
+    // Frame being read
+    unsigned char opcode;
+    bool fin;
+    bool inMessage;           // A fragmented data message is in progress
+    unsigned char mask[4];
+    uint64_t remaining;       // Payload bytes still to come
+    uint64_t offset;          // Payload bytes already seen
+    std::string control;      // Unmasked control frame payload
+};
+
+// Output side of a WebSocket connection. Everything the server sends in
+// one loop iteration goes out as a single text frame; control frames
+// queued with sendControl() follow it.
+class WebSocketFilter : public OutputFilter {
+private:
+    std::string message;   // Text for the frame being built
+    std::string controls;  // Complete control frames
+
+public:
+    void write(std::string_view data, std::string&) override {
+        message += data;
+    }
+
+    void flush(std::string& out) override {
+        if (!message.empty()) {
+            WebSocket::appendHeader(out, WebSocket::OP_TEXT, message.size());
+            out += message;
+            message.clear();
+        }
+        out += controls;
+        controls.clear();
+    }
+
+    void finish(std::string& out) override {
+        flush(out);
+    }
+
+    // Queue a ping, pong or close; it goes out with the next flush
+    void sendControl(unsigned char opcode, const std::string& payload) {
+        WebSocket::appendHeader(controls, opcode, payload.size());
+        controls += payload;
+    }
+};
+
+#endif //WEBSOCKETPROTOCOL_H
@@ -0,0 +1,45 @@
+# Text commands answered per second of server CPU, end to end: a guest
+# pipelines one command and the server's user plus system time is read
+# from /proc before and after.
+#
+#     taskset -c 0 ./gomoku_server --threads 1 --command-rate 0 --chat-rate 0 &
+#     python3 bench/command_rate.py $! [commands] [command]
+#
+# The command defaults to "game"; any line works, an unknown verb
+# included, as long as each reply ends in one CRLF.
+import sys
+import time
+
+import server
+
+BATCH = 500
+IN_FLIGHT = 2000
+
+
+def main():
+    pid = int(sys.argv[1])
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 1000000
+    command = (sys.argv[3] if len(sys.argv) > 3 else 'game').encode()
+
+    sock = server.telnet()
+    sock.settimeout(None)
+    batch = (command + b'\r\n') * BATCH
+
+    cpu_before = server.cpu_seconds(pid)
+    started = time.time()
+    sent = 0
+    answered = 0
+    while answered < count:
+        if sent < count and sent - answered < IN_FLIGHT:
+            sock.sendall(batch)
+            sent += BATCH
+        answered += sock.recv(1 << 20).count(b'\r\n')
+    elapsed = time.time() - started
+    cpu = server.cpu_seconds(pid) - cpu_before
+
+    print('%s: %d commands in %.2f s (%.0f/s), server CPU %.2f s, %.0f commands per CPU second'
+          % (command.decode(), count, elapsed, count / elapsed, cpu, count / cpu))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,104 @@
+// Text command dispatch alone, without the session or any command: split
+// a line, try it as a move, look the verb up. The table path is
+// CommandTable; the other is the interpreter it replaced, rebuilt here as
+// it was (a std::regex and an istringstream per line, then a chain of
+// string compares), so the two can be compared on the same lines.
+//
+//     make bench/dispatch_bench
+//     taskset -c 0 bench/dispatch_bench [lines]
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../CommandTable.h"
+
+// The old if/else chain, in its order
+static const char* const OLD_VERBS[] = {
+    "login", "testsave", "quiet", "info", "nonquiet", "listmail", "readmail", "deletemail", "mail",
+    "guest", "block", "unblock", "register", "exit", "quit", "help", "?", "game", "match", "resign",
+    "refresh", "observe", "unobserve", "who", "shout", "tell", "kibitz", "'", "stats", "passwd"
+};
+
+// Both return a number that depends on what the line parsed to, so
+// neither can be optimised away
+static int oldDispatch(const std::string& command)
+{
+    std::istringstream iss(command);
+    std::vector<std::string> tokens;
+    std::string token;
+    std::regex moveAttemptPattern("^([A-Za-z])([0-9]+)$");
+    std::smatch moveAttemptMatches;
+
+    while (iss >> token) {
+        tokens.push_back(token);
+    }
+    if (tokens.empty()) {
+        return -1;
+    }
+
+    std::string cmd = tokens[0];
+    std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::tolower);
+    if (std::regex_match(cmd, moveAttemptMatches, moveAttemptPattern)) {
+        int row = std::stoi(moveAttemptMatches[2].str());
+        return 100 + row + (toupper(moveAttemptMatches[1].str()[0]) - 'A');
+    }
+    for (size_t i = 0; i < sizeof(OLD_VERBS) / sizeof(OLD_VERBS[0]); i++) {
+        if (cmd == OLD_VERBS[i]) {
+            return static_cast<int>(i + tokens.size());
+        }
+    }
+    return -2;
+}
+
+static int tableDispatch(const std::string& command, std::vector<std::string_view>& tokens)
+{
+    CommandTable::split(command, tokens);
+    if (tokens.empty()) {
+        return -1;
+    }
+
+    int row, col;
+    MoveSyntax move = CommandTable::parseMove(tokens[0], row, col);
+    if (move == MoveSyntax::VALID) {
+        return 100 + row + col;
+    }
+    if (move != MoveSyntax::NOT_A_MOVE) {
+        return 99;
+    }
+    const CommandTable::Spec* spec = CommandTable::find(tokens[0]);
+    if (!spec) {
+        return -2;
+    }
+    return static_cast<int>(spec->command) + static_cast<int>(tokens.size());
+}
+
+int main(int argc, char* argv[])
+{
+    const std::vector<std::string> lines = {
+        "who", "H8", "shout hello everybody", "tell bob hi there", "refresh",
+        "o15", "match alice b 600", "unobserve", "readmail 3", "xyzzy"
+    };
+    int count = argc > 1 ? atoi(argv[1]) : 200000;
+    std::vector<std::string_view> tokens;
+
+    for (int table = 0; table < 2; table++) {
+        long sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < count; i++) {
+            const std::string& line = lines[i % lines.size()];
+            sum += table ? tableDispatch(line, tokens) : oldDispatch(line);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("%-36s %12.0f commands/s %10.1f ns each  (checksum %ld)\n",
+               table ? "command table:" : "regex + istringstream + if chain:",
+               count / seconds, seconds / count * 1e9, sum);
+    }
+    return 0;
+}
@@ -0,0 +1,116 @@
+// Game board costs, through Game's own interface: creating a game,
+// probing a cell, replaying random games through makeMove with eight
+// isPositionEmpty probes before each move, as a client checking cells
+// would, and checkWin on every stone of 100-stone positions.
+//
+//     make bench/game_bench
+//     taskset -c 0 bench/game_bench [games]
+//
+// Game.h is taken from BENCH_INCLUDE (the tree by default), so the same
+// program measures an older layout built from another checkout:
+//
+//     git worktree add /tmp/before <commit>
+//     make -B bench/game_bench BENCH_INCLUDE=/tmp/before
+//
+// Add BENCH_OPT=-O0 to either for the server's own build flags.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "Game.h"
+
+static double nanosecondsSince(std::chrono::steady_clock::time_point start, long count)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / count * 1e9;
+}
+
+int main(int argc, char* argv[])
+{
+    int games = argc > 1 ? atoi(argv[1]) : 20000;
+    auto black = std::make_shared<User>("black", "pw", ConnectionHandle());
+    auto white = std::make_shared<User>("white", "pw", ConnectionHandle());
+
+    const long CREATES = 1000000;
+    long checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < CREATES; i++) {
+        Game game(static_cast<int>(i), black, white);
+        checksum += game.getId();
+    }
+    printf("create a Game          %8.1f ns\n", nanosecondsSince(start, CREATES));
+
+    // Off-board cells included, which isPositionEmpty also answers
+    const long PROBES = 50000000;
+    {
+        Game game(1, black, white);
+        start = std::chrono::steady_clock::now();
+        for (long k = 0; k < PROBES; k++) {
+            checksum += game.isPositionEmpty(static_cast<int>((k * 7) % 17) - 1, static_cast<int>((k * 11) % 17) - 1);
+        }
+        printf("isPositionEmpty        %8.2f ns\n", nanosecondsSince(start, PROBES));
+    }
+
+    // The same 256 move orders every run; a game ends at five in a row
+    std::mt19937 rng(7);
+    std::vector<std::vector<int>> orders(256);
+    for (auto& order : orders) {
+        for (int cell = 0; cell < 225; cell++) {
+            order.push_back(cell);
+        }
+        std::shuffle(order.begin(), order.end(), rng);
+    }
+
+    long moves = 0;
+    start = std::chrono::steady_clock::now();
+    for (int g = 0; g < games; g++) {
+        // Clocks long enough never to run out
+        Game game(g, black, white, 1 << 30);
+        const std::vector<int>& order = orders[g & 255];
+        for (int i = 0; i < 225 && game.getStatus() == GameStatus::PLAYING; i++) {
+            for (int k = 0; k < 8; k++) {
+                int cell = order[(i + k * 29) % 225];
+                checksum += game.isPositionEmpty(cell / 15, cell % 15);
+            }
+            auto player = game.getCurrentTurn() == StoneColor::BLACK ? black : white;
+            if (game.makeMove(player, order[i] / 15, order[i] % 15)) {
+                moves++;
+            }
+        }
+    }
+    printf("makeMove + 8 probes    %8.1f ns  (%ld moves in %d games)\n", nanosecondsSince(start, moves), moves, games);
+
+    // Stones placed through makeMove, so the game stops short of 100 if
+    // someone wins first
+    long checks = 0;
+    double seconds = 0;
+    std::vector<int> cells = orders[0];
+    for (int position = 0; position < 200; position++) {
+        Game game(position, black, white, 1 << 30);
+        std::shuffle(cells.begin(), cells.end(), rng);
+        int placed = 0;
+        for (int i = 0; i < 225 && placed < 100 && game.getStatus() == GameStatus::PLAYING; i++) {
+            auto player = game.getCurrentTurn() == StoneColor::BLACK ? black : white;
+            if (game.makeMove(player, cells[i] / 15, cells[i] % 15)) {
+                placed++;
+            }
+        }
+        start = std::chrono::steady_clock::now();
+        for (int k = 0; k < 20000; k++) {
+            for (int cell : cells) {
+                if (game.getCell(cell / 15, cell % 15) != '.') {
+                    checksum += game.checkWin(cell / 15, cell % 15);
+                    checks++;
+                }
+            }
+        }
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    printf("checkWin, 100 stones   %8.1f ns\n", seconds / checks * 1e9);
+    printf("checksum %ld\n", checksum);
+    return 0;
+}
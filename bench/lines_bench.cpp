@@ -0,0 +1,233 @@
+// The Lines kernels on their own. First checks them against a brute-force
+// walk over random boards of 5-95% density, then times them on 1024 boards
+// at 35% density next to the cell-by-cell walk that Game::checkWin used
+// before (reproduced here).
+//
+//     make bench/lines_bench
+//     taskset -c 0 bench/lines_bench
+//
+// Add BENCH_OPT=-O0 for the server's own build flags.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "../Lines.h"
+
+using Grid = bool[Lines::SIZE][Lines::SIZE];
+
+static const int DIRECTIONS[4][2] = {{0, 1}, {1, 0}, {1, 1}, {1, -1}};
+
+static bool stoneAt(const Grid& grid, int row, int col)
+{
+    return row >= 0 && row < Lines::SIZE && col >= 0 && col < Lines::SIZE && grid[row][col];
+}
+
+// The longest line through (row, col), counting the cell as a stone
+static int bruteLongestRun(const Grid& grid, int row, int col)
+{
+    int longest = 0;
+    for (const auto& d : DIRECTIONS) {
+        int count = 1;
+        for (int i = 1; stoneAt(grid, row + i * d[0], col + i * d[1]); i++) {
+            count++;
+        }
+        for (int i = 1; stoneAt(grid, row - i * d[0], col - i * d[1]); i++) {
+            count++;
+        }
+        longest = std::max(longest, count);
+    }
+    return longest;
+}
+
+static bool bruteHasFive(const Grid& grid)
+{
+    for (int row = 0; row < Lines::SIZE; row++) {
+        for (int col = 0; col < Lines::SIZE; col++) {
+            for (const auto& d : DIRECTIONS) {
+                int count = 0;
+                while (count < 5 && stoneAt(grid, row + count * d[0], col + count * d[1])) {
+                    count++;
+                }
+                if (count == 5) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+// The old Game::checkWin: up to four cells each way in each direction
+static bool cellWalk(const Grid& grid, int row, int col)
+{
+    for (const auto& d : DIRECTIONS) {
+        int count = 1;
+        for (int i = 1; i < 5 && stoneAt(grid, row + i * d[0], col + i * d[1]); i++) {
+            count++;
+        }
+        for (int i = 1; i < 5 && stoneAt(grid, row - i * d[0], col - i * d[1]); i++) {
+            count++;
+        }
+        if (count >= 5) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool scanByWalking(const Grid& grid)
+{
+    for (int row = 0; row < Lines::SIZE; row++) {
+        for (int col = 0; col < Lines::SIZE; col++) {
+            if (grid[row][col] && cellWalk(grid, row, col)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void fill(std::mt19937& rng, int density, Lines::Bits& stones, Grid& grid)
+{
+    memset(stones, 0, sizeof(stones));
+    memset(grid, 0, sizeof(grid));
+    for (int row = 0; row < Lines::SIZE; row++) {
+        for (int col = 0; col < Lines::SIZE; col++) {
+            if (static_cast<int>(rng() % 100) < density) {
+                grid[row][col] = true;
+                Lines::set(stones, row, col);
+            }
+        }
+    }
+}
+
+// Mismatches between the kernels and the brute-force walk
+static long check(std::mt19937& rng)
+{
+    const long BOARDS = 200000;
+    long wrong = 0;
+    Lines::Bits stones;
+    Grid grid;
+    for (long b = 0; b < BOARDS; b++) {
+        fill(rng, static_cast<int>(rng() % 91) + 5, stones, grid);
+        for (int w = 0; w < Lines::WORDS; w++) {
+            wrong += (stones[w] & 0x8000800080008000ULL) != 0;  // guard bits stay clear
+        }
+        bool five = bruteHasFive(grid);
+        wrong += Lines::hasFivePortable(stones) != five;
+        wrong += Lines::hasFive(stones) != five;
+#if defined(__x86_64__) || defined(__i386__)
+        if (Lines::HAVE_AVX2) {
+            wrong += Lines::hasFiveAvx2(stones) != five;
+        }
+#endif
+        for (int k = 0; k < 10; k++) {
+            int row = static_cast<int>(rng() % Lines::SIZE);
+            int col = static_cast<int>(rng() % Lines::SIZE);
+            int longest = bruteLongestRun(grid, row, col);
+            wrong += Lines::longestRun(stones, row, col) != longest;
+            wrong += Lines::makesFive(stones, row, col) != (longest >= 5);
+        }
+    }
+    printf("checked %ld boards, %ld mismatches\n", BOARDS, wrong);
+    return wrong;
+}
+
+// Keeps the compiler from hoisting work on the boards out of a repeat loop
+static void clobber(const void* p)
+{
+    asm volatile("" : : "r"(p) : "memory");
+}
+
+// Nanoseconds per item for run(), which does count items
+template <class Run>
+static double timePer(long count, Run run)
+{
+    auto start = std::chrono::steady_clock::now();
+    long result = run();
+    asm volatile("" : : "r"(result) : "memory");
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / count * 1e9;
+}
+
+int main()
+{
+    std::mt19937 rng(9);
+    if (check(rng) != 0) {
+        return 1;
+    }
+
+    const int BOARDS = 1024;
+    std::vector<Lines::Bits> boards(BOARDS);
+    std::vector<Grid> grids(BOARDS);
+    std::vector<std::vector<std::pair<int, int>>> stones(BOARDS);
+    long cells = 0;
+    for (int b = 0; b < BOARDS; b++) {
+        fill(rng, 35, boards[b], grids[b]);
+        for (int row = 0; row < Lines::SIZE; row++) {
+            for (int col = 0; col < Lines::SIZE; col++) {
+                if (grids[b][row][col]) {
+                    stones[b].push_back({row, col});
+                }
+            }
+        }
+        cells += static_cast<long>(stones[b].size());
+    }
+
+    // Every stone on every board, REPEATS times
+    const int REPEATS = 200;
+    auto perStone = [&](auto kernel) {
+        return timePer(cells * REPEATS, [&]() {
+            long sum = 0;
+            for (int k = 0; k < REPEATS; k++) {
+                clobber(boards.data());
+                for (int b = 0; b < BOARDS; b++) {
+                    for (auto [row, col] : stones[b]) {
+                        sum += kernel(b, row, col);
+                    }
+                }
+            }
+            return sum;
+        });
+    };
+    // Every board, SCANS times
+    const int SCANS = 20000;
+    auto perBoard = [&](int scans, auto scan) {
+        return timePer(static_cast<long>(scans) * BOARDS, [&]() {
+            long sum = 0;
+            for (int k = 0; k < scans; k++) {
+                clobber(boards.data());
+                for (int b = 0; b < BOARDS; b++) {
+                    sum += scan(b);
+                }
+            }
+            return sum;
+        });
+    };
+
+    printf("per stone, 35%% density:\n");
+    printf("  makesFive              %8.2f ns\n",
+           perStone([&](int b, int row, int col) { return Lines::makesFive(boards[b], row, col); }));
+    printf("  old cell walk          %8.2f ns\n",
+           perStone([&](int b, int row, int col) { return cellWalk(grids[b], row, col); }));
+    printf("  longestRun             %8.2f ns\n",
+           perStone([&](int b, int row, int col) { return Lines::longestRun(boards[b], row, col); }));
+    printf("per position:\n");
+    printf("  hasFive portable       %8.2f ns\n",
+           perBoard(SCANS, [&](int b) { return Lines::hasFivePortable(boards[b]); }));
+#if defined(__x86_64__) || defined(__i386__)
+    if (Lines::HAVE_AVX2) {
+        printf("  hasFive AVX2           %8.2f ns\n",
+               perBoard(SCANS, [&](int b) { return Lines::hasFiveAvx2(boards[b]); }));
+    }
+#endif
+    printf("  hasFive                %8.2f ns\n",
+           perBoard(SCANS, [&](int b) { return Lines::hasFive(boards[b]); }));
+    printf("  scan by cell walk      %8.2f ns\n",
+           perBoard(SCANS / 100, [&](int b) { return scanByWalking(grids[b]); }));
+    return 0;
+}
@@ -0,0 +1,72 @@
+# Allocations and round-trip time per request on the output path: a bot
+# ping answered with a pong, a WebSocket ping answered through the frame
+# filter, and a telnet "help" for comparison with the command path.
+#
+#     make bench/malloc_count.so
+#     LD_PRELOAD=bench/malloc_count.so taskset -c 0 ./gomoku_server --threads 1 \
+#         --command-rate 0 --chat-rate 0 &
+#     python3 bench/ping_allocs.py $! [requests]
+#
+# Add --io-uring to the server for the other backend. For a before and
+# after, run it against a build of each commit.
+import struct
+import sys
+import time
+
+import server
+
+PONG_BYTES = 7            # u16 length, type, u32 echoed back
+WEBSOCKET_PONG_BYTES = 6  # two byte header, four byte payload
+
+
+def bot_pings(sock, count):
+    buffered = b''
+    for i in range(count):
+        sock.sendall(server.bot_frame(9, struct.pack('>I', i)))
+        buffered = server.recv_exactly(sock, buffered, PONG_BYTES)
+
+
+def websocket_pings(sock, count):
+    buffered = b''
+    for _ in range(count):
+        sock.sendall(server.websocket_frame(9, b'ping'))
+        buffered = server.recv_exactly(sock, buffered, WEBSOCKET_PONG_BYTES)
+
+
+def telnet_lines(sock, line, reply_end, count):
+    buffered = b''
+    for _ in range(count):
+        sock.sendall(line)
+        while reply_end not in buffered:
+            buffered += sock.recv(65536)
+        buffered = buffered[buffered.index(reply_end) + len(reply_end):]
+
+
+def measure(pid, name, run, count):
+    run(count // 10)  # warm up the pools
+    before = server.malloc_count(pid)
+    started = time.perf_counter()
+    run(count)
+    elapsed = time.perf_counter() - started
+    allocations = server.malloc_count(pid) - before
+    print('%-15s %6.2f allocations/request, %6.1f us round trip'
+          % (name, allocations / count, elapsed / count * 1e6))
+
+
+def main():
+    pid = int(sys.argv[1])
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 20000
+
+    bot = server.bot()
+    measure(pid, 'bot ping', lambda n: bot_pings(bot, n), count)
+
+    ws = server.websocket()
+    measure(pid, 'websocket ping', lambda n: websocket_pings(ws, n), count)
+
+    # Far slower, so fewer of them
+    telnet = server.telnet()
+    measure(pid, 'telnet help', lambda n: telnet_lines(telnet, b'help\r\n', b'new user\n\r\n', n), count // 10)
+
+
+if __name__ == '__main__':
+    main()
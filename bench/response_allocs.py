@@ -0,0 +1,92 @@
+# Allocations and server CPU per response for the commands that render
+# the most text: who, game, refresh (the board) and listmail. Two players
+# start a game with an observer and exchange some mail first, so every
+# response has something in it.
+#
+#     make bench/malloc_count.so
+#     LD_PRELOAD=bench/malloc_count.so taskset -c 0 ./gomoku_server --threads 1 \
+#         --command-rate 0 --chat-rate 0 &
+#     python3 bench/response_allocs.py $! [responses]
+#
+import random
+import sys
+import time
+
+import server
+
+BATCH = 50
+
+# Each command with the end of its reply
+COMMANDS = [
+    ('who', b'guest\n\r\n'),
+    ('game', b']\n\r\n'),
+    ('refresh', b' seconds\r\n'),
+    ('listmail', b'\n\r\n'),
+]
+
+
+def command(sock, line):
+    sock.sendall(line.encode() + b'\r\n')
+    time.sleep(0.15)
+    return server.read_for(sock)
+
+
+def set_up():
+    """Returns the connection to measure on, then the others, which have
+    to stay open for the game to go on."""
+    tag = str(random.randint(1000, 9999))
+    black = server.telnet()
+    white = server.telnet()
+    observer = server.telnet()
+    command(black, 'register pa%s pw' % tag)
+    command(white, 'register pb%s pw' % tag)
+    started = command(black, 'match pb%s b' % tag).decode()
+    game = int(started.split('Game ')[1].split(' ')[0])
+    server.read_for(white)
+    for move, player in (('h8', black), ('a1', white), ('h9', black)):
+        command(player, move)
+    server.read_for(white)
+    command(observer, 'observe %d' % game)
+    for i in range(3):
+        command(white, 'mail pa%s note %d' % (tag, i))
+        command(white, 'body')
+        command(white, '.')
+    server.read_for(black)
+    black.settimeout(None)
+    return black, (white, observer)
+
+
+def run(sock, line, reply_end, count):
+    batch = (line + '\r\n').encode() * BATCH
+    buffered = b''
+    for _ in range(count // BATCH):
+        sock.sendall(batch)
+        replies = 0
+        while replies < BATCH:
+            buffered += sock.recv(1 << 20)
+            found = buffered.count(reply_end)
+            if found:
+                replies += found
+                buffered = buffered[buffered.rindex(reply_end) + len(reply_end):]
+
+
+def main():
+    pid = int(sys.argv[1])
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 20000
+    sock, others = set_up()
+
+    for line, reply_end in COMMANDS:
+        run(sock, line, reply_end, 500)
+        allocations = server.malloc_count(pid)
+        cpu = server.cpu_seconds(pid)
+        started = time.time()
+        run(sock, line, reply_end, count)
+        elapsed = time.time() - started
+        cpu = server.cpu_seconds(pid) - cpu
+        allocations = server.malloc_count(pid) - allocations
+        print('%-8s %6.2f allocations/response %6.2f us server CPU/response  (%d in %.2f s)'
+              % (line, allocations / count, cpu / count * 1e6, count, elapsed))
+
+
+if __name__ == '__main__':
+    main()
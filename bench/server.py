@@ -0,0 +1,93 @@
+# Helpers for the benchmark scripts in this directory: talking to a
+# running server on its default ports and reading what it has used.
+import os
+import signal
+import socket
+import struct
+import time
+
+HOST = '127.0.0.1'
+TELNET_PORT = 8023
+BINARY_PORT = 8024
+WEBSOCKET_PORT = 8025
+
+
+def malloc_count(pid):
+    """Allocations so far, from a server run under malloc_count.so."""
+    path = '/tmp/malloc_count.%d' % pid
+    os.kill(pid, signal.SIGUSR1)
+    time.sleep(0.2)
+    with open(path) as f:
+        return int(f.read())
+
+
+def cpu_seconds(pid):
+    """User plus system CPU time the server has used."""
+    with open('/proc/%d/stat' % pid) as f:
+        fields = f.read().rsplit(')', 1)[1].split()
+    return (int(fields[11]) + int(fields[12])) / os.sysconf('SC_CLK_TCK')
+
+
+def read_for(sock, wait=0.3):
+    """Whatever arrives until the connection goes quiet for wait seconds."""
+    data = b''
+    sock.settimeout(wait)
+    try:
+        while True:
+            chunk = sock.recv(65536)
+            if not chunk:
+                break
+            data += chunk
+    except socket.timeout:
+        pass
+    return data
+
+
+def telnet(login=b'guest'):
+    """A telnet connection, logged in as login."""
+    sock = socket.create_connection((HOST, TELNET_PORT))
+    read_for(sock)
+    if login:
+        sock.sendall(login + b'\r\n')
+        read_for(sock)
+    return sock
+
+
+def bot_frame(kind, payload=b''):
+    """A binary protocol frame: u16 length, type, payload."""
+    return struct.pack('>HB', len(payload) + 1, kind) + payload
+
+
+def bot():
+    sock = socket.create_connection((HOST, BINARY_PORT))
+    sock.settimeout(2)
+    return sock
+
+
+def websocket():
+    """A WebSocket connection past its handshake and welcome."""
+    sock = socket.create_connection((HOST, WEBSOCKET_PORT))
+    sock.sendall(b'GET /chat HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\n'
+                 b'Connection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n'
+                 b'Sec-WebSocket-Version: 13\r\n\r\n')
+    read_for(sock)
+    return sock
+
+
+def websocket_frame(opcode, payload):
+    """A masked, unfragmented frame, as a browser sends it."""
+    mask = os.urandom(4)
+    header = bytes([0x80 | opcode])
+    if len(payload) < 126:
+        header += bytes([0x80 | len(payload)])
+    else:
+        header += bytes([0x80 | 126]) + struct.pack('>H', len(payload))
+    return header + mask + bytes(b ^ mask[i % 4] for i, b in enumerate(payload))
+
+
+def recv_exactly(sock, buffered, length):
+    """length bytes, starting with those already in buffered; returns the
+    rest of the buffer."""
+    while len(buffered) < length:
+        buffered += sock.recv(65536)
+    return buffered[length:]
@@ -1,25 +1,125 @@
 #include <iostream>
 #include <signal.h>
+#include <cstdlib>
+#include <cstring>
 
 #include "TelnetServer.h"
 
 volatile sig_atomic_t shouldExit = 0;
+volatile sig_atomic_t shouldRestart = 0;
 
 void signalHandler(int signal)
 {
     shouldExit = 1;
 }
 
-int main()
+// SIGUSR2: hand the server over to a fresh copy of the binary
+void restartHandler(int)
+{
+    shouldRestart = 1;
+}
+
+int main(int argc, char* argv[])
 {
     // Set up signal handlers
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
+    signal(SIGUSR2, restartHandler);
 
-    int port = 8023;
+    ServerConfig config;
+
+    // Parse command line options
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+        {
+            config.port = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            config.reactorThreads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+        {
+            config.commandThreads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--backlog") == 0 && i + 1 < argc)
+        {
+            config.listenBacklog = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--binary-port") == 0 && i + 1 < argc)
+        {
+            config.binaryPort = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--ws-port") == 0 && i + 1 < argc)
+        {
+            config.webSocketPort = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--unix-socket") == 0 && i + 1 < argc)
+        {
+            config.unixSocketPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--bot-unix-socket") == 0 && i + 1 < argc)
+        {
+            config.binaryUnixSocketPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--trust-uid") == 0 && i + 1 < argc)
+        {
+            config.trustedUids.push_back(static_cast<uid_t>(atoi(argv[++i])));
+        }
+        else if (strcmp(argv[i], "--login-timeout") == 0 && i + 1 < argc)
+        {
+            config.timeouts.login = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--idle-timeout") == 0 && i + 1 < argc)
+        {
+            config.timeouts.idle = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--mail-timeout") == 0 && i + 1 < argc)
+        {
+            config.timeouts.mail = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--mail-deadline") == 0 && i + 1 < argc)
+        {
+            config.timeouts.mailDeadline = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--max-mail-body") == 0 && i + 1 < argc)
+        {
+            config.maxMailBody = static_cast<size_t>(atol(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--max-per-ip") == 0 && i + 1 < argc)
+        {
+            config.limits.connectionsPerAddress = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--chat-rate") == 0 && i + 1 < argc)
+        {
+            config.limits.chatPerSecond = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--command-rate") == 0 && i + 1 < argc)
+        {
+            config.limits.gamePerSecond = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--resume-fd") == 0 && i + 1 < argc)
+        {
+            config.resumeFd = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--io-uring") == 0)
+        {
+            config.ioBackend = IoBackend::IO_URING;
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--port N] [--threads N] [--workers N] [--backlog N] [--binary-port N] [--ws-port N] [--io-uring]"
+                      << " [--unix-socket PATH] [--bot-unix-socket PATH] [--trust-uid UID]"
+                      << " [--login-timeout S] [--idle-timeout S] [--mail-timeout S]"
+                      << " [--mail-deadline S] [--max-mail-body BYTES]"
+                      << " [--max-per-ip N] [--chat-rate R] [--command-rate R]" << std::endl;
+            return 1;
+        }
+    }
 
     TelnetServer server;
-    if (!server.start(port))
+    if (!server.start(config))
     {
         std::cerr << "Failed to start server" << std::endl;
         return 1;
@@ -31,6 +131,20 @@ int main()
     while (!shouldExit)
     {
         std::this_thread::sleep_for(std::chrono::seconds(1));
+
+        if (shouldRestart)
+        {
+            shouldRestart = 0;
+            if (server.hotRestart(argv))
+            {
+                // The new process owns the sockets and the user data now,
+                // so leave without running any destructors
+                std::cout << "Handed over to the new process" << std::endl;
+                std::cout.flush();
+                _exit(0);
+            }
+            std::cerr << "Hot restart failed, still serving" << std::endl;
+        }
     }
 
     std::cout << "Shutting down..." << std::endl;